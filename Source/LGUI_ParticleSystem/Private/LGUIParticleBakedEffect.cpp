@@ -0,0 +1,276 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#include "LGUIParticleBakedEffect.h"
+#include "LGUIWorldParticleSystemComponent.h"
+#include "Core/LGUIMesh/LGUIMeshComponent.h"
+#include "Core/LGUIIndexBuffer.h"
+#include "Core/ActorComponent/LGUICanvas.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+
+#if ENGINE_MAJOR_VERSION >= 5
+typedef FVector3f MyVector3;
+typedef FVector2f MyVector2;
+#else
+typedef FVector MyVector3;
+typedef FVector2D MyVector2;
+#endif
+
+DEFINE_LOG_CATEGORY_STATIC(LogLGUIParticleBake, Log, All);
+
+static FORCEINLINE float DecodeHalf(uint16 Encoded)
+{
+	FFloat16 Half;
+	Half.Encoded = Encoded;
+	return Half.GetFloat();
+}
+static FORCEINLINE uint16 EncodeHalf(float Value)
+{
+	return FFloat16(Value).Encoded;
+}
+
+bool FLGUIParticleBakedEntry::WriteMeshSection(int32 FrameIndex, FLGUIMeshSection* MeshSection, const FLGUIParticleRenderTransform& RenderTransform, float Alpha01, uint8 AdditionalChannels, int32& InOutIndexCount)const
+{
+	auto& Vertices = MeshSection->vertices;
+	auto& Triangles = MeshSection->triangles;
+	//allocate for the largest frame, so render resource is created once and every frame is only an update
+	if (Vertices.Num() != MaxVertexCount || Triangles.Num() != MaxIndexCount)
+	{
+		Vertices.SetNumZeroed(MaxVertexCount);
+		Triangles.SetNumZeroed(MaxIndexCount);
+		InOutIndexCount = 0;
+	}
+	const FLGUIParticleBakedFrame* Frame = Frames.IsValidIndex(FrameIndex) ? &Frames[FrameIndex] : nullptr;
+	const int32 VertexCount = Frame != nullptr ? FMath::Min(Frame->GetVertexCount(), MaxVertexCount) : 0;
+
+	//same as local space sprite: scale by component, rotate by -pitch, then offset
+	float Sin, Cos;
+	FMath::SinCos(&Sin, &Cos, FMath::DegreesToRadians(-RenderTransform.Rotation.Pitch));
+	const MyVector2 AxisX = MyVector2(Cos * RenderTransform.Scale.X, Sin * RenderTransform.Scale.X) * PositionStep;
+	const MyVector2 AxisY = MyVector2(-Sin * RenderTransform.Scale.Z, Cos * RenderTransform.Scale.Z) * PositionStep;
+	const MyVector2 Translation = MyVector2(RenderTransform.Location.X, RenderTransform.Location.Z);
+	const bool bWriteUV1 = (AdditionalChannels & (uint8)ELGUICanvasAdditionalChannelType::UV1) != 0;
+	const bool bWriteUV2 = (AdditionalChannels & (uint8)ELGUICanvasAdditionalChannelType::UV2) != 0;
+	const bool bHaveMaterialData = Frame != nullptr && Frame->MaterialData.Num() >= VertexCount * 4;
+	for (int32 i = 0; i < VertexCount; i++)
+	{
+		auto& Vertex = Vertices[i];
+		const MyVector2 Position = AxisX * Frame->Positions[i * 2] + AxisY * Frame->Positions[i * 2 + 1] + Translation;
+		Vertex.Position = MyVector3(0, Position.X, Position.Y);
+		Vertex.TextureCoordinate[0] = MyVector2(DecodeHalf(Frame->TextureCoordinates[i * 2]), DecodeHalf(Frame->TextureCoordinates[i * 2 + 1]));
+		Vertex.Color = Frame->Colors[i];
+		Vertex.Color.A = (uint8)FMath::RoundToInt(Vertex.Color.A * Alpha01);
+		if (bWriteUV1)
+		{
+			Vertex.TextureCoordinate[1] = bHaveMaterialData ? MyVector2(DecodeHalf(Frame->MaterialData[i * 4]), DecodeHalf(Frame->MaterialData[i * 4 + 1])) : MyVector2::ZeroVector;
+		}
+		if (bWriteUV2)
+		{
+			Vertex.TextureCoordinate[2] = bHaveMaterialData ? MyVector2(DecodeHalf(Frame->MaterialData[i * 4 + 2]), DecodeHalf(Frame->MaterialData[i * 4 + 3])) : MyVector2::ZeroVector;
+		}
+	}
+
+	//vertices after VertexCount keep old data, they are not referenced by any index
+	int32 IndexCount = 0;
+	if (bSprite)
+	{
+		IndexCount = FMath::Min(VertexCount / 4 * 6, MaxIndexCount);
+		if (IndexCount == InOutIndexCount)
+			return false;
+		for (int32 QuadIndex = InOutIndexCount / 6, QuadCount = IndexCount / 6; QuadIndex < QuadCount; QuadIndex++)
+		{
+			const int32 VertexIndex = QuadIndex * 4;
+			FLGUIIndexType* Indices = Triangles.GetData() + QuadIndex * 6;
+			Indices[0] = VertexIndex;
+			Indices[1] = VertexIndex + 1;
+			Indices[2] = VertexIndex + 2;
+
+			Indices[3] = VertexIndex + 2;
+			Indices[4] = VertexIndex + 1;
+			Indices[5] = VertexIndex + 3;
+		}
+	}
+	else
+	{
+		IndexCount = Frame != nullptr ? FMath::Min(Frame->Indices.Num(), MaxIndexCount) : 0;
+		if (IndexCount == 0 && InOutIndexCount == 0)
+			return false;
+		for (int32 i = 0; i < IndexCount; i++)
+		{
+			Triangles[i] = Frame->Indices[i];
+		}
+	}
+	if (IndexCount < InOutIndexCount)
+	{
+		FMemory::Memzero(Triangles.GetData() + IndexCount, (InOutIndexCount - IndexCount) * sizeof(FLGUIIndexType));
+	}
+	InOutIndexCount = IndexCount;
+	return true;
+}
+
+int32 ULGUIParticleBakedEffect::GetFrameIndex(float Time)const
+{
+	const int32 NumFrames = GetBakedFrameCount();
+	if (NumFrames == 0)
+		return INDEX_NONE;
+	const int32 FrameIndex = FMath::Max(FMath::FloorToInt(Time * FrameRate), 0);
+	if (FrameIndex < NumFrames)
+		return FrameIndex;
+	return bLoop ? FrameIndex % NumFrames : INDEX_NONE;
+}
+
+#if WITH_EDITOR
+void ULGUIParticleBakedEffect::Bake()
+{
+	if (!IsValid(SourceSystem))
+	{
+		UE_LOG(LogLGUIParticleBake, Error, TEXT("[ULGUIParticleBakedEffect::Bake]%s: SourceSystem is not assigned."), *GetName());
+		return;
+	}
+	UWorld* World = nullptr;
+	for (const FWorldContext& Context : GEngine->GetWorldContexts())
+	{
+		if (Context.WorldType == EWorldType::Editor && Context.World() != nullptr)
+		{
+			World = Context.World();
+			break;
+		}
+	}
+	if (World == nullptr)
+	{
+		UE_LOG(LogLGUIParticleBake, Error, TEXT("[ULGUIParticleBakedEffect::Bake]%s: No editor world to simulate in."), *GetName());
+		return;
+	}
+
+	FActorSpawnParameters SpawnParameters;
+	SpawnParameters.ObjectFlags |= RF_Transient;
+	auto WorldParticleActor = World->SpawnActor<ALGUIWorldParticleSystemActor>(SpawnParameters);
+	auto ParticleComponent = WorldParticleActor->Emit(SourceSystem, false);
+	//tick on calling thread, so data set is finalized when AdvanceSimulation return
+	ParticleComponent->SetForceSolo(true);
+	ParticleComponent->Activate(true);
+	const float DeltaTime = 1.f / FMath::Max(FrameRate, 1.f);
+	if (WarmupFrames > 0)
+	{
+		ParticleComponent->AdvanceSimulation(WarmupFrames, DeltaTime);
+	}
+
+	TArray<FLGUINiagaraRendererEntry> RenderEntries;
+	ParticleComponent->GetRenderEntries(RenderEntries);
+	//same as UIParticleSystem at origin, then playback apply its own transform
+	FLGUIParticleRenderTransform RenderTransform;
+	RenderTransform.bForceLocalSpace = true;
+	struct FBakeFrame
+	{
+		TArray<FDynamicMeshVertex> Vertices;
+		TArray<FLGUIIndexType> Indices;
+	};
+	TArray<FLGUIMeshSection> MeshSections;
+	MeshSections.SetNum(RenderEntries.Num());
+	TArray<TArray<FBakeFrame>> BakeFrames;
+	BakeFrames.SetNum(RenderEntries.Num());
+	for (int32 FrameIndex = 0; FrameIndex < FrameCount; FrameIndex++)
+	{
+		ParticleComponent->AdvanceSimulation(1, DeltaTime);
+		for (int32 EntryIndex = 0; EntryIndex < RenderEntries.Num(); EntryIndex++)
+		{
+			auto& Entry = RenderEntries[EntryIndex];
+			auto& MeshSection = MeshSections[EntryIndex];
+			ParticleComponent->RenderUI(&MeshSection, Entry, RenderTransform, 1.f, MyVector2::ZeroVector, 1.f, FLGUIParticleMeshCapacitySettings(), FLGUIParticleCullRect(), 0xFF);
+
+			auto& BakeFrame = BakeFrames[EntryIndex].AddDefaulted_GetRef();
+			int32 VertexCount = 0;
+			int32 IndexCount = 0;
+			if (Entry.BindingPlan.RendererType == ELGUIParticleRendererType::Sprite)
+			{
+				VertexCount = FMath::Min(Entry.EmittedParticleCount * 4, MeshSection.vertices.Num());
+			}
+			else
+			{
+				//unused capacity is zero triangles at the end
+				IndexCount = MeshSection.triangles.Num();
+				while (IndexCount >= 3 && MeshSection.triangles[IndexCount - 1] == 0 && MeshSection.triangles[IndexCount - 2] == 0 && MeshSection.triangles[IndexCount - 3] == 0)
+				{
+					IndexCount -= 3;
+				}
+				for (int32 i = 0; i < IndexCount; i++)
+				{
+					VertexCount = FMath::Max(VertexCount, (int32)MeshSection.triangles[i] + 1);
+				}
+				if (VertexCount > (int32)TNumericLimits<uint16>::Max())
+				{
+					UE_LOG(LogLGUIParticleBake, Warning, TEXT("[ULGUIParticleBakedEffect::Bake]%s: Ribbon have %d vertices in frame %d, more than baked index can address, frame is left empty."), *GetName(), VertexCount, FrameIndex);
+					VertexCount = 0;
+					IndexCount = 0;
+				}
+				BakeFrame.Indices.Append(MeshSection.triangles.GetData(), IndexCount);
+			}
+			BakeFrame.Vertices.Append(MeshSection.vertices.GetData(), VertexCount);
+		}
+	}
+	WorldParticleActor->Destroy();
+
+	//quantize
+	Entries.Reset();
+	int64 BakedBytes = 0;
+	for (int32 EntryIndex = 0; EntryIndex < RenderEntries.Num(); EntryIndex++)
+	{
+		auto& BakedEntry = Entries.AddDefaulted_GetRef();
+		BakedEntry.Material = RenderEntries[EntryIndex].Material;
+		BakedEntry.bSprite = RenderEntries[EntryIndex].BindingPlan.RendererType == ELGUIParticleRendererType::Sprite;
+		float MaxAbsPosition = 0.f;
+		for (auto& BakeFrame : BakeFrames[EntryIndex])
+		{
+			for (auto& Vertex : BakeFrame.Vertices)
+			{
+				MaxAbsPosition = FMath::Max3(MaxAbsPosition, FMath::Abs((float)Vertex.Position.Y), FMath::Abs((float)Vertex.Position.Z));
+			}
+		}
+		BakedEntry.PositionStep = MaxAbsPosition > 0.f ? MaxAbsPosition / TNumericLimits<int16>::Max() : 1.f;
+		const float InvPositionStep = 1.f / BakedEntry.PositionStep;
+
+		for (auto& BakeFrame : BakeFrames[EntryIndex])
+		{
+			auto& Frame = BakedEntry.Frames.AddDefaulted_GetRef();
+			const int32 VertexCount = BakeFrame.Vertices.Num();
+			Frame.Positions.SetNumUninitialized(VertexCount * 2);
+			Frame.TextureCoordinates.SetNumUninitialized(VertexCount * 2);
+			Frame.Colors.SetNumUninitialized(VertexCount);
+			bool bHaveMaterialData = false;
+			for (int32 i = 0; i < VertexCount; i++)
+			{
+				const auto& Vertex = BakeFrame.Vertices[i];
+				Frame.Positions[i * 2] = (int16)FMath::Clamp(FMath::RoundToInt(Vertex.Position.Y * InvPositionStep), -32767, 32767);
+				Frame.Positions[i * 2 + 1] = (int16)FMath::Clamp(FMath::RoundToInt(Vertex.Position.Z * InvPositionStep), -32767, 32767);
+				Frame.TextureCoordinates[i * 2] = EncodeHalf(Vertex.TextureCoordinate[0].X);
+				Frame.TextureCoordinates[i * 2 + 1] = EncodeHalf(Vertex.TextureCoordinate[0].Y);
+				Frame.Colors[i] = Vertex.Color;
+				bHaveMaterialData |= Vertex.TextureCoordinate[1] != MyVector2::ZeroVector || Vertex.TextureCoordinate[2] != MyVector2::ZeroVector;
+			}
+			if (bHaveMaterialData)
+			{
+				Frame.MaterialData.SetNumUninitialized(VertexCount * 4);
+				for (int32 i = 0; i < VertexCount; i++)
+				{
+					const auto& Vertex = BakeFrame.Vertices[i];
+					Frame.MaterialData[i * 4] = EncodeHalf(Vertex.TextureCoordinate[1].X);
+					Frame.MaterialData[i * 4 + 1] = EncodeHalf(Vertex.TextureCoordinate[1].Y);
+					Frame.MaterialData[i * 4 + 2] = EncodeHalf(Vertex.TextureCoordinate[2].X);
+					Frame.MaterialData[i * 4 + 3] = EncodeHalf(Vertex.TextureCoordinate[2].Y);
+				}
+			}
+			Frame.Indices.SetNumUninitialized(BakeFrame.Indices.Num());
+			for (int32 i = 0; i < BakeFrame.Indices.Num(); i++)
+			{
+				Frame.Indices[i] = (uint16)BakeFrame.Indices[i];
+			}
+			BakedEntry.MaxVertexCount = FMath::Max(BakedEntry.MaxVertexCount, VertexCount);
+			BakedEntry.MaxIndexCount = FMath::Max(BakedEntry.MaxIndexCount, BakedEntry.bSprite ? VertexCount / 4 * 6 : Frame.Indices.Num());
+			BakedBytes += Frame.Positions.Num() * sizeof(int16) + Frame.TextureCoordinates.Num() * sizeof(uint16) + Frame.Colors.Num() * sizeof(FColor)
+				+ Frame.MaterialData.Num() * sizeof(uint16) + Frame.Indices.Num() * sizeof(uint16);
+		}
+	}
+	MarkPackageDirty();
+	UE_LOG(LogLGUIParticleBake, Log, TEXT("[ULGUIParticleBakedEffect::Bake]%s: Baked %d frames of %d render entries, %lld bytes."), *GetName(), FrameCount, Entries.Num(), BakedBytes);
+}
+#endif
@@ -0,0 +1,809 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#include "CoreMinimal.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+#include "LGUIParticleSpriteBuilder.h"
+#include "LGUIParticleRibbonBuilder.h"
+#include "LGUIParticleCapture.h"
+#include "LGUIParticleBakedEffect.h"
+#include "Core/LGUIMesh/LGUIMeshComponent.h"
+#include "UIParticleSystem.h"
+#include "Misc/Paths.h"
+#include "Misc/AutomationTest.h"
+
+/**
+ * Benchmark of the mesh builders with synthetic particle data, no world or niagara system is needed, so it can run with -nullrhi:
+ *		UnrealEditor-Cmd <Project> -nullrhi -ExecCmds="lgui.ParticleSystem.Benchmark 10000 100, quit"
+ * Sprite kernels and fast-math sin/cos are checked against the scalar reference, ribbon radix sort is checked against Algo::Sort,
+ * both builders are checked against hand computed golden vertices, and baked frames are decoded the way UIParticleSystem play them.
+ * The same checks run as automation tests "LGUI.ParticleSystem.Builders".
+ * lgui.ParticleSystem.Replay run mesh build and upload of UIParticleSystem with particle data and build inputs captured from live game by lgui.ParticleSystem.Capture,
+ * and check sprite kernels with it.
+ */
+
+DEFINE_LOG_CATEGORY_STATIC(LogLGUIParticleBenchmark, Log, All);
+
+/** Synthetic SoA sprite particles */
+struct FLGUIBenchmarkSpriteData
+{
+	TArray<float> Data;
+	FLGUISpriteParticleStreams Streams;
+
+	void Init(int32 Count, int32 Seed)
+	{
+		FRandomStream Random(Seed);
+		const float** StreamPointers[FLGUISpriteParticleStreams::NumStreams];
+		Streams.GetStreamPointers(StreamPointers);
+		Data.SetNumUninitialized(Count * FLGUISpriteParticleStreams::NumStreams);
+		for (int32 StreamIndex = 0; StreamIndex < FLGUISpriteParticleStreams::NumStreams; StreamIndex++)
+		{
+			float* Stream = Data.GetData() + StreamIndex * Count;
+			for (int32 i = 0; i < Count; i++)
+			{
+				Stream[i] = Random.FRandRange(-500.f, 500.f);
+			}
+			*StreamPointers[StreamIndex] = Stream;
+		}
+		//color in 0-1, size positive, subimage index positive
+		for (const float* Stream : { Streams.ColorR, Streams.ColorG, Streams.ColorB, Streams.ColorA })
+		{
+			for (int32 i = 0; i < Count; i++)
+			{
+				((float*)Stream)[i] = FMath::Frac(FMath::Abs(Stream[i]));
+			}
+		}
+		for (const float* Stream : { Streams.SizeX, Streams.SizeY, Streams.SubImage })
+		{
+			for (int32 i = 0; i < Count; i++)
+			{
+				((float*)Stream)[i] = FMath::Abs(Stream[i]) * 0.1f;
+			}
+		}
+		Streams.Count = Count;
+	}
+};
+
+static void MakeBenchmarkSpriteParams(FLGUISpriteBuildParams& Params, bool bLocalSpace, bool bVelocityAligned, bool bUseSubImage)
+{
+	Params = FLGUISpriteBuildParams();
+	Params.bLocalSpace = bLocalSpace;
+	if (bLocalSpace)
+	{
+		float Sin, Cos;
+		FMath::SinCos(&Sin, &Cos, FMath::DegreesToRadians(30.f));
+		Params.AxisX = MyVector2(Cos * 1.5f, Sin * 1.5f);
+		Params.AxisY = MyVector2(-Sin * 0.8f, Cos * 0.8f);
+		Params.Translation = MyVector2(100.f, -50.f);
+		Params.SizeScale = MyVector2(1.5f, 0.8f);
+		Params.ComponentPitch = 30.f;
+	}
+	Params.Alpha01 = 0.75f;
+	Params.bVelocityAligned = bVelocityAligned;
+	Params.bUseSubImage = bUseSubImage;
+	Params.SubImageSize = bUseSubImage ? MyVector2(4.f, 4.f) : MyVector2(1.f, 1.f);
+	Params.SubImageDelta = MyVector2::UnitVector / Params.SubImageSize;
+}
+
+/** Largest difference between two vertex buffers */
+struct FLGUIBenchmarkVertexError
+{
+	/** Position distance */
+	float Position = 0.f;
+	/** Color channel difference, of all channels */
+	int32 Color = 0;
+	/** Component difference of uv0, uv1 and uv2 */
+	float TextureCoordinate = 0.f;
+
+	void Compare(const FDynamicMeshVertex* A, const FDynamicMeshVertex* B, int32 VertexCount)
+	{
+		for (int32 i = 0; i < VertexCount; i++)
+		{
+			Position = FMath::Max(Position, (float)(A[i].Position - B[i].Position).Size());
+			Color = FMath::Max(Color, FMath::Abs((int32)A[i].Color.R - (int32)B[i].Color.R));
+			Color = FMath::Max(Color, FMath::Abs((int32)A[i].Color.G - (int32)B[i].Color.G));
+			Color = FMath::Max(Color, FMath::Abs((int32)A[i].Color.B - (int32)B[i].Color.B));
+			Color = FMath::Max(Color, FMath::Abs((int32)A[i].Color.A - (int32)B[i].Color.A));
+			for (int32 Channel = 0; Channel < 3; Channel++)
+			{
+				TextureCoordinate = FMath::Max(TextureCoordinate, (float)FMath::Abs(A[i].TextureCoordinate[Channel].X - B[i].TextureCoordinate[Channel].X));
+				TextureCoordinate = FMath::Max(TextureCoordinate, (float)FMath::Abs(A[i].TextureCoordinate[Channel].Y - B[i].TextureCoordinate[Channel].Y));
+			}
+		}
+	}
+	/** Vectorized kernel use different sin/cos and sqrt, allow small error relative to position range */
+	bool IsWithinKernelTolerance()const
+	{
+		return Position < 0.05f && Color <= 1 && TextureCoordinate < 1e-4f;
+	}
+};
+
+template<typename FunctionType>
+static double MeasureSeconds(int32 Iterations, FunctionType&& Function)
+{
+	const double StartTime = FPlatformTime::Seconds();
+	for (int32 i = 0; i < Iterations; i++)
+	{
+		Function();
+	}
+	return (FPlatformTime::Seconds() - StartTime) / Iterations;
+}
+
+static bool RunSpriteBenchmark(int32 ParticleCount, int32 Iterations)
+{
+	bool bAllPass = true;
+	FLGUIBenchmarkSpriteData SpriteData;
+	SpriteData.Init(ParticleCount, 1);
+	TArray<FDynamicMeshVertex> ScalarVertices, VectorizedVertices, FastMathVertices;
+	ScalarVertices.SetNumZeroed(ParticleCount * 4);
+	VectorizedVertices.SetNumZeroed(ParticleCount * 4);
+	FastMathVertices.SetNumZeroed(ParticleCount * 4);
+	const int64 BytesWritten = (int64)ParticleCount * 4 * sizeof(FDynamicMeshVertex);
+
+	for (int32 Case = 0; Case < 8; Case++)
+	{
+		const bool bLocalSpace = (Case & 1) != 0;
+		const bool bVelocityAligned = (Case & 2) != 0;
+		const bool bUseSubImage = (Case & 4) != 0;
+		FLGUISpriteBuildParams Params;
+		MakeBenchmarkSpriteParams(Params, bLocalSpace, bVelocityAligned, bUseSubImage);
+
+		const double ScalarSeconds = MeasureSeconds(Iterations, [&] { LGUIParticleSpriteBuilder::BuildScalar(SpriteData.Streams, Params, 0, ParticleCount, ScalarVertices.GetData()); });
+		const double VectorizedSeconds = MeasureSeconds(Iterations, [&] { LGUIParticleSpriteBuilder::BuildVectorized(SpriteData.Streams, Params, 0, ParticleCount, VectorizedVertices.GetData()); });
+		FLGUIBenchmarkVertexError Error;
+		Error.Compare(ScalarVertices.GetData(), VectorizedVertices.GetData(), ScalarVertices.Num());
+		Params.bFastMath = true;
+		const double FastMathSeconds = MeasureSeconds(Iterations, [&] { LGUIParticleSpriteBuilder::BuildVectorized(SpriteData.Streams, Params, 0, ParticleCount, FastMathVertices.GetData()); });
+		FLGUIBenchmarkVertexError FastMathError;
+		FastMathError.Compare(ScalarVertices.GetData(), FastMathVertices.GetData(), ScalarVertices.Num());
+		const bool bPass = Error.IsWithinKernelTolerance() && FastMathError.IsWithinKernelTolerance();
+		bAllPass &= bPass;
+
+		UE_LOG(LogLGUIParticleBenchmark, Log, TEXT("Sprite %s%s%s: scalar %.2f ns/particle, vectorized %.2f ns/particle, fast-math %.2f ns/particle, %lld bytes written, max error position %f (fast-math %f) color %d uv %g: %s")
+			, bLocalSpace ? TEXT("local") : TEXT("world")
+			, bVelocityAligned ? TEXT(" velocity-aligned") : TEXT("")
+			, bUseSubImage ? TEXT(" subimage") : TEXT("")
+			, ScalarSeconds * 1e9 / ParticleCount, VectorizedSeconds * 1e9 / ParticleCount, FastMathSeconds * 1e9 / ParticleCount
+			, BytesWritten, Error.Position, FastMathError.Position, FMath::Max(Error.Color, FastMathError.Color), FMath::Max(Error.TextureCoordinate, FastMathError.TextureCoordinate)
+			, bPass ? TEXT("PASS") : TEXT("FAIL"));
+	}
+
+	//most ui sprites: world space, rotation and dynamic material not bound, no subimage. Compare with the variant that do everything
+	{
+		FLGUISpriteParticleStreams PlainStreams = SpriteData.Streams;
+		PlainStreams.Rotation = nullptr;
+		for (auto& Stream : PlainStreams.DynamicMaterial)
+		{
+			Stream = nullptr;
+		}
+		FLGUISpriteBuildParams PlainParams;
+		MakeBenchmarkSpriteParams(PlainParams, false, false, false);
+		PlainParams.bWriteMaterialDataUV1 = PlainParams.bWriteMaterialDataUV2 = false;
+		FLGUISpriteBuildParams FullParams;
+		MakeBenchmarkSpriteParams(FullParams, true, false, true);
+
+		const double ScalarSeconds = MeasureSeconds(Iterations, [&] { LGUIParticleSpriteBuilder::BuildScalar(PlainStreams, PlainParams, 0, ParticleCount, ScalarVertices.GetData()); });
+		const double PlainSeconds = MeasureSeconds(Iterations, [&] { LGUIParticleSpriteBuilder::BuildVectorized(PlainStreams, PlainParams, 0, ParticleCount, VectorizedVertices.GetData()); });
+		FLGUIBenchmarkVertexError Error;
+		Error.Compare(ScalarVertices.GetData(), VectorizedVertices.GetData(), ScalarVertices.Num());
+		const double FullSeconds = MeasureSeconds(Iterations, [&] { LGUIParticleSpriteBuilder::BuildVectorized(SpriteData.Streams, FullParams, 0, ParticleCount, FastMathVertices.GetData()); });
+		const bool bPass = Error.IsWithinKernelTolerance();
+		bAllPass &= bPass;
+		UE_LOG(LogLGUIParticleBenchmark, Log, TEXT("Sprite world unrotated: scalar %.2f ns/particle, vectorized %.2f ns/particle, vectorized with all features %.2f ns/particle, max error position %f color %d uv %g: %s")
+			, ScalarSeconds * 1e9 / ParticleCount, PlainSeconds * 1e9 / ParticleCount, FullSeconds * 1e9 / ParticleCount
+			, Error.Position, Error.Color, Error.TextureCoordinate
+			, bPass ? TEXT("PASS") : TEXT("FAIL"));
+	}
+
+	//local space with rotation not bound: constant rotation variant
+	{
+		FLGUISpriteParticleStreams UnrotatedStreams = SpriteData.Streams;
+		UnrotatedStreams.Rotation = nullptr;
+		FLGUISpriteBuildParams LocalParams;
+		MakeBenchmarkSpriteParams(LocalParams, true, false, false);
+
+		const double ScalarSeconds = MeasureSeconds(Iterations, [&] { LGUIParticleSpriteBuilder::BuildScalar(UnrotatedStreams, LocalParams, 0, ParticleCount, ScalarVertices.GetData()); });
+		const double VectorizedSeconds = MeasureSeconds(Iterations, [&] { LGUIParticleSpriteBuilder::BuildVectorized(UnrotatedStreams, LocalParams, 0, ParticleCount, VectorizedVertices.GetData()); });
+		FLGUIBenchmarkVertexError Error;
+		Error.Compare(ScalarVertices.GetData(), VectorizedVertices.GetData(), ScalarVertices.Num());
+		const bool bPass = Error.IsWithinKernelTolerance();
+		bAllPass &= bPass;
+		UE_LOG(LogLGUIParticleBenchmark, Log, TEXT("Sprite local constant rotation: scalar %.2f ns/particle, vectorized %.2f ns/particle, max error position %f color %d uv %g: %s")
+			, ScalarSeconds * 1e9 / ParticleCount, VectorizedSeconds * 1e9 / ParticleCount
+			, Error.Position, Error.Color, Error.TextureCoordinate
+			, bPass ? TEXT("PASS") : TEXT("FAIL"));
+	}
+
+	//cull half of the particles
+	FLGUISpriteBuildParams Params;
+	MakeBenchmarkSpriteParams(Params, false, false, false);
+	FLGUIParticleCullRect CullRect;
+	CullRect.bEnable = true;
+	CullRect.Min = MyVector2(-500.f, -500.f);
+	CullRect.Max = MyVector2(0.f, 500.f);
+	TArray<float> CullScratch;
+	int32 SurvivedCount = 0;
+	const double CullSeconds = MeasureSeconds(Iterations, [&]
+		{
+			FLGUISpriteParticleStreams Streams = SpriteData.Streams;
+			SurvivedCount = LGUIParticleSpriteBuilder::CullAndCompact(Streams, Params, CullRect, 1, CullScratch);
+		});
+	UE_LOG(LogLGUIParticleBenchmark, Log, TEXT("Sprite cull: %.2f ns/particle, %d of %d survived"), CullSeconds * 1e9 / ParticleCount, SurvivedCount, ParticleCount);
+	return bAllPass;
+}
+
+/** Fast-math sin/cos against FMath::SinCos, over a dense sweep and large angles */
+static bool RunSinCosFastBenchmark(int32 Iterations)
+{
+	TArray<float> Degrees;
+	for (float Angle = -1080.f; Angle <= 1080.f; Angle += 0.0625f)
+	{
+		Degrees.Add(Angle);
+	}
+	for (const float Angle : { 90.f, 180.f, 270.f, 360.f, -90.f, -180.f, -270.f, -360.f })
+	{
+		Degrees.Add(Angle);
+	}
+	while (Degrees.Num() % 4 != 0)
+	{
+		Degrees.Add(0.f);
+	}
+	const int32 Count = Degrees.Num();
+	TArray<float> FastSin, FastCos, ReferenceSin, ReferenceCos;
+	FastSin.SetNumUninitialized(Count);
+	FastCos.SetNumUninitialized(Count);
+	ReferenceSin.SetNumUninitialized(Count);
+	ReferenceCos.SetNumUninitialized(Count);
+
+	const double FastSeconds = MeasureSeconds(Iterations, [&]
+		{
+			for (int32 i = 0; i < Count; i += 4)
+			{
+				LGUIParticleSpriteBuilder::SinCosDegreesFast(Degrees.GetData() + i, FastSin.GetData() + i, FastCos.GetData() + i);
+			}
+		});
+	const double ReferenceSeconds = MeasureSeconds(Iterations, [&]
+		{
+			for (int32 i = 0; i < Count; i++)
+			{
+				FMath::SinCos(&ReferenceSin[i], &ReferenceCos[i], FMath::DegreesToRadians(Degrees[i]));
+			}
+		});
+
+	float MaxError = 0.f;
+	for (int32 i = 0; i < Count; i++)
+	{
+		MaxError = FMath::Max(MaxError, FMath::Abs(FastSin[i] - ReferenceSin[i]));
+		MaxError = FMath::Max(MaxError, FMath::Abs(FastCos[i] - ReferenceCos[i]));
+	}
+	//polynomial error is 8e-6, the rest is float rounding of range reduction
+	const bool bPass = MaxError < 2e-5f;
+	UE_LOG(LogLGUIParticleBenchmark, Log, TEXT("Sprite rotation sin/cos of %d angles: fast-math %.2f ns/angle, reference %.2f ns/angle, max error %g: %s")
+		, Count, FastSeconds * 1e9 / Count, ReferenceSeconds * 1e9 / Count, MaxError
+		, bPass ? TEXT("PASS") : TEXT("FAIL"));
+	return bPass;
+}
+
+static bool RunRibbonSortBenchmark(int32 ParticleCount, int32 RibbonCount, int32 Iterations)
+{
+	FRandomStream Random(2);
+	FLGUIRibbonSortScratch Scratch;
+	Scratch.SortKeys.SetNumUninitialized(ParticleCount);
+	Scratch.RibbonKeys.SetNumUninitialized(ParticleCount);
+	TArray<float> SortKeyValues;
+	TArray<int32> RibbonValues;
+	SortKeyValues.SetNumUninitialized(ParticleCount);
+	RibbonValues.SetNumUninitialized(ParticleCount);
+	for (int32 i = 0; i < ParticleCount; i++)
+	{
+		SortKeyValues[i] = Random.FRandRange(-100.f, 100.f);
+		RibbonValues[i] = Random.RandHelper(FMath::Max(RibbonCount, 1));
+		Scratch.SortKeys[i] = LGUIParticleRibbonBuilder::MakeSortableFloatKey(SortKeyValues[i]);
+		Scratch.RibbonKeys[i] = LGUIParticleRibbonBuilder::MakeSortableRibbonKey(RibbonValues[i], 0);
+	}
+
+	const double RadixSeconds = MeasureSeconds(Iterations, [&] { LGUIParticleRibbonBuilder::SortRibbonParticles(Scratch, ParticleCount, true); });
+
+	TArray<int32> ReferenceIndices;
+	const double ReferenceSeconds = MeasureSeconds(Iterations, [&]
+		{
+			ReferenceIndices.Reset();
+			for (int32 i = 0; i < ParticleCount; i++)
+			{
+				ReferenceIndices.Add(i);
+			}
+			ReferenceIndices.Sort([&](int32 A, int32 B) { return RibbonValues[A] != RibbonValues[B] ? RibbonValues[A] < RibbonValues[B] : SortKeyValues[A] < SortKeyValues[B]; });
+		});
+
+	//ties may be ordered differently, so compare keys instead of indices
+	bool bPass = Scratch.SortedIndices.Num() == ReferenceIndices.Num();
+	for (int32 i = 0; bPass && i < ParticleCount; i++)
+	{
+		const int32 A = Scratch.SortedIndices[i], B = ReferenceIndices[i];
+		bPass = RibbonValues[A] == RibbonValues[B] && SortKeyValues[A] == SortKeyValues[B];
+	}
+	UE_LOG(LogLGUIParticleBenchmark, Log, TEXT("Ribbon sort %d points in %d ribbons: radix %.2f ns/point, reference %.2f ns/point, found %d ribbons: %s")
+		, ParticleCount, RibbonCount
+		, RadixSeconds * 1e9 / ParticleCount, ReferenceSeconds * 1e9 / ParticleCount
+		, Scratch.RibbonOffsets.Num() - 1
+		, bPass ? TEXT("PASS") : TEXT("FAIL"));
+	return bPass;
+}
+
+/** Synthetic ribbons, each one a wave along X. Points of a ribbon are consecutive particles, so SortedIndices is identity */
+struct FLGUIBenchmarkRibbonData
+{
+	TArray<float> Data;
+	TArray<int32> SortedIndices;
+	TArray<int32> RibbonOffsets;
+	FLGUIRibbonParticleStreams Streams;
+
+	void Init(int32 RibbonCount, int32 PointsPerRibbon, int32 Seed)
+	{
+		FRandomStream Random(Seed);
+		const int32 Count = RibbonCount * PointsPerRibbon;
+		Data.SetNumUninitialized(Count * 7);
+		float* PositionX = Data.GetData();
+		float* PositionZ = PositionX + Count;
+		float* Width = PositionZ + Count;
+		float* Color = Width + Count;
+		SortedIndices.SetNumUninitialized(Count);
+		RibbonOffsets.Reset();
+		for (int32 RibbonIndex = 0; RibbonIndex < RibbonCount; RibbonIndex++)
+		{
+			RibbonOffsets.Add(RibbonIndex * PointsPerRibbon);
+			const float Phase = Random.FRandRange(0.f, 2.f * PI);
+			const float Height = Random.FRandRange(-500.f, 500.f);
+			for (int32 PointIndex = 0; PointIndex < PointsPerRibbon; PointIndex++)
+			{
+				const int32 i = RibbonIndex * PointsPerRibbon + PointIndex;
+				PositionX[i] = PointIndex * 4.f;
+				PositionZ[i] = Height + FMath::Sin(Phase + PointIndex * 0.1f) * 20.f;
+				Width[i] = Random.FRandRange(1.f, 10.f);
+				for (int32 Channel = 0; Channel < 4; Channel++)
+				{
+					Color[Channel * Count + i] = Random.FRand();
+				}
+				SortedIndices[i] = i;
+			}
+		}
+		RibbonOffsets.Add(Count);
+		Streams.PositionX = PositionX;
+		Streams.PositionZ = PositionZ;
+		Streams.Width = Width;
+		Streams.ColorR = Color;
+		Streams.ColorG = Color + Count;
+		Streams.ColorB = Color + Count * 2;
+		Streams.ColorA = Color + Count * 3;
+		Streams.Count = Count;
+	}
+};
+
+static bool RunRibbonBuildBenchmark(int32 ParticleCount, int32 RibbonCount, int32 Iterations)
+{
+	const int32 PointsPerRibbon = FMath::Max(ParticleCount / RibbonCount, 3);
+	FLGUIBenchmarkRibbonData RibbonData;
+	RibbonData.Init(RibbonCount, PointsPerRibbon, 3);
+	const int32 PointCount = RibbonData.Streams.Count;
+	TArray<FDynamicMeshVertex> Vertices;
+	TArray<FLGUIIndexType> Indices;
+	Vertices.SetNumZeroed(PointCount * 2);
+	Indices.SetNumZeroed(PointCount * 6);
+
+	bool bAllPass = true;
+	for (int32 Case = 0; Case < 4; Case++)
+	{
+		const bool bLocalSpace = (Case & 1) != 0;
+		const bool bTiled = (Case & 2) != 0;
+		FLGUIRibbonBuildParams Params;
+		if (bLocalSpace)
+		{
+			float Sin, Cos;
+			FMath::SinCos(&Sin, &Cos, FMath::DegreesToRadians(30.f));
+			Params.AxisX = MyVector2(Cos * 1.5f, Sin * 1.5f);
+			Params.AxisY = MyVector2(-Sin * 0.8f, Cos * 0.8f);
+			Params.Translation = MyVector2(100.f, -50.f);
+		}
+		Params.Alpha01 = 0.75f;
+		Params.UV0TilingLength = Params.UV1TilingLength = bTiled ? 50.f : 0.f;
+		Params.bWriteUV1 = true;
+
+		int32 VertexCount = 0, IndexCount = 0;
+		const double Seconds = MeasureSeconds(Iterations, [&]
+			{
+				VertexCount = IndexCount = 0;
+				for (int32 RibbonIndex = 0; RibbonIndex < RibbonCount; RibbonIndex++)
+				{
+					const int32 RibbonStart = RibbonData.RibbonOffsets[RibbonIndex];
+					LGUIParticleRibbonBuilder::BuildRibbon(RibbonData.Streams, Params, RibbonData.SortedIndices.GetData() + RibbonStart, RibbonData.RibbonOffsets[RibbonIndex + 1] - RibbonStart
+						, Vertices.GetData(), Indices.GetData(), VertexCount, IndexCount);
+				}
+			});
+		//every index must point to a vertex of this build, and no vertex is NaN
+		bool bPass = VertexCount == RibbonCount * (PointsPerRibbon - 1) * 2 && IndexCount == RibbonCount * (PointsPerRibbon - 2) * 6;
+		for (int32 i = 0; bPass && i < IndexCount; i++)
+		{
+			bPass = Indices[i] < VertexCount;
+		}
+		for (int32 i = 0; bPass && i < VertexCount; i++)
+		{
+			bPass = !Vertices[i].Position.ContainsNaN();
+		}
+		bAllPass &= bPass;
+		UE_LOG(LogLGUIParticleBenchmark, Log, TEXT("Ribbon build %s%s %d points in %d ribbons: %.2f ns/point, %lld bytes written: %s")
+			, bLocalSpace ? TEXT("local") : TEXT("world")
+			, bTiled ? TEXT(" tiled-uv") : TEXT("")
+			, PointCount, RibbonCount, Seconds * 1e9 / PointCount
+			, (int64)VertexCount * sizeof(FDynamicMeshVertex) + (int64)IndexCount * sizeof(FLGUIIndexType)
+			, bPass ? TEXT("PASS") : TEXT("FAIL"));
+	}
+	return bAllPass;
+}
+
+/** Check one vertex against hand computed values */
+static bool CheckGoldenVertex(const FDynamicMeshVertex& Vertex, const MyVector2& Position, const FColor& Color, const MyVector2& UV0)
+{
+	return FMath::IsNearlyEqual((float)Vertex.Position.X, 0.f, 1e-4f)
+		&& FMath::IsNearlyEqual((float)Vertex.Position.Y, (float)Position.X, 1e-4f)
+		&& FMath::IsNearlyEqual((float)Vertex.Position.Z, (float)Position.Y, 1e-4f)
+		&& FMath::Abs((int32)Vertex.Color.R - (int32)Color.R) <= 1 && FMath::Abs((int32)Vertex.Color.G - (int32)Color.G) <= 1
+		&& FMath::Abs((int32)Vertex.Color.B - (int32)Color.B) <= 1 && FMath::Abs((int32)Vertex.Color.A - (int32)Color.A) <= 1
+		&& FMath::IsNearlyEqual((float)Vertex.TextureCoordinate[0].X, (float)UV0.X, 1e-4f)
+		&& FMath::IsNearlyEqual((float)Vertex.TextureCoordinate[0].Y, (float)UV0.Y, 1e-4f);
+}
+
+/**
+ * Builders against hand computed output, so the scalar reference itself is checked, not only kernels against it.
+ * Sprite: particle at (10, 20) size (4, 2), color (1, 0.5, 0, 1) with Alpha01 0.5, world space. 4 same particles so the vectorized loop is used.
+ * Ribbon: straight ribbon (0, 0), (10, 0), (20, 0) width 2, white, uv distributed by point index.
+ */
+static bool RunGoldenChecks()
+{
+	bool bSpritePass = true;
+	{
+		const int32 Count = 4;
+		float PositionX[Count], PositionZ[Count], SizeX[Count], SizeY[Count], ColorR[Count], ColorG[Count], ColorB[Count], ColorA[Count];
+		for (int32 i = 0; i < Count; i++)
+		{
+			PositionX[i] = 10.f; PositionZ[i] = 20.f;
+			SizeX[i] = 4.f; SizeY[i] = 2.f;
+			ColorR[i] = 1.f; ColorG[i] = 0.5f; ColorB[i] = 0.f; ColorA[i] = 1.f;
+		}
+		FLGUISpriteParticleStreams Streams;
+		Streams.PositionX = PositionX; Streams.PositionZ = PositionZ;
+		Streams.SizeX = SizeX; Streams.SizeY = SizeY;
+		Streams.ColorR = ColorR; Streams.ColorG = ColorG; Streams.ColorB = ColorB; Streams.ColorA = ColorA;
+		Streams.Count = Count;
+		FLGUISpriteBuildParams Params;
+		Params.Alpha01 = 0.5f;
+		Params.bWriteMaterialDataUV1 = Params.bWriteMaterialDataUV2 = false;
+
+		const MyVector2 GoldenPositions[4] = { MyVector2(8.f, 19.f), MyVector2(12.f, 19.f), MyVector2(8.f, 21.f), MyVector2(12.f, 21.f) };
+		const MyVector2 GoldenUV0[4] = { MyVector2(0.f, 0.f), MyVector2(1.f, 0.f), MyVector2(0.f, 1.f), MyVector2(1.f, 1.f) };
+		const FColor GoldenColor(255, 127, 0, 127);
+		TArray<FDynamicMeshVertex> Vertices;
+		Vertices.SetNumZeroed(Count * 4);
+		for (auto Build : { &LGUIParticleSpriteBuilder::BuildScalar, LGUIParticleSpriteBuilder::SelectVectorized(Streams, Params) })
+		{
+			Build(Streams, Params, 0, Count, Vertices.GetData());
+			for (int32 i = 0; i < Vertices.Num(); i++)
+			{
+				bSpritePass &= CheckGoldenVertex(Vertices[i], GoldenPositions[i % 4], GoldenColor, GoldenUV0[i % 4]);
+			}
+		}
+	}
+
+	bool bRibbonPass = true;
+	{
+		const float PositionX[3] = { 0.f, 10.f, 20.f };
+		const float PositionZ[3] = { 0.f, 0.f, 0.f };
+		const float Width[3] = { 2.f, 2.f, 2.f };
+		const int32 RibbonIndices[3] = { 0, 1, 2 };
+		FLGUIRibbonParticleStreams Streams;
+		Streams.PositionX = PositionX;
+		Streams.PositionZ = PositionZ;
+		Streams.Width = Width;
+		Streams.Count = 3;
+		FLGUIRibbonBuildParams Params;
+		FDynamicMeshVertex Vertices[4];
+		FLGUIIndexType Indices[6];
+		int32 VertexCount = 0, IndexCount = 0;
+		LGUIParticleRibbonBuilder::BuildRibbon(Streams, Params, RibbonIndices, 3, Vertices, Indices, VertexCount, IndexCount);
+
+		const FLGUIIndexType GoldenIndices[6] = { 0, 1, 2, 2, 1, 3 };
+		bRibbonPass = VertexCount == 4 && IndexCount == 6 && FMemory::Memcmp(Indices, GoldenIndices, sizeof(GoldenIndices)) == 0
+			&& CheckGoldenVertex(Vertices[0], MyVector2(0.f, 1.f), FColor::White, MyVector2(0.f, 0.f))
+			&& CheckGoldenVertex(Vertices[1], MyVector2(0.f, -1.f), FColor::White, MyVector2(1.f, 0.f))
+			&& CheckGoldenVertex(Vertices[2], MyVector2(10.f, 1.f), FColor::White, MyVector2(1.f / 3.f, 1.f))
+			&& CheckGoldenVertex(Vertices[3], MyVector2(10.f, -1.f), FColor::White, MyVector2(1.f / 3.f, 0.f));
+	}
+	UE_LOG(LogLGUIParticleBenchmark, Log, TEXT("Golden output: sprite %s, ribbon %s"), bSpritePass ? TEXT("PASS") : TEXT("FAIL"), bRibbonPass ? TEXT("PASS") : TEXT("FAIL"));
+	return bSpritePass && bRibbonPass;
+}
+
+/**
+ * Baked playback of a hand made sprite and ribbon entry: frame 0 have one quad, frame 1 is empty.
+ * Mesh section must get the quad at RenderTransform's location, and be cleared when frame is empty or playback is stopped.
+ */
+static bool RunBakedPlaybackChecks()
+{
+	FLGUIParticleBakedFrame QuadFrame;
+	//(8, 19) to (12, 21) in steps of 0.5
+	QuadFrame.Positions = { 16, 38, 24, 38, 16, 42, 24, 42 };
+	const FFloat16 Zero(0.f), One(1.f);
+	QuadFrame.TextureCoordinates = { Zero.Encoded, Zero.Encoded, One.Encoded, Zero.Encoded, Zero.Encoded, One.Encoded, One.Encoded, One.Encoded };
+	QuadFrame.Colors.Init(FColor(255, 127, 0, 254), 4);
+	QuadFrame.Indices = { 0, 1, 2, 2, 1, 3 };
+
+	FLGUIParticleRenderTransform RenderTransform;
+	RenderTransform.Location = FVector(5.f, 0.f, -5.f);
+	const MyVector2 GoldenPositions[4] = { MyVector2(13.f, 14.f), MyVector2(17.f, 14.f), MyVector2(13.f, 16.f), MyVector2(17.f, 16.f) };
+	const MyVector2 GoldenUV0[4] = { MyVector2(0.f, 0.f), MyVector2(1.f, 0.f), MyVector2(0.f, 1.f), MyVector2(1.f, 1.f) };
+	const FColor GoldenColor(255, 127, 0, 127);
+	const FLGUIIndexType GoldenIndices[6] = { 0, 1, 2, 2, 1, 3 };
+
+	bool bPass = true;
+	for (const bool bSprite : { true, false })
+	{
+		FLGUIParticleBakedEntry Entry;
+		Entry.bSprite = bSprite;
+		Entry.PositionStep = 0.5f;
+		Entry.MaxVertexCount = 4;
+		Entry.MaxIndexCount = 6;
+		Entry.Frames.Add(QuadFrame);
+		Entry.Frames.AddDefaulted();
+		if (bSprite)
+		{
+			//sprite indices are generated
+			Entry.Frames[0].Indices.Empty();
+		}
+
+		FLGUIMeshSection MeshSection;
+		int32 IndexCount = 0;
+		bool bEntryPass = Entry.WriteMeshSection(0, &MeshSection, RenderTransform, 0.5f, 0, IndexCount)
+			&& IndexCount == 6 && MeshSection.vertices.Num() == 4 && MeshSection.triangles.Num() == 6
+			&& FMemory::Memcmp(MeshSection.triangles.GetData(), GoldenIndices, sizeof(GoldenIndices)) == 0;
+		for (int32 i = 0; bEntryPass && i < 4; i++)
+		{
+			bEntryPass &= CheckGoldenVertex(MeshSection.vertices[i], GoldenPositions[i], GoldenColor, GoldenUV0[i]);
+		}
+		//empty frame and stopped playback both clear indices
+		for (const int32 EmptyFrameIndex : { 1, (int32)INDEX_NONE })
+		{
+			IndexCount = 6;
+			Entry.WriteMeshSection(EmptyFrameIndex, &MeshSection, RenderTransform, 0.5f, 0, IndexCount);
+			bEntryPass &= IndexCount == 0 && !MeshSection.triangles.ContainsByPredicate([](FLGUIIndexType Index) { return Index != 0; });
+		}
+		UE_LOG(LogLGUIParticleBenchmark, Log, TEXT("Baked playback %s: %s"), bSprite ? TEXT("sprite") : TEXT("ribbon"), bEntryPass ? TEXT("PASS") : TEXT("FAIL"));
+		bPass &= bEntryPass;
+	}
+	return bPass;
+}
+
+/** Mesh of one captured render entry, kept between captured frames so capacity and index writes behave the same as in game */
+struct FLGUIReplayEntry
+{
+	FLGUIMeshSection MeshSection;
+	FLGUISpriteMeshBuildState SpriteBuildState;
+	FLGUIRibbonSortScratch RibbonScratch;
+	/** What upload copy to render thread */
+	TArray<FDynamicMeshVertex> UploadedVertices;
+	TArray<FLGUIIndexType> UploadedIndices;
+};
+
+struct FLGUIReplayStats
+{
+	int64 EmittedParticles = 0;
+	int32 Reallocations = 0;
+	int64 BytesUploaded = 0;
+};
+
+/** Build and upload every record in order, same path as UIParticleSystem: cull and LODStride, mesh capacity, build, then create or update render data */
+static void ReplayMeshBuild(const TArray<FLGUIParticleCaptureReader::FRecord>& Records, TMap<uint64, FLGUIReplayEntry>& Entries, FLGUIReplayStats& OutStats)
+{
+	for (auto& Record : Records)
+	{
+		const auto Header = Record.Header;
+		auto& Entry = Entries.FindOrAdd(((uint64)Header->SourceId << 32) | Header->EntryIndex);
+		auto& MeshSection = Entry.MeshSection;
+		if (Header->RendererType == (uint32)ELGUIParticleRendererType::Sprite)
+		{
+			FLGUISpriteParticleStreams Streams = Record.SpriteStreams;
+			FLGUISpriteBuildParams Params;
+			Header->GetBuildParams(Params);
+			bool bIndicesChanged = false;
+			OutStats.EmittedParticles += ULGUIWorldParticleSystemComponent::BuildSpriteMesh(&MeshSection, Entry.SpriteBuildState, bIndicesChanged
+				, Streams, Params, Header->LODStride, Header->MaxParticleCount, Header->GetMeshCapacity(), Header->GetCullRect());
+		}
+		else
+		{
+			const auto& Streams = Record.RibbonStreams;
+			const int32 ParticleCount = Streams.Streams.Count;
+			FLGUIRibbonBuildParams Params;
+			Header->GetBuildParams(Params);
+			auto& Scratch = Entry.RibbonScratch;
+			const bool bMultiRibbons = Streams.RibbonIDIndex != nullptr && Streams.RibbonIDAcquireTag != nullptr;
+			if (ParticleCount >= 2)
+			{
+				Scratch.SortKeys.SetNumUninitialized(ParticleCount, false);
+				for (int32 i = 0; i < ParticleCount; i++)
+				{
+					Scratch.SortKeys[i] = LGUIParticleRibbonBuilder::MakeSortableFloatKey(Streams.SortKey != nullptr ? Streams.SortKey[i] : 0.f);
+				}
+				if (bMultiRibbons)
+				{
+					Scratch.RibbonKeys.SetNumUninitialized(ParticleCount, false);
+					for (int32 i = 0; i < ParticleCount; i++)
+					{
+						Scratch.RibbonKeys[i] = LGUIParticleRibbonBuilder::MakeSortableRibbonKey(Streams.RibbonIDIndex[i], Streams.RibbonIDAcquireTag[i]);
+					}
+				}
+			}
+			ULGUIWorldParticleSystemComponent::BuildRibbonMesh(&MeshSection, Scratch, Streams.Streams, Params, bMultiRibbons, Streams.IDIndex
+				, Header->LODStride, Header->MaxParticleCount, Header->GetMeshCapacity());
+			OutStats.EmittedParticles += ParticleCount;
+		}
+
+		//same create or update decision as UUIParticleSystem::UploadMeshSections
+		const int32 UploadBytes = MeshSection.vertices.Num() * UUIParticleSystem::GetUploadedVertexSize((uint8)Header->AdditionalChannels) + MeshSection.triangles.Num() * sizeof(FLGUIIndexType);
+		if (MeshSection.prevVertexCount == MeshSection.vertices.Num() && MeshSection.prevIndexCount == MeshSection.triangles.Num())
+		{
+			if (MeshSection.prevVertexCount > 0 && MeshSection.prevIndexCount > 0)
+			{
+				FMemory::Memcpy(Entry.UploadedVertices.GetData(), MeshSection.vertices.GetData(), MeshSection.vertices.Num() * sizeof(FDynamicMeshVertex));
+				FMemory::Memcpy(Entry.UploadedIndices.GetData(), MeshSection.triangles.GetData(), MeshSection.triangles.Num() * sizeof(FLGUIIndexType));
+				OutStats.BytesUploaded += UploadBytes;
+			}
+		}
+		else
+		{
+			MeshSection.prevVertexCount = MeshSection.vertices.Num();
+			MeshSection.prevIndexCount = MeshSection.triangles.Num();
+			Entry.UploadedVertices = MeshSection.vertices;
+			Entry.UploadedIndices = MeshSection.triangles;
+			OutStats.Reallocations++;
+			OutStats.BytesUploaded += UploadBytes;
+		}
+	}
+}
+
+static void RunCaptureReplay(const FString& Filename, int32 Iterations)
+{
+	FLGUIParticleCaptureReader Reader;
+	if (!Reader.Open(Filename))
+	{
+		UE_LOG(LogLGUIParticleBenchmark, Error, TEXT("Can't open capture file: %s"), *Filename);
+		return;
+	}
+	const auto& Records = Reader.GetRecords();
+	//sprite kernels are checked with the same params as captured mesh build
+	TArray<FLGUISpriteBuildParams> RecordParams;
+	TArray<LGUIParticleSpriteBuilder::FBuildFunction> RecordBuildFunctions;
+	int64 ParticleCount = 0;
+	int64 SpriteParticleCount = 0;
+	int32 MaxRecordParticleCount = 0;
+	TSet<uint32> Frames;
+	for (auto& Record : Records)
+	{
+		auto& Params = RecordParams.AddDefaulted_GetRef();
+		Record.Header->GetBuildParams(Params);
+		RecordBuildFunctions.Add(LGUIParticleSpriteBuilder::SelectVectorized(Record.SpriteStreams, Params));
+		ParticleCount += Record.Header->Count;
+		SpriteParticleCount += Record.SpriteStreams.Count;
+		MaxRecordParticleCount = FMath::Max(MaxRecordParticleCount, Record.SpriteStreams.Count);
+		Frames.Add(Record.Header->Frame);
+	}
+	if (ParticleCount == 0)
+	{
+		UE_LOG(LogLGUIParticleBenchmark, Log, TEXT("Replay %s: %d records, no particle"), *Filename, Records.Num());
+		return;
+	}
+
+	//whole mesh build and upload, every iteration start from empty meshes like a new play
+	TMap<uint64, FLGUIReplayEntry> Entries;
+	FLGUIReplayStats ReplayStats;
+	const double MeshBuildSeconds = MeasureSeconds(Iterations, [&]
+		{
+			Entries.Reset();
+			ReplayStats = FLGUIReplayStats();
+			ReplayMeshBuild(Records, Entries, ReplayStats);
+		});
+	UE_LOG(LogLGUIParticleBenchmark, Log, TEXT("Replay %s: %d frames, %d records, %lld particles: mesh build and upload %.2f ns/particle, %lld emitted, %d reallocations, %lld bytes uploaded")
+		, *Filename, Frames.Num(), Records.Num(), ParticleCount
+		, MeshBuildSeconds * 1e9 / ParticleCount, ReplayStats.EmittedParticles, ReplayStats.Reallocations, ReplayStats.BytesUploaded);
+	if (SpriteParticleCount == 0)
+		return;
+
+	TArray<FDynamicMeshVertex> ScalarVertices, VectorizedVertices;
+	ScalarVertices.SetNumZeroed(MaxRecordParticleCount * 4);
+	VectorizedVertices.SetNumZeroed(MaxRecordParticleCount * 4);
+	const double ScalarSeconds = MeasureSeconds(Iterations, [&]
+		{
+			for (int32 i = 0; i < Records.Num(); i++)
+			{
+				LGUIParticleSpriteBuilder::BuildScalar(Records[i].SpriteStreams, RecordParams[i], 0, Records[i].SpriteStreams.Count, ScalarVertices.GetData());
+			}
+		});
+	const double VectorizedSeconds = MeasureSeconds(Iterations, [&]
+		{
+			for (int32 i = 0; i < Records.Num(); i++)
+			{
+				RecordBuildFunctions[i](Records[i].SpriteStreams, RecordParams[i], 0, Records[i].SpriteStreams.Count, VectorizedVertices.GetData());
+			}
+		});
+
+	//check every record, measured loops above only keep the last one
+	FLGUIBenchmarkVertexError Error;
+	for (int32 i = 0; i < Records.Num(); i++)
+	{
+		LGUIParticleSpriteBuilder::BuildScalar(Records[i].SpriteStreams, RecordParams[i], 0, Records[i].SpriteStreams.Count, ScalarVertices.GetData());
+		RecordBuildFunctions[i](Records[i].SpriteStreams, RecordParams[i], 0, Records[i].SpriteStreams.Count, VectorizedVertices.GetData());
+		Error.Compare(ScalarVertices.GetData(), VectorizedVertices.GetData(), Records[i].SpriteStreams.Count * 4);
+	}
+	const bool bPass = Error.IsWithinKernelTolerance();
+	UE_LOG(LogLGUIParticleBenchmark, Log, TEXT("Replay %s: %lld sprite particles: scalar %.2f ns/particle, vectorized %.2f ns/particle, max error position %f color %d uv %g: %s")
+		, *Filename, SpriteParticleCount
+		, ScalarSeconds * 1e9 / SpriteParticleCount, VectorizedSeconds * 1e9 / SpriteParticleCount
+		, Error.Position, Error.Color, Error.TextureCoordinate
+		, bPass ? TEXT("PASS") : TEXT("FAIL"));
+}
+
+static FAutoConsoleCommand LGUIParticleBenchmarkCommand(
+	TEXT("lgui.ParticleSystem.Benchmark"),
+	TEXT("Benchmark UI particle mesh builders with synthetic data, and check optimized kernels against reference. Arguments: [ParticleCount=10000] [Iterations=100] [RibbonCount=100]"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+		{
+			const int32 ParticleCount = FMath::Max(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 10000, 1);
+			const int32 Iterations = FMath::Max(Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 100, 1);
+			const int32 RibbonCount = FMath::Max(Args.Num() > 2 ? FCString::Atoi(*Args[2]) : 100, 1);
+			RunSpriteBenchmark(ParticleCount, Iterations);
+			RunSinCosFastBenchmark(Iterations);
+			RunRibbonSortBenchmark(ParticleCount, RibbonCount, Iterations);
+			RunRibbonBuildBenchmark(ParticleCount, RibbonCount, Iterations);
+			RunGoldenChecks();
+			RunBakedPlaybackChecks();
+		}));
+
+static FAutoConsoleCommand LGUIParticleReplayCommand(
+	TEXT("lgui.ParticleSystem.Replay"),
+	TEXT("Benchmark mesh build and upload with a capture file of lgui.ParticleSystem.Capture, and check vectorized sprite kernel against reference. No world or niagara is needed. Arguments: [Filename=Saved/Profiling/LGUIParticleCapture.bin] [Iterations=10]"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+		{
+			const FString Filename = Args.Num() > 0 ? Args[0] : FPaths::ProfilingDir() / TEXT("LGUIParticleCapture.bin");
+			const int32 Iterations = FMath::Max(Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 10, 1);
+			RunCaptureReplay(Filename, Iterations);
+		}));
+
+#if WITH_DEV_AUTOMATION_TESTS
+//same checks as lgui.ParticleSystem.Benchmark with small data, so they run in CI: -ExecCmds="Automation RunTests LGUI.ParticleSystem.Builders; quit" -nullrhi
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLGUIParticleBuilderGoldenTest, "LGUI.ParticleSystem.Builders.GoldenOutput", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+bool FLGUIParticleBuilderGoldenTest::RunTest(const FString& Parameters)
+{
+	TestTrue(TEXT("Sprite and ribbon builders write hand computed vertices"), RunGoldenChecks());
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLGUIParticleBakedPlaybackTest, "LGUI.ParticleSystem.Builders.BakedPlayback", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+bool FLGUIParticleBakedPlaybackTest::RunTest(const FString& Parameters)
+{
+	TestTrue(TEXT("Baked sprite and ribbon frames decode into non-empty mesh section"), RunBakedPlaybackChecks());
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLGUIParticleSpriteKernelTest, "LGUI.ParticleSystem.Builders.SpriteKernels", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+bool FLGUIParticleSpriteKernelTest::RunTest(const FString& Parameters)
+{
+	//odd count so the scalar tail of vectorized kernel is covered
+	TestTrue(TEXT("Vectorized and fast-math sprite kernels match scalar reference"), RunSpriteBenchmark(1001, 1));
+	TestTrue(TEXT("Fast-math sin/cos match FMath::SinCos"), RunSinCosFastBenchmark(1));
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLGUIParticleRibbonBuilderTest, "LGUI.ParticleSystem.Builders.Ribbon", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+bool FLGUIParticleRibbonBuilderTest::RunTest(const FString& Parameters)
+{
+	TestTrue(TEXT("Ribbon radix sort match reference sort"), RunRibbonSortBenchmark(1000, 10, 1));
+	TestTrue(TEXT("Ribbon build write valid mesh"), RunRibbonBuildBenchmark(1000, 10, 1));
+	return true;
+}
+#endif
@@ -0,0 +1,345 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#include "LGUIParticleCapture.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "Async/MappedFileHandle.h"
+#include "Misc/Paths.h"
+#include "Engine/World.h"
+#include "UIParticleSystem.h"
+#include "LGUIParticleSystemSubsystem.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogLGUIParticleCapture, Log, All);
+
+static TSharedPtr<FLGUIParticleCaptureWriter> GLGUIParticleCaptureWriter;
+
+void FLGUIRibbonCaptureStreams::GetStreamPointers(const void** (&OutStreams)[NumStreams])
+{
+	OutStreams[0] = (const void**)&Streams.PositionX;
+	OutStreams[1] = (const void**)&Streams.PositionZ;
+	OutStreams[2] = (const void**)&Streams.Width;
+	OutStreams[3] = (const void**)&Streams.ColorR;
+	OutStreams[4] = (const void**)&Streams.ColorG;
+	OutStreams[5] = (const void**)&Streams.ColorB;
+	OutStreams[6] = (const void**)&Streams.ColorA;
+	OutStreams[7] = (const void**)&SortKey;
+	OutStreams[8] = (const void**)&RibbonIDIndex;
+	OutStreams[9] = (const void**)&RibbonIDAcquireTag;
+	OutStreams[10] = (const void**)&IDIndex;
+}
+
+/** Sprite streams of GetStreamPointers, then IDIndex */
+static constexpr int32 NumSpriteCaptureStreams = FLGUISpriteParticleStreams::NumStreams + 1;
+static void GetSpriteCaptureStreamPointers(FLGUISpriteParticleStreams& Streams, const void** (&OutStreams)[NumSpriteCaptureStreams])
+{
+	const float** FloatStreams[FLGUISpriteParticleStreams::NumStreams];
+	Streams.GetStreamPointers(FloatStreams);
+	for (int32 StreamIndex = 0; StreamIndex < FLGUISpriteParticleStreams::NumStreams; StreamIndex++)
+	{
+		OutStreams[StreamIndex] = (const void**)FloatStreams[StreamIndex];
+	}
+	OutStreams[FLGUISpriteParticleStreams::NumStreams] = (const void**)&Streams.IDIndex;
+}
+
+void FLGUIParticleCaptureRecord::SetBuildParams(const FLGUISpriteBuildParams& Params)
+{
+	RendererType = (uint32)ELGUIParticleRendererType::Sprite;
+	AxisX[0] = Params.AxisX.X; AxisX[1] = Params.AxisX.Y;
+	AxisY[0] = Params.AxisY.X; AxisY[1] = Params.AxisY.Y;
+	Translation[0] = Params.Translation.X; Translation[1] = Params.Translation.Y;
+	SizeScale[0] = Params.SizeScale.X; SizeScale[1] = Params.SizeScale.Y;
+	ComponentPitch = Params.ComponentPitch;
+	Alpha01 = Params.Alpha01;
+	bLocalSpace = Params.bLocalSpace;
+	bVelocityAligned = Params.bVelocityAligned;
+	SubImageSize[0] = Params.SubImageSize.X; SubImageSize[1] = Params.SubImageSize.Y;
+	bWriteUV1 = Params.bWriteMaterialDataUV1;
+	bWriteUV2 = Params.bWriteMaterialDataUV2;
+}
+
+void FLGUIParticleCaptureRecord::SetBuildParams(const FLGUIRibbonBuildParams& Params)
+{
+	RendererType = (uint32)ELGUIParticleRendererType::Ribbon;
+	AxisX[0] = Params.AxisX.X; AxisX[1] = Params.AxisX.Y;
+	AxisY[0] = Params.AxisY.X; AxisY[1] = Params.AxisY.Y;
+	Translation[0] = Params.Translation.X; Translation[1] = Params.Translation.Y;
+	SizeScale[0] = Params.WidthScale;
+	Alpha01 = Params.Alpha01;
+	UV0TilingLength = Params.UV0TilingLength;
+	UV1TilingLength = Params.UV1TilingLength;
+	bWriteUV1 = Params.bWriteUV1;
+}
+
+void FLGUIParticleCaptureRecord::GetBuildParams(FLGUISpriteBuildParams& OutParams)const
+{
+	OutParams.AxisX = MyVector2(AxisX[0], AxisX[1]);
+	OutParams.AxisY = MyVector2(AxisY[0], AxisY[1]);
+	OutParams.Translation = MyVector2(Translation[0], Translation[1]);
+	OutParams.SizeScale = MyVector2(SizeScale[0], SizeScale[1]);
+	OutParams.ComponentPitch = ComponentPitch;
+	OutParams.Alpha01 = Alpha01;
+	OutParams.bLocalSpace = bLocalSpace != 0;
+	OutParams.bVelocityAligned = bVelocityAligned != 0;
+	OutParams.SubImageSize = MyVector2(SubImageSize[0], SubImageSize[1]);
+	OutParams.SubImageDelta = MyVector2::UnitVector / OutParams.SubImageSize;
+	OutParams.bUseSubImage = OutParams.SubImageSize != MyVector2(1.f, 1.f);
+	OutParams.bWriteMaterialDataUV1 = bWriteUV1 != 0;
+	OutParams.bWriteMaterialDataUV2 = bWriteUV2 != 0;
+}
+
+void FLGUIParticleCaptureRecord::GetBuildParams(FLGUIRibbonBuildParams& OutParams)const
+{
+	OutParams.AxisX = MyVector2(AxisX[0], AxisX[1]);
+	OutParams.AxisY = MyVector2(AxisY[0], AxisY[1]);
+	OutParams.Translation = MyVector2(Translation[0], Translation[1]);
+	OutParams.WidthScale = SizeScale[0];
+	OutParams.Alpha01 = Alpha01;
+	OutParams.UV0TilingLength = UV0TilingLength;
+	OutParams.UV1TilingLength = UV1TilingLength;
+	OutParams.bWriteUV1 = bWriteUV1 != 0;
+}
+
+void FLGUIParticleCaptureRecord::SetMeshBuildInputs(const FLGUIParticleCullRect& CullRect, int32 InLODStride, int32 InMaxParticleCount, const FLGUIParticleMeshCapacitySettings& MeshCapacity, uint8 InAdditionalChannels)
+{
+	bCullRectEnable = CullRect.bEnable;
+	CullRectMin[0] = CullRect.Min.X; CullRectMin[1] = CullRect.Min.Y;
+	CullRectMax[0] = CullRect.Max.X; CullRectMax[1] = CullRect.Max.Y;
+	LODStride = InLODStride;
+	MaxParticleCount = InMaxParticleCount;
+	CapacityPolicy = (uint32)MeshCapacity.Policy;
+	CapacityBucketSize = MeshCapacity.BucketSize;
+	CapacityGrowFactor = MeshCapacity.GrowFactor;
+	CapacityShrinkRatio = MeshCapacity.ShrinkRatio;
+	AdditionalChannels = InAdditionalChannels;
+}
+
+FLGUIParticleCullRect FLGUIParticleCaptureRecord::GetCullRect()const
+{
+	FLGUIParticleCullRect CullRect;
+	CullRect.bEnable = bCullRectEnable != 0;
+	CullRect.Min = FLGUIParticleCullRect::FRectVector(CullRectMin[0], CullRectMin[1]);
+	CullRect.Max = FLGUIParticleCullRect::FRectVector(CullRectMax[0], CullRectMax[1]);
+	return CullRect;
+}
+
+FLGUIParticleMeshCapacitySettings FLGUIParticleCaptureRecord::GetMeshCapacity()const
+{
+	FLGUIParticleMeshCapacitySettings MeshCapacity;
+	MeshCapacity.Policy = (ELGUIParticleMeshCapacityPolicy)CapacityPolicy;
+	MeshCapacity.BucketSize = CapacityBucketSize;
+	MeshCapacity.GrowFactor = CapacityGrowFactor;
+	MeshCapacity.ShrinkRatio = CapacityShrinkRatio;
+	return MeshCapacity;
+}
+
+TSharedPtr<FLGUIParticleCaptureWriter> FLGUIParticleCaptureWriter::Create(const FString& InFilename)
+{
+	FArchive* Archive = IFileManager::Get().CreateFileWriter(*InFilename);
+	if (Archive == nullptr)
+		return nullptr;
+	auto Writer = MakeShared<FLGUIParticleCaptureWriter>();
+	Writer->Filename = InFilename;
+	Writer->Archive.Reset(Archive);
+	FLGUIParticleCaptureFileHeader FileHeader;
+	Archive->Serialize(&FileHeader, sizeof(FileHeader));
+	return Writer;
+}
+
+TSharedPtr<FLGUIParticleCaptureWriter> FLGUIParticleCaptureWriter::GetActive()
+{
+	return GLGUIParticleCaptureWriter;
+}
+
+FLGUIParticleCaptureWriter::~FLGUIParticleCaptureWriter()
+{
+	if (Archive.IsValid())
+	{
+		Archive->Close();
+	}
+}
+
+int64 FLGUIParticleCaptureWriter::GetBytesWritten()const
+{
+	return Archive.IsValid() ? Archive->Tell() : 0;
+}
+
+void FLGUIParticleCaptureWriter::Write(FLGUIParticleCaptureRecord& Record, const FLGUISpriteParticleStreams& Streams)
+{
+	FLGUISpriteParticleStreams MutableStreams = Streams;
+	const void** StreamPointers[NumSpriteCaptureStreams];
+	GetSpriteCaptureStreamPointers(MutableStreams, StreamPointers);
+	const void* StreamData[NumSpriteCaptureStreams];
+	for (int32 StreamIndex = 0; StreamIndex < NumSpriteCaptureStreams; StreamIndex++)
+	{
+		StreamData[StreamIndex] = *StreamPointers[StreamIndex];
+	}
+	WriteStreams(Record, StreamData, NumSpriteCaptureStreams, Streams.Count);
+}
+
+void FLGUIParticleCaptureWriter::Write(FLGUIParticleCaptureRecord& Record, const FLGUIRibbonCaptureStreams& Streams)
+{
+	FLGUIRibbonCaptureStreams MutableStreams = Streams;
+	const void** StreamPointers[FLGUIRibbonCaptureStreams::NumStreams];
+	MutableStreams.GetStreamPointers(StreamPointers);
+	const void* StreamData[FLGUIRibbonCaptureStreams::NumStreams];
+	for (int32 StreamIndex = 0; StreamIndex < FLGUIRibbonCaptureStreams::NumStreams; StreamIndex++)
+	{
+		StreamData[StreamIndex] = *StreamPointers[StreamIndex];
+	}
+	WriteStreams(Record, StreamData, FLGUIRibbonCaptureStreams::NumStreams, Streams.Streams.Count);
+}
+
+void FLGUIParticleCaptureWriter::WriteStreams(FLGUIParticleCaptureRecord& Record, const void* const* Streams, int32 NumStreams, int32 Count)
+{
+	static_assert(sizeof(int32) == sizeof(float), "int32 streams are stored the same as float streams");
+	Record.Count = Count;
+	Record.StreamMask = 0;
+	int32 BoundStreamCount = 0;
+	for (int32 StreamIndex = 0; StreamIndex < NumStreams; StreamIndex++)
+	{
+		if (Streams[StreamIndex] != nullptr)
+		{
+			Record.StreamMask |= 1u << StreamIndex;
+			BoundStreamCount++;
+		}
+	}
+	Record.DataSize = BoundStreamCount * Count * sizeof(float);
+
+	Archive->Serialize(&Record, sizeof(Record));
+	for (int32 StreamIndex = 0; StreamIndex < NumStreams; StreamIndex++)
+	{
+		if (Streams[StreamIndex] != nullptr)
+		{
+			Archive->Serialize((void*)Streams[StreamIndex], Count * sizeof(float));
+		}
+	}
+	RecordCount++;
+}
+
+FLGUIParticleCaptureReader::~FLGUIParticleCaptureReader()
+{
+	//region must be released before file handle
+	MappedRegion.Reset();
+	MappedFile.Reset();
+}
+
+bool FLGUIParticleCaptureReader::Open(const FString& Filename)
+{
+	Records.Reset();
+	MappedRegion.Reset();
+	MappedFile.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Filename));
+	if (!MappedFile.IsValid() || MappedFile->GetFileSize() < (int64)sizeof(FLGUIParticleCaptureFileHeader))
+		return false;
+	MappedRegion.Reset(MappedFile->MapRegion(0, MappedFile->GetFileSize()));
+	if (!MappedRegion.IsValid())
+		return false;
+
+	const uint8* Data = MappedRegion->GetMappedPtr();
+	const int64 Size = MappedRegion->GetMappedSize();
+	const auto FileHeader = (const FLGUIParticleCaptureFileHeader*)Data;
+	if (FileHeader->Magic != FLGUIParticleCaptureFileHeader::CurrentMagic || FileHeader->Version != FLGUIParticleCaptureFileHeader::CurrentVersion)
+		return false;
+
+	int64 Offset = sizeof(FLGUIParticleCaptureFileHeader);
+	while (Offset + (int64)sizeof(FLGUIParticleCaptureRecord) <= Size)
+	{
+		const auto Header = (const FLGUIParticleCaptureRecord*)(Data + Offset);
+		Offset += sizeof(FLGUIParticleCaptureRecord);
+		//capture may be stopped by crash or exit in the middle of a record
+		if (Header->Count < 0 || Offset + (int64)Header->DataSize > Size)
+			break;
+		//stream pointers are made from StreamMask and Count, so they must exactly cover DataSize, otherwise the rest of file can't be trusted
+		int32 NumStreams = 0;
+		if (Header->RendererType == (uint32)ELGUIParticleRendererType::Sprite)
+		{
+			NumStreams = NumSpriteCaptureStreams;
+		}
+		else if (Header->RendererType == (uint32)ELGUIParticleRendererType::Ribbon)
+		{
+			NumStreams = FLGUIRibbonCaptureStreams::NumStreams;
+		}
+		const uint64 ExpectedDataSize = (uint64)FPlatformMath::CountBits(Header->StreamMask) * (uint64)Header->Count * sizeof(float);
+		if (NumStreams == 0 || (Header->StreamMask >> NumStreams) != 0 || ExpectedDataSize != Header->DataSize)
+		{
+			UE_LOG(LogLGUIParticleCapture, Warning, TEXT("Invalid record at offset %lld of %s, %d records before it are read."), Offset - (int64)sizeof(FLGUIParticleCaptureRecord), *Filename, Records.Num());
+			break;
+		}
+
+		FRecord& Record = Records.AddDefaulted_GetRef();
+		Record.Header = Header;
+		const uint8* Stream = Data + Offset;
+		auto BindStreams = [Header, &Stream](const void** const* StreamPointers, int32 NumStreams)
+		{
+			for (int32 StreamIndex = 0; StreamIndex < NumStreams; StreamIndex++)
+			{
+				if (Header->StreamMask & (1u << StreamIndex))
+				{
+					*StreamPointers[StreamIndex] = Stream;
+					Stream += Header->Count * sizeof(float);
+				}
+			}
+		};
+		if (Header->RendererType == (uint32)ELGUIParticleRendererType::Sprite)
+		{
+			const void** StreamPointers[NumSpriteCaptureStreams];
+			GetSpriteCaptureStreamPointers(Record.SpriteStreams, StreamPointers);
+			BindStreams(StreamPointers, NumSpriteCaptureStreams);
+			Record.SpriteStreams.Count = Header->Count;
+		}
+		else
+		{
+			const void** StreamPointers[FLGUIRibbonCaptureStreams::NumStreams];
+			Record.RibbonStreams.GetStreamPointers(StreamPointers);
+			BindStreams(StreamPointers, FLGUIRibbonCaptureStreams::NumStreams);
+			Record.RibbonStreams.Streams.Count = Header->Count;
+		}
+		Offset += Header->DataSize;
+	}
+	return true;
+}
+
+static FAutoConsoleCommandWithWorldAndArgs LGUIParticleCaptureCommand(
+	TEXT("lgui.ParticleSystem.Capture"),
+	TEXT("Start capturing sprite and ribbon particle attributes of every UIParticleSystem in current world to a file, UIParticleSystems that start later are captured too, replay it with lgui.ParticleSystem.Replay. Arguments: [Filename=Saved/Profiling/LGUIParticleCapture.bin]. Run again without argument to stop."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			auto Subsystem = ULGUIParticleSystemSubsystem::GetInstance(World);
+			if (!Subsystem)
+				return;
+			auto SetWriter = [Subsystem](const TSharedPtr<FLGUIParticleCaptureWriter>& Writer)
+			{
+				for (auto& ItemPtr : Subsystem->GetUIParticleSystems())
+				{
+					if (ItemPtr.IsValid() && ItemPtr->GetParticleSystemInstance() != nullptr)
+					{
+						auto ParticleSystemInstance = ItemPtr->GetParticleSystemInstance();
+						if (Writer.IsValid())
+						{
+							ParticleSystemInstance->BeginCapture(Writer);
+						}
+						else
+						{
+							ParticleSystemInstance->EndCapture();
+						}
+					}
+				}
+			};
+			if (GLGUIParticleCaptureWriter.IsValid())
+			{
+				SetWriter(nullptr);
+				UE_LOG(LogLGUIParticleCapture, Log, TEXT("Captured %d records, %lld bytes to %s"), GLGUIParticleCaptureWriter->GetRecordCount(), GLGUIParticleCaptureWriter->GetBytesWritten(), *GLGUIParticleCaptureWriter->GetFilename());
+				GLGUIParticleCaptureWriter.Reset();
+				if (Args.Num() == 0)
+					return;
+			}
+			const FString Filename = Args.Num() > 0 ? Args[0] : FPaths::ProfilingDir() / TEXT("LGUIParticleCapture.bin");
+			GLGUIParticleCaptureWriter = FLGUIParticleCaptureWriter::Create(Filename);
+			if (!GLGUIParticleCaptureWriter.IsValid())
+			{
+				UE_LOG(LogLGUIParticleCapture, Error, TEXT("Can't create capture file: %s"), *Filename);
+				return;
+			}
+			SetWriter(GLGUIParticleCaptureWriter);
+			UE_LOG(LogLGUIParticleCapture, Log, TEXT("Capturing to %s"), *Filename);
+		}));
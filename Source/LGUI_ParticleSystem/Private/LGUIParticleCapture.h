@@ -0,0 +1,139 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LGUIParticleSpriteBuilder.h"
+#include "LGUIParticleRibbonBuilder.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+/**
+ * Capture file of particle attributes and mesh build inputs from live simulation, replayed through the same mesh build without niagara. lgui.ParticleSystem.Capture, lgui.ParticleSystem.Replay
+ * Layout: FLGUIParticleCaptureFileHeader, then records. Each record is FLGUIParticleCaptureRecord followed by Count values of every bound stream:
+ * sprite in FLGUISpriteParticleStreams::GetStreamPointers order then IDIndex, ribbon in FLGUIRibbonCaptureStreams::GetStreamPointers order.
+ * Every field is 4 bytes, so streams stay aligned in mapped file.
+ */
+struct FLGUIParticleCaptureFileHeader
+{
+	static constexpr uint32 CurrentMagic = 0x4350474C;//"LGPC"
+	static constexpr uint32 CurrentVersion = 2;
+	uint32 Magic = CurrentMagic;
+	uint32 Version = CurrentVersion;
+};
+
+/** Ribbon particles of a capture record: vertex streams, then what ribbon sort and LODStride read. */
+struct FLGUIRibbonCaptureStreams
+{
+	FLGUIRibbonParticleStreams Streams;
+	const float* SortKey = nullptr;
+	/** Ribbon full ID, not bound if emitter have only one ribbon */
+	const int32* RibbonIDIndex = nullptr;
+	const int32* RibbonIDAcquireTag = nullptr;
+	/** Particle ID's Index */
+	const int32* IDIndex = nullptr;
+
+	static constexpr int32 NumStreams = 11;
+	/** Address of every stream pointer, for processing all streams the same way */
+	void GetStreamPointers(const void** (&OutStreams)[NumStreams]);
+};
+
+struct FLGUIParticleCaptureRecord
+{
+	/** GFrameCounter when captured */
+	uint32 Frame = 0;
+	/** Capturing component and its render entry, same emitter have same ids in every frame */
+	uint32 SourceId = 0;
+	uint32 EntryIndex = 0;
+	/** ELGUIParticleRendererType, decide which streams follow */
+	uint32 RendererType = 0;
+	int32 Count = 0;
+	/** Bit N: stream N of the renderer type's streams is bound */
+	uint32 StreamMask = 0;
+	/** Build params resolved from emitter, renderer and UIParticleSystem's transform, see FLGUISpriteBuildParams and FLGUIRibbonBuildParams */
+	float AxisX[2] = { 1.f, 0.f };
+	float AxisY[2] = { 0.f, 1.f };
+	float Translation[2] = { 0.f, 0.f };
+	/** Sprite size scale, or ribbon width scale in [0] */
+	float SizeScale[2] = { 1.f, 1.f };
+	float ComponentPitch = 0.f;
+	float Alpha01 = 1.f;
+	uint32 bLocalSpace = 0;
+	uint32 bVelocityAligned = 0;
+	float SubImageSize[2] = { 1.f, 1.f };
+	float UV0TilingLength = 0.f;
+	float UV1TilingLength = 0.f;
+	/** Sprite: material data is written to uv1 and uv2. Ribbon: uv1 is written */
+	uint32 bWriteUV1 = 0;
+	uint32 bWriteUV2 = 0;
+	/** Mesh build inputs of UIParticleSystem, so replay cull, allocate and upload the same way */
+	uint32 bCullRectEnable = 0;
+	float CullRectMin[2] = { 0.f, 0.f };
+	float CullRectMax[2] = { 0.f, 0.f };
+	int32 LODStride = 1;
+	int32 MaxParticleCount = 0;
+	uint32 CapacityPolicy = 0;
+	int32 CapacityBucketSize = 0;
+	float CapacityGrowFactor = 0.f;
+	float CapacityShrinkRatio = 0.f;
+	/** ELGUICanvasAdditionalChannelType flags of render canvas */
+	uint32 AdditionalChannels = 0xFF;
+	/** Bytes of stream data after this record */
+	uint32 DataSize = 0;
+
+	void SetBuildParams(const FLGUISpriteBuildParams& Params);
+	void SetBuildParams(const FLGUIRibbonBuildParams& Params);
+	void GetBuildParams(FLGUISpriteBuildParams& OutParams)const;
+	void GetBuildParams(FLGUIRibbonBuildParams& OutParams)const;
+	void SetMeshBuildInputs(const FLGUIParticleCullRect& CullRect, int32 InLODStride, int32 InMaxParticleCount, const FLGUIParticleMeshCapacitySettings& MeshCapacity, uint8 InAdditionalChannels);
+	FLGUIParticleCullRect GetCullRect()const;
+	FLGUIParticleMeshCapacitySettings GetMeshCapacity()const;
+};
+
+/** Append records to capture file, shared by all capturing components. */
+class FLGUIParticleCaptureWriter
+{
+public:
+	/** nullptr if file can't be created */
+	static TSharedPtr<FLGUIParticleCaptureWriter> Create(const FString& InFilename);
+	/** Writer of running lgui.ParticleSystem.Capture, new and reused particle system components attach to it. nullptr if not capturing */
+	static TSharedPtr<FLGUIParticleCaptureWriter> GetActive();
+	~FLGUIParticleCaptureWriter();
+
+	/** Fill Record.Count, StreamMask and DataSize from Streams, then write record and stream data */
+	void Write(FLGUIParticleCaptureRecord& Record, const FLGUISpriteParticleStreams& Streams);
+	void Write(FLGUIParticleCaptureRecord& Record, const FLGUIRibbonCaptureStreams& Streams);
+	uint32 AddSource() { return NextSourceId++; }
+	const FString& GetFilename()const { return Filename; }
+	int32 GetRecordCount()const { return RecordCount; }
+	int64 GetBytesWritten()const;
+private:
+	void WriteStreams(FLGUIParticleCaptureRecord& Record, const void* const* Streams, int32 NumStreams, int32 Count);
+	FString Filename;
+	TUniquePtr<FArchive> Archive;
+	uint32 NextSourceId = 0;
+	int32 RecordCount = 0;
+};
+
+/** Capture file mapped into memory, stream pointers of records point into the mapping so nothing is copied. */
+class FLGUIParticleCaptureReader
+{
+public:
+	struct FRecord
+	{
+		const FLGUIParticleCaptureRecord* Header = nullptr;
+		/** Streams of Header->RendererType, the other one is empty */
+		FLGUISpriteParticleStreams SpriteStreams;
+		FLGUIRibbonCaptureStreams RibbonStreams;
+	};
+
+	~FLGUIParticleCaptureReader();
+	/** Map the file and index its records, return false if file is missing or invalid. Reading stop at the first record that is truncated or whose data size don't match its streams */
+	bool Open(const FString& Filename);
+	const TArray<FRecord>& GetRecords()const { return Records; }
+private:
+	TUniquePtr<IMappedFileHandle> MappedFile;
+	TUniquePtr<IMappedFileRegion> MappedRegion;
+	TArray<FRecord> Records;
+};
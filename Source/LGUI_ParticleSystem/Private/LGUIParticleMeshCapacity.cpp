@@ -0,0 +1,32 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#include "LGUIParticleMeshCapacity.h"
+
+int32 FLGUIParticleMeshCapacitySettings::GetParticleCapacity(int32 ParticleCount, int32 CurrentCapacity, int32 MaxParticleCount)const
+{
+	const int32 Bucket = FMath::Max(BucketSize, 1);
+	auto RoundUpToBucket = [Bucket](int32 Count) { return FMath::DivideAndRoundUp(Count, Bucket) * Bucket; };
+
+	switch (Policy)
+	{
+	default:
+	case ELGUIParticleMeshCapacityPolicy::FixedBucket:
+		return RoundUpToBucket(ParticleCount);
+	case ELGUIParticleMeshCapacityPolicy::Geometric:
+	{
+		if (ParticleCount > CurrentCapacity)
+		{
+			return RoundUpToBucket(FMath::Max(ParticleCount, FMath::CeilToInt(CurrentCapacity * FMath::Max(GrowFactor, 1.0f))));
+		}
+		if (ParticleCount < CurrentCapacity * ShrinkRatio)
+		{
+			//shrink to where next grow is still far away
+			const int32 NewCapacity = RoundUpToBucket(FMath::CeilToInt(ParticleCount * FMath::Max(GrowFactor, 1.0f)));
+			return FMath::Min(NewCapacity, CurrentCapacity);
+		}
+		return CurrentCapacity;
+	}
+	case ELGUIParticleMeshCapacityPolicy::PreallocateMaxParticles:
+		return FMath::Max(CurrentCapacity, RoundUpToBucket(FMath::Max(ParticleCount, MaxParticleCount)));
+	}
+}
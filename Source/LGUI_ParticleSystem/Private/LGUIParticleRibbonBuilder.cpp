@@ -0,0 +1,308 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#include "LGUIParticleRibbonBuilder.h"
+#include "NiagaraDataSet.h"
+#include "NiagaraRibbonRendererProperties.h"
+
+//PRAGMA_DISABLE_OPTIMIZATION
+
+/** One stable counting sort pass on 8 bits of Keys, from Src to Dst. Return false if all keys have the same digit, so nothing is written. */
+template<typename KeyType>
+static bool RadixSortPass(const KeyType* RESTRICT Keys, uint32 Shift, const int32* RESTRICT Src, int32* RESTRICT Dst, int32 Count)
+{
+	int32 Histogram[256];
+	FMemory::Memzero(Histogram, sizeof(Histogram));
+	for (int32 i = 0; i < Count; i++)
+	{
+		Histogram[(Keys[Src[i]] >> Shift) & 0xFF]++;
+	}
+	if (Histogram[(Keys[Src[0]] >> Shift) & 0xFF] == Count)
+		return false;
+
+	int32 Offset = 0;
+	for (int32 Digit = 0; Digit < 256; Digit++)
+	{
+		const int32 DigitCount = Histogram[Digit];
+		Histogram[Digit] = Offset;
+		Offset += DigitCount;
+	}
+	for (int32 i = 0; i < Count; i++)
+	{
+		const int32 ParticleIndex = Src[i];
+		Dst[Histogram[(Keys[ParticleIndex] >> Shift) & 0xFF]++] = ParticleIndex;
+	}
+	return true;
+}
+
+template<typename KeyType>
+static void RadixSortByKey(const KeyType* Keys, TArray<int32>& InOutIndices, TArray<int32>& TempIndices)
+{
+	const int32 Count = InOutIndices.Num();
+	for (uint32 Shift = 0; Shift < sizeof(KeyType) * 8; Shift += 8)
+	{
+		if (RadixSortPass(Keys, Shift, InOutIndices.GetData(), TempIndices.GetData(), Count))
+		{
+			Swap(InOutIndices, TempIndices);
+		}
+	}
+}
+
+void LGUIParticleRibbonBuilder::SortRibbonParticles(FLGUIRibbonSortScratch& Scratch, int32 ParticleCount, bool bMultiRibbons)
+{
+	Scratch.SortedIndices.SetNumUninitialized(ParticleCount, false);
+	Scratch.TempIndices.SetNumUninitialized(ParticleCount, false);
+	Scratch.RibbonOffsets.Reset();
+	if (ParticleCount <= 0)
+	{
+		Scratch.RibbonOffsets.Add(0);
+		return;
+	}
+	for (int32 i = 0; i < ParticleCount; i++)
+	{
+		Scratch.SortedIndices[i] = i;
+	}
+
+	//least significant key first, then stable passes on ribbon key keep sort key order inside ribbon
+	RadixSortByKey(Scratch.SortKeys.GetData(), Scratch.SortedIndices, Scratch.TempIndices);
+	if (bMultiRibbons)
+	{
+		RadixSortByKey(Scratch.RibbonKeys.GetData(), Scratch.SortedIndices, Scratch.TempIndices);
+
+		uint64 PrevRibbonKey = Scratch.RibbonKeys[Scratch.SortedIndices[0]];
+		Scratch.RibbonOffsets.Add(0);
+		for (int32 i = 1; i < ParticleCount; i++)
+		{
+			const uint64 RibbonKey = Scratch.RibbonKeys[Scratch.SortedIndices[i]];
+			if (RibbonKey != PrevRibbonKey)
+			{
+				PrevRibbonKey = RibbonKey;
+				Scratch.RibbonOffsets.Add(i);
+			}
+		}
+	}
+	else
+	{
+		Scratch.RibbonOffsets.Add(0);
+	}
+	Scratch.RibbonOffsets.Add(ParticleCount);
+}
+
+void FLGUIRibbonParticleStreams::Init(const FLGUIParticleBindingPlan& Plan, FNiagaraDataBuffer& DataBuffer)
+{
+	auto GetStream = [&DataBuffer](int32 Component) { return Component != INDEX_NONE ? (const float*)DataBuffer.GetComponentPtrFloat(Component) : nullptr; };
+	PositionX = GetStream(Plan.RibbonPositionXFloatComponent);
+	PositionZ = GetStream(Plan.RibbonPositionZFloatComponent);
+	Width = GetStream(Plan.RibbonWidthFloatComponent);
+	const bool bHaveColor = Plan.RibbonColorFloatComponent != INDEX_NONE;
+	ColorR = bHaveColor ? GetStream(Plan.RibbonColorFloatComponent) : nullptr;
+	ColorG = bHaveColor ? GetStream(Plan.RibbonColorFloatComponent + 1) : nullptr;
+	ColorB = bHaveColor ? GetStream(Plan.RibbonColorFloatComponent + 2) : nullptr;
+	ColorA = bHaveColor ? GetStream(Plan.RibbonColorFloatComponent + 3) : nullptr;
+	Count = DataBuffer.GetNumInstances();
+}
+
+void FLGUIRibbonBuildParams::Init(bool bLocalSpace, const FVector& ComponentLocation, const FVector& ComponentScale, const FRotator& ComponentRotation
+	, float ScaleFactor, MyVector2 LocationOffset, float InAlpha01, const UNiagaraRibbonRendererProperties* RibbonRenderer)
+{
+	if (bLocalSpace)
+	{
+		//scale by component, rotate by -pitch, then offset
+		float Sin, Cos;
+		FMath::SinCos(&Sin, &Cos, FMath::DegreesToRadians(-ComponentRotation.Pitch));
+		const MyVector2 Scale = MyVector2(ComponentScale.X, ComponentScale.Z) * ScaleFactor;
+		AxisX = MyVector2(Cos * Scale.X, Sin * Scale.X);
+		AxisY = MyVector2(-Sin * Scale.Y, Cos * Scale.Y);
+		Translation = LocationOffset + MyVector2(ComponentLocation.X, ComponentLocation.Z) * ScaleFactor;
+	}
+	else
+	{
+		AxisX = MyVector2(ScaleFactor, 0.f);
+		AxisY = MyVector2(0.f, ScaleFactor);
+		Translation = LocationOffset;
+	}
+	WidthScale = ScaleFactor;
+	Alpha01 = InAlpha01;
+	UV0TilingLength = RibbonRenderer->UV0Settings.DistributionMode == ENiagaraRibbonUVDistributionMode::TiledOverRibbonLength ? RibbonRenderer->UV0Settings.TilingLength : 0.f;
+	UV1TilingLength = RibbonRenderer->UV1Settings.DistributionMode == ENiagaraRibbonUVDistributionMode::TiledOverRibbonLength ? RibbonRenderer->UV1Settings.TilingLength : 0.f;
+}
+
+template<typename T>
+FORCEINLINE T ReadRibbonStream(const T* Stream, int32 Index, T Default)
+{
+	return Stream != nullptr ? Stream[Index] : Default;
+}
+
+FORCEINLINE MyVector3 MakeRibbonPositionVector(const MyVector2& InVector2D)
+{
+	return MyVector3(0, InVector2D.X, InVector2D.Y);
+}
+
+void LGUIParticleRibbonBuilder::BuildRibbon(const FLGUIRibbonParticleStreams& Streams, const FLGUIRibbonBuildParams& Params, const int32* RibbonIndices, int32 numParticlesInRibbon
+	, FDynamicMeshVertex* VertexData, FLGUIIndexType* IndexData, int32& InOutVertexCount, int32& InOutIndexCount)
+{
+	if (numParticlesInRibbon < 3)
+		return;
+
+	auto GetParticlePosition2D = [&Streams](int32 Index)
+	{
+		return MyVector2(ReadRibbonStream(Streams.PositionX, Index, 0.f), ReadRibbonStream(Streams.PositionZ, Index, 0.f));
+	};
+	auto GetParticleColor = [&Streams](int32 Index)
+	{
+		return Streams.ColorR != nullptr ? FLinearColor(Streams.ColorR[Index], Streams.ColorG[Index], Streams.ColorB[Index], Streams.ColorA[Index]) : FLinearColor::White;
+	};
+	auto GetParticleWidth = [&Streams](int32 Index)
+	{
+		return ReadRibbonStream(Streams.Width, Index, 0.f);
+	};
+	auto ToUIPosition = [&Params](const MyVector2& Position)
+	{
+		return Params.AxisX * Position.X + Params.AxisY * Position.Y + Params.Translation;
+	};
+	const bool bWriteUV1 = Params.bWriteUV1;
+
+	int VertexCount = (numParticlesInRibbon - 1) * 2;
+	int IndexCount = (numParticlesInRibbon - 2) * 6;
+
+	auto CurrentVertexIndex = InOutVertexCount;
+	auto CurrentIndexIndex = InOutIndexCount;
+	InOutVertexCount += VertexCount;
+	InOutIndexCount += IndexCount;
+
+	const int32 StartDataIndex = RibbonIndices[0];
+
+	float TotalDistance = 0.0f;
+
+	MyVector2 LastPosition = GetParticlePosition2D(StartDataIndex);
+	MyVector2 CurrentPosition = MyVector2::ZeroVector;
+	float CurrentWidth = 0.f;
+	MyVector2 LastToCurrentVector = MyVector2::ZeroVector;
+	float LastToCurrentSize = 0.f;
+	float LastU0 = 0.f;
+	float LastU1 = 0.f;
+
+	MyVector2 LastParticleUIPosition = ToUIPosition(LastPosition);
+
+	int32 CurrentIndex = 1;
+	int32 CurrentDataIndex = RibbonIndices[CurrentIndex];
+
+	CurrentPosition = GetParticlePosition2D(CurrentDataIndex);
+	LastToCurrentVector = CurrentPosition - LastPosition;
+	LastToCurrentSize = LastToCurrentVector.Size();
+
+	// Normalize LastToCurrVec
+	LastToCurrentVector *= 1.f / LastToCurrentSize;
+
+
+	FColor InitialColor = GetParticleColor(StartDataIndex).ToFColor(false);
+	InitialColor.A = InitialColor.A * Params.Alpha01;
+	const float InitialWidth = GetParticleWidth(StartDataIndex) * Params.WidthScale;
+
+	MyVector2 InitialPositionArray[2];
+	InitialPositionArray[0] = LastToCurrentVector.GetRotated(90.f) * InitialWidth * 0.5f;
+	InitialPositionArray[1] = -InitialPositionArray[0];
+
+	for (int i = 0; i < 2; ++i)
+	{
+		VertexData[CurrentVertexIndex + i].Position = MakeRibbonPositionVector(InitialPositionArray[i] + LastParticleUIPosition);
+		VertexData[CurrentVertexIndex + i].Color = InitialColor;
+		VertexData[CurrentVertexIndex + i].TextureCoordinate[0] = MyVector2(i, 0);
+		if (bWriteUV1)
+		{
+			VertexData[CurrentVertexIndex + i].TextureCoordinate[1] = MyVector2::ZeroVector;
+		}
+	}
+
+	CurrentVertexIndex += 2;
+
+	int32 NextIndex = CurrentIndex + 1;
+
+	while (NextIndex < numParticlesInRibbon)
+	{
+		const int32 NextDataIndex = RibbonIndices[NextIndex];
+		const MyVector2 NextPosition = GetParticlePosition2D(NextDataIndex);
+		MyVector2 CurrentToNextVector = NextPosition - CurrentPosition;
+		const float CurrentToNextSize = CurrentToNextVector.Size();
+		CurrentWidth = GetParticleWidth(CurrentDataIndex) * Params.WidthScale;
+		FColor CurrentColor = GetParticleColor(CurrentDataIndex).ToFColor(false);
+		CurrentColor.A = CurrentColor.A * Params.Alpha01;
+
+		// Normalize CurrToNextVec
+		CurrentToNextVector *= 1.f / CurrentToNextSize;
+
+		const MyVector2 CurrentTangent = (LastToCurrentVector + CurrentToNextVector).GetSafeNormal();
+
+		TotalDistance += LastToCurrentSize;
+
+		MyVector2 CurrentPositionArray[2];
+		CurrentPositionArray[0] = CurrentTangent.GetRotated(90.f) * CurrentWidth * 0.5f;
+		CurrentPositionArray[1] = -CurrentPositionArray[0];
+
+		const MyVector2 CurrentParticleUIPosition = ToUIPosition(CurrentPosition);
+
+		float CurrentU0 = 0.f;
+
+		if (Params.UV0TilingLength > 0.f)
+		{
+			CurrentU0 = LastU0 + LastToCurrentSize / Params.UV0TilingLength;
+		}
+		else
+		{
+			CurrentU0 = (float)CurrentIndex / (float)numParticlesInRibbon;
+		}
+
+		float CurrentU1 = 0.f;
+
+		if (Params.UV1TilingLength > 0.f)
+		{
+			CurrentU1 = LastU1 + LastToCurrentSize / Params.UV1TilingLength;
+		}
+		else
+		{
+			CurrentU1 = (float)CurrentIndex / (float)numParticlesInRibbon;
+		}
+
+		MyVector2 TextureCoordinates0[2];
+		TextureCoordinates0[0] = MyVector2(CurrentU0, 1.f);
+		TextureCoordinates0[1] = MyVector2(CurrentU0, 0.f);
+
+		MyVector2 TextureCoordinates1[2];
+		TextureCoordinates1[0] = MyVector2(CurrentU1, 1.f);
+		TextureCoordinates1[1] = MyVector2(CurrentU1, 0.f);
+
+		for (int i = 0; i < 2; ++i)
+		{
+			VertexData[CurrentVertexIndex + i].Position = MakeRibbonPositionVector(CurrentPositionArray[i] + CurrentParticleUIPosition);
+			VertexData[CurrentVertexIndex + i].Color = CurrentColor;
+			VertexData[CurrentVertexIndex + i].TextureCoordinate[0] = TextureCoordinates0[i];
+			if (bWriteUV1)
+			{
+				VertexData[CurrentVertexIndex + i].TextureCoordinate[1] = TextureCoordinates1[i];
+			}
+		}
+
+		IndexData[CurrentIndexIndex] = CurrentVertexIndex - 2;
+		IndexData[CurrentIndexIndex + 1] = CurrentVertexIndex - 1;
+		IndexData[CurrentIndexIndex + 2] = CurrentVertexIndex;
+
+		IndexData[CurrentIndexIndex + 3] = CurrentVertexIndex;
+		IndexData[CurrentIndexIndex + 4] = CurrentVertexIndex - 1;
+		IndexData[CurrentIndexIndex + 5] = CurrentVertexIndex + 1;
+
+
+		CurrentVertexIndex += 2;
+		CurrentIndexIndex += 6;
+
+		CurrentIndex = NextIndex;
+		CurrentDataIndex = NextDataIndex;
+		LastPosition = CurrentPosition;
+		LastParticleUIPosition = CurrentParticleUIPosition;
+		CurrentPosition = NextPosition;
+		LastToCurrentVector = CurrentToNextVector;
+		LastToCurrentSize = CurrentToNextSize;
+		LastU0 = CurrentU0;
+
+		++NextIndex;
+	}
+}
+//PRAGMA_ENABLE_OPTIMIZATION
@@ -0,0 +1,78 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DynamicMeshBuilder.h"
+#include "Core/LGUIIndexBuffer.h"
+#include "LGUIWorldParticleSystemComponent.h"
+
+class FNiagaraDataBuffer;
+class UNiagaraRibbonRendererProperties;
+
+/**
+ * Ribbon particle attributes that build vertices, read directly from niagara's float component streams (SoA).
+ * A null stream means the attribute is not bound, the builder use the same default value as FNiagaraDataSetAccessor::GetSafe.
+ */
+struct FLGUIRibbonParticleStreams
+{
+	const float* PositionX = nullptr;
+	const float* PositionZ = nullptr;
+	const float* Width = nullptr;
+	const float* ColorR = nullptr;
+	const float* ColorG = nullptr;
+	const float* ColorB = nullptr;
+	const float* ColorA = nullptr;
+	int32 Count = 0;
+
+	void Init(const FLGUIParticleBindingPlan& Plan, FNiagaraDataBuffer& DataBuffer);
+};
+
+/** Per-emitter constants for building ribbons, same transform as FLGUISpriteBuildParams. */
+struct FLGUIRibbonBuildParams
+{
+	/** Particle position (X, Z) to UI position: AxisX * X + AxisY * Z + Translation */
+	MyVector2 AxisX = MyVector2(1.f, 0.f);
+	MyVector2 AxisY = MyVector2(0.f, 1.f);
+	MyVector2 Translation = MyVector2(0.f, 0.f);
+	/** Multiply to ribbon width */
+	float WidthScale = 1.f;
+	float Alpha01 = 1.f;
+	/** U of uv0 and uv1 grow by segment length / TilingLength if > 0 (TiledOverRibbonLength), otherwise distributed by point index */
+	float UV0TilingLength = 0.f;
+	float UV1TilingLength = 0.f;
+	/** Canvas have uv1 */
+	bool bWriteUV1 = false;
+
+	void Init(bool bLocalSpace, const FVector& ComponentLocation, const FVector& ComponentScale, const FRotator& ComponentRotation
+		, float ScaleFactor, MyVector2 LocationOffset, float InAlpha01, const UNiagaraRibbonRendererProperties* RibbonRenderer);
+};
+
+namespace LGUIParticleRibbonBuilder
+{
+	/** Map float to uint32 that keep the same order when compare as unsigned integer. */
+	FORCEINLINE uint32 MakeSortableFloatKey(float Value)
+	{
+		const uint32 Bits = *(const uint32*)&Value;
+		return Bits ^ ((Bits & 0x80000000u) ? 0xFFFFFFFFu : 0x80000000u);
+	}
+	/** Map two int32 (compared as Major then Minor) to uint64 that keep the same order when compare as unsigned integer. */
+	FORCEINLINE uint64 MakeSortableRibbonKey(int32 Major, int32 Minor)
+	{
+		return ((uint64)((uint32)Major ^ 0x80000000u) << 32) | (uint64)((uint32)Minor ^ 0x80000000u);
+	}
+
+	/**
+	 * Sort particles by (RibbonKey, SortKey) with LSD radix sort, using memory in Scratch.
+	 * Caller fill Scratch.SortKeys, and Scratch.RibbonKeys if bMultiRibbons, both have ParticleCount elements.
+	 * Result: Scratch.SortedIndices contains particle indices, ribbon N is [RibbonOffsets[N], RibbonOffsets[N + 1]).
+	 */
+	void SortRibbonParticles(FLGUIRibbonSortScratch& Scratch, int32 ParticleCount, bool bMultiRibbons);
+
+	/**
+	 * Build one ribbon whose points are particles RibbonIndices[0, PointCount) in order, ribbon with less than 3 points is skipped.
+	 * Write (PointCount - 1) * 2 vertices at OutVertices[InOutVertexCount] and (PointCount - 2) * 6 indices at OutIndices[InOutIndexCount], then advance both counts.
+	 */
+	void BuildRibbon(const FLGUIRibbonParticleStreams& Streams, const FLGUIRibbonBuildParams& Params, const int32* RibbonIndices, int32 PointCount
+		, FDynamicMeshVertex* OutVertices, FLGUIIndexType* OutIndices, int32& InOutVertexCount, int32& InOutIndexCount);
+}
@@ -0,0 +1,39 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#include "LGUIParticleSnapshot.h"
+
+void FLGUISpriteParticleSnapshot::CopyFrom(const FLGUISpriteParticleStreams& Source, const void* InDataBuffer, float InSimulationAge)
+{
+	Streams = Source;
+	DataBuffer = InDataBuffer;
+	SimulationAge = InSimulationAge;
+
+	const float** StreamPointers[FLGUISpriteParticleStreams::NumStreams];
+	Streams.GetStreamPointers(StreamPointers);
+	int32 BoundStreamCount = Source.IDIndex != nullptr ? 1 : 0;
+	for (const float** StreamPointer : StreamPointers)
+	{
+		if (*StreamPointer != nullptr)
+		{
+			BoundStreamCount++;
+		}
+	}
+	//same size every frame for a stable particle count, so no allocation after warm up
+	Data.SetNumUninitialized(BoundStreamCount * Source.Count, false);
+	float* Dest = Data.GetData();
+	for (const float** StreamPointer : StreamPointers)
+	{
+		if (*StreamPointer != nullptr)
+		{
+			FMemory::Memcpy(Dest, *StreamPointer, Source.Count * sizeof(float));
+			*StreamPointer = Dest;
+			Dest += Source.Count;
+		}
+	}
+	if (Source.IDIndex != nullptr)
+	{
+		static_assert(sizeof(int32) == sizeof(float), "ID index is stored in float array");
+		FMemory::Memcpy(Dest, Source.IDIndex, Source.Count * sizeof(int32));
+		Streams.IDIndex = (const int32*)Dest;
+	}
+}
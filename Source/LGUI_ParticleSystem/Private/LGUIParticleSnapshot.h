@@ -0,0 +1,98 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LGUIParticleSpriteBuilder.h"
+#include <atomic>
+
+/**
+ * Copy of the sprite attributes that LGUI sprite builder bind, taken on game thread after niagara simulation is finalized.
+ * It only hand particle data from game thread to mesh build, copy still happen at the point where niagara data set is safe to read.
+ * Ribbon have no snapshot: ribbon build sort and read most of the particle attributes, so the copy would cost about as much as the build,
+ * and async build is already finished in subsystem's pre actor tick before niagara write the data set again.
+ */
+struct FLGUISpriteParticleSnapshot
+{
+	/** Bound streams packed one after another, unbound streams take no space */
+	TArray<float> Data;
+	/** Stream pointers point into Data */
+	FLGUISpriteParticleStreams Streams;
+	/** Niagara data buffer and system age this snapshot is copied from, for FLGUIParticleBuildSignature */
+	const void* DataBuffer = nullptr;
+	float SimulationAge = -1.f;
+
+	void CopyFrom(const FLGUISpriteParticleStreams& Source, const void* InDataBuffer, float InSimulationAge);
+};
+
+/**
+ * Lock-free single producer single consumer ring of snapshots.
+ * Producer write a free slot then publish it. Consumer always take the newest published slot and hold it until next Acquire, older unread slots are counted as stale.
+ * If every slot is published or held by consumer, new snapshot is dropped.
+ */
+template<typename SnapshotType, uint32 NumSlots = 3>
+class TLGUIParticleSnapshotRing
+{
+	static_assert(NumSlots >= 2, "Consumer hold one slot, so producer need at least one more");
+public:
+	/** Producer: slot to write, nullptr if ring is full. Call EndWrite when done */
+	SnapshotType* BeginWrite()
+	{
+		const uint32 Head = WriteIndex.load(std::memory_order_relaxed);
+		if (Head - ReleaseIndex.load(std::memory_order_acquire) >= NumSlots)
+		{
+			DroppedCount.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		return &Slots[Head % NumSlots];
+	}
+	/** Producer: make the slot returned by BeginWrite visible to consumer */
+	void EndWrite()
+	{
+		WriteIndex.store(WriteIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		PublishedCount.fetch_add(1, std::memory_order_relaxed);
+	}
+	/** Consumer: newest published snapshot, or the held one if nothing new. nullptr if nothing is published yet. Returned snapshot stay valid until next Acquire */
+	const SnapshotType* Acquire()
+	{
+		const uint32 Head = WriteIndex.load(std::memory_order_acquire);
+		if (Head != ReadIndex)
+		{
+			const uint32 Newest = Head - 1;
+			StaleCount.fetch_add(Newest - ReadIndex, std::memory_order_relaxed);
+			ReadIndex = Head;
+			HeldSlot = &Slots[Newest % NumSlots];
+			//every slot before the newest is free now, include the one held before
+			ReleaseIndex.store(Newest, std::memory_order_release);
+		}
+		return HeldSlot;
+	}
+
+	uint32 GetPublishedCount()const { return PublishedCount.load(std::memory_order_relaxed); }
+	/** Snapshots not published because consumer is too slow */
+	uint32 GetDroppedCount()const { return DroppedCount.load(std::memory_order_relaxed); }
+	/** Snapshots published but replaced by newer ones before consumer read them */
+	uint32 GetStaleCount()const { return StaleCount.load(std::memory_order_relaxed); }
+private:
+	SnapshotType Slots[NumSlots];
+	/** Index of next slot to publish */
+	std::atomic<uint32> WriteIndex{ 0 };
+	/** Slots before this index can be written by producer */
+	std::atomic<uint32> ReleaseIndex{ 0 };
+	/** Consumer only: index of next unread slot, and the slot it hold */
+	uint32 ReadIndex = 0;
+	const SnapshotType* HeldSlot = nullptr;
+
+	std::atomic<uint32> PublishedCount{ 0 };
+	std::atomic<uint32> DroppedCount{ 0 };
+	std::atomic<uint32> StaleCount{ 0 };
+};
+
+struct FLGUISpriteSnapshotRing : public TLGUIParticleSnapshotRing<FLGUISpriteParticleSnapshot>
+{
+	/** Producer only: source of last published snapshot, paused or finished simulation don't need to publish again */
+	const void* LastDataBuffer = nullptr;
+	float LastSimulationAge = -1.f;
+	/** Producer only, mesh build have its own plan in render entry */
+	FLGUIParticleBindingPlan BindingPlan;
+};
@@ -0,0 +1,627 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#include "LGUIParticleSpriteBuilder.h"
+#include "NiagaraDataSet.h"
+#include "NiagaraSpriteRendererProperties.h"
+#include "Templates/IntegerSequence.h"
+
+//PRAGMA_DISABLE_OPTIMIZATION
+
+static const FNiagaraVariableLayoutInfo* FindVariableLayout(const FNiagaraDataSet& DataSet, const FName& VariableName)
+{
+	const FNiagaraDataSetCompiledData& CompiledData = DataSet.GetCompiledData();
+	const int32 VariableIndex = CompiledData.Variables.IndexOfByPredicate([VariableName](const FNiagaraVariable& Item) { return Item.GetName() == VariableName; });
+	if (VariableIndex == INDEX_NONE)
+		return nullptr;
+	return &CompiledData.VariableLayouts[VariableIndex];
+}
+
+int32 LGUIParticleDataSetLayout::FindInt32Component(const FNiagaraDataSet& DataSet, const FName& VariableName, uint32 ComponentOffset)
+{
+	const FNiagaraVariableLayoutInfo* Layout = FindVariableLayout(DataSet, VariableName);
+	if (Layout == nullptr || ComponentOffset >= Layout->GetNumInt32Components())
+		return INDEX_NONE;
+#if ENGINE_MAJOR_VERSION > 5 || (ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 1)
+	const uint32 Int32ComponentStart = Layout->GetInt32ComponentStart();
+#else
+	const uint32 Int32ComponentStart = Layout->Int32ComponentStart;
+#endif
+	return Int32ComponentStart + ComponentOffset;
+}
+
+int32 LGUIParticleDataSetLayout::FindFloatComponent(const FNiagaraDataSet& DataSet, const FName& VariableName, uint32 ComponentOffset)
+{
+	const FNiagaraVariableLayoutInfo* LayoutPtr = FindVariableLayout(DataSet, VariableName);
+	if (LayoutPtr == nullptr)
+		return INDEX_NONE;
+
+	const FNiagaraVariableLayoutInfo& Layout = *LayoutPtr;
+#if ENGINE_MAJOR_VERSION > 5 || (ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 1)
+	const uint32 FloatComponentStart = Layout.GetFloatComponentStart();
+#else
+	const uint32 FloatComponentStart = Layout.FloatComponentStart;
+#endif
+	if (ComponentOffset >= Layout.GetNumFloatComponents())
+		return INDEX_NONE;
+	return FloatComponentStart + ComponentOffset;
+}
+
+void FLGUISpriteParticleStreams::ResolveBindingPlan(FLGUIParticleBindingPlan& OutPlan, const FNiagaraDataSet& DataSet, const UNiagaraSpriteRendererProperties* SpriteRenderer)
+{
+	using namespace LGUIParticleDataSetLayout;
+	//same order as GetStreamPointers
+	int32* Components = OutPlan.SpriteFloatComponents;
+	const FName PositionName = SpriteRenderer->PositionBinding.GetDataSetBindableVariable().GetName();
+	Components[0] = FindFloatComponent(DataSet, PositionName, 0);
+	Components[1] = FindFloatComponent(DataSet, PositionName, 2);
+
+	const FName ColorName = SpriteRenderer->ColorBinding.GetDataSetBindableVariable().GetName();
+	for (int i = 0; i < 4; i++)
+	{
+		Components[2 + i] = FindFloatComponent(DataSet, ColorName, i);
+	}
+	//color is all or nothing, same as reading a FLinearColor
+	if (Components[2] == INDEX_NONE || Components[3] == INDEX_NONE || Components[4] == INDEX_NONE || Components[5] == INDEX_NONE)
+	{
+		Components[2] = Components[3] = Components[4] = Components[5] = INDEX_NONE;
+	}
+
+	const FName VelocityName = SpriteRenderer->VelocityBinding.GetDataSetBindableVariable().GetName();
+	Components[6] = FindFloatComponent(DataSet, VelocityName, 0);
+	Components[7] = FindFloatComponent(DataSet, VelocityName, 2);
+
+	const FName SizeName = SpriteRenderer->SpriteSizeBinding.GetDataSetBindableVariable().GetName();
+	Components[8] = FindFloatComponent(DataSet, SizeName, 0);
+	Components[9] = FindFloatComponent(DataSet, SizeName, 1);
+
+	Components[10] = FindFloatComponent(DataSet, SpriteRenderer->SpriteRotationBinding.GetDataSetBindableVariable().GetName(), 0);
+	Components[11] = FindFloatComponent(DataSet, SpriteRenderer->SubImageIndexBinding.GetDataSetBindableVariable().GetName(), 0);
+
+	const FName DynamicMaterialName = SpriteRenderer->DynamicMaterialBinding.GetDataSetBindableVariable().GetName();
+	for (int i = 0; i < 4; i++)
+	{
+		Components[12 + i] = FindFloatComponent(DataSet, DynamicMaterialName, i);
+	}
+
+	//FNiagaraID.Index, stable for the whole life of particle
+	OutPlan.IDInt32Component = FindInt32Component(DataSet, FName(TEXT("ID")), 0);
+}
+
+void FLGUISpriteParticleStreams::Init(const FLGUIParticleBindingPlan& Plan, FNiagaraDataBuffer& DataBuffer)
+{
+	const float** StreamPointers[NumStreams];
+	GetStreamPointers(StreamPointers);
+	for (int32 StreamIndex = 0; StreamIndex < NumStreams; StreamIndex++)
+	{
+		const int32 Component = Plan.SpriteFloatComponents[StreamIndex];
+		*StreamPointers[StreamIndex] = Component != INDEX_NONE ? (const float*)DataBuffer.GetComponentPtrFloat(Component) : nullptr;
+	}
+	IDIndex = Plan.IDInt32Component != INDEX_NONE ? (const int32*)DataBuffer.GetComponentPtrInt32(Plan.IDInt32Component) : nullptr;
+	Count = DataBuffer.GetNumInstances();
+}
+
+void FLGUISpriteParticleStreams::GetStreamPointers(const float** (&OutStreams)[NumStreams])
+{
+	const float** Streams[NumStreams] =
+	{
+		&PositionX, &PositionZ,
+		&ColorR, &ColorG, &ColorB, &ColorA,
+		&VelocityX, &VelocityZ,
+		&SizeX, &SizeY,
+		&Rotation, &SubImage,
+		&DynamicMaterial[0], &DynamicMaterial[1], &DynamicMaterial[2], &DynamicMaterial[3],
+	};
+	FMemory::Memcpy(OutStreams, Streams, sizeof(Streams));
+}
+
+void FLGUISpriteBuildParams::Init(bool bInLocalSpace, const FVector& ComponentLocation, const FVector& ComponentScale, const FRotator& ComponentRotation
+	, float ScaleFactor, MyVector2 LocationOffset, float InAlpha01, const UNiagaraSpriteRendererProperties* SpriteRenderer)
+{
+	bLocalSpace = bInLocalSpace;
+	if (bLocalSpace)
+	{
+		//same as: scale by component, rotate by -pitch, then offset
+		float Sin, Cos;
+		FMath::SinCos(&Sin, &Cos, FMath::DegreesToRadians(-ComponentRotation.Pitch));
+		const MyVector2 Scale = MyVector2(ComponentScale.X, ComponentScale.Z) * ScaleFactor;
+		AxisX = MyVector2(Cos * Scale.X, Sin * Scale.X);
+		AxisY = MyVector2(-Sin * Scale.Y, Cos * Scale.Y);
+		Translation = LocationOffset + MyVector2(ComponentLocation.X, ComponentLocation.Z) * ScaleFactor;
+		SizeScale = Scale;
+		ComponentPitch = ComponentRotation.Pitch;
+	}
+	else
+	{
+		AxisX = MyVector2(ScaleFactor, 0.f);
+		AxisY = MyVector2(0.f, ScaleFactor);
+		Translation = LocationOffset;
+		SizeScale = MyVector2(ScaleFactor, ScaleFactor);
+		ComponentPitch = 0.f;
+	}
+	Alpha01 = InAlpha01;
+	SubImageSize = (MyVector2)SpriteRenderer->SubImageSize;
+	SubImageDelta = MyVector2::UnitVector / SubImageSize;
+	bUseSubImage = SubImageSize != MyVector2(1.f, 1.f);
+	bVelocityAligned = SpriteRenderer->Alignment == ENiagaraSpriteAlignment::VelocityAligned;
+}
+
+FORCEINLINE MyVector2 SpriteFastRotate(const MyVector2 Vector, float Sin, float Cos)
+{
+	return MyVector2(Cos * Vector.X - Sin * Vector.Y,
+		Sin * Vector.X + Cos * Vector.Y);
+}
+
+template<typename T>
+FORCEINLINE T ReadSpriteStream(const T* Stream, int32 Index, T Default)
+{
+	return Stream != nullptr ? Stream[Index] : Default;
+}
+
+FORCEINLINE FColor MakeSpriteColor(float R, float G, float B, float A, float Alpha01)
+{
+	FColor Result = FLinearColor(R, G, B, A).ToFColor(false);
+	Result.A = Result.A * Alpha01;
+	return Result;
+}
+
+
+FORCEINLINE void GetSpriteTextureCoordinates(const FLGUISpriteBuildParams& Params, float ParticleSubImage, MyVector2* OutTextureCoordinates)
+{
+	if (Params.bUseSubImage)
+	{
+		const int Row = (int)FMath::Floor(ParticleSubImage / Params.SubImageSize.X) % (int)Params.SubImageSize.Y;
+		const int Column = (int)(ParticleSubImage) % (int)(Params.SubImageSize.X);
+
+		const float LeftUV = Params.SubImageDelta.X * Column;
+		const float Right = Params.SubImageDelta.X * (Column + 1);
+		const float TopUV = Params.SubImageDelta.Y * Row;
+		const float BottomUV = Params.SubImageDelta.Y * (Row + 1);
+
+		OutTextureCoordinates[0] = MyVector2(LeftUV, TopUV);
+		OutTextureCoordinates[1] = MyVector2(Right, TopUV);
+		OutTextureCoordinates[2] = MyVector2(LeftUV, BottomUV);
+		OutTextureCoordinates[3] = MyVector2(Right, BottomUV);
+	}
+	else
+	{
+		OutTextureCoordinates[0] = MyVector2(0.f, 0.f);
+		OutTextureCoordinates[1] = MyVector2(1.f, 0.f);
+		OutTextureCoordinates[2] = MyVector2(0.f, 1.f);
+		OutTextureCoordinates[3] = MyVector2(1.f, 1.f);
+	}
+}
+
+FORCEINLINE void WriteSpriteVertices(FDynamicMeshVertex* RESTRICT Vertices, const FLGUISpriteBuildParams& Params, const MyVector2* PositionArray, const FColor& Color, const MyVector2* TextureCoordinates, const MyVector4& MaterialData)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		Vertices[i].Position = MyVector3(0, PositionArray[i].X, PositionArray[i].Y);
+		Vertices[i].Color = Color;
+		Vertices[i].TextureCoordinate[0] = TextureCoordinates[i];
+		if (Params.bWriteMaterialDataUV1)
+		{
+			Vertices[i].TextureCoordinate[1].X = MaterialData.X;
+			Vertices[i].TextureCoordinate[1].Y = MaterialData.Y;
+		}
+		if (Params.bWriteMaterialDataUV2)
+		{
+			Vertices[i].TextureCoordinate[2].X = MaterialData.Z;
+			Vertices[i].TextureCoordinate[2].Y = MaterialData.W;
+		}
+	}
+}
+
+FORCEINLINE MyVector4 ReadSpriteMaterialData(const FLGUISpriteParticleStreams& Streams, const FLGUISpriteBuildParams& Params, int32 ParticleIndex)
+{
+	if (!Params.bWriteMaterialDataUV1 && !Params.bWriteMaterialDataUV2)
+	{
+		return MyVector4(0.f, 0.f, 0.f, 0.f);
+	}
+	return MyVector4(ReadSpriteStream(Streams.DynamicMaterial[0], ParticleIndex, 0.f)
+		, ReadSpriteStream(Streams.DynamicMaterial[1], ParticleIndex, 0.f)
+		, ReadSpriteStream(Streams.DynamicMaterial[2], ParticleIndex, 0.f)
+		, ReadSpriteStream(Streams.DynamicMaterial[3], ParticleIndex, 0.f));
+}
+
+void LGUIParticleSpriteBuilder::BuildScalar(const FLGUISpriteParticleStreams& Streams, const FLGUISpriteBuildParams& Params, int32 StartIndex, int32 EndIndex, FDynamicMeshVertex* OutVertices)
+{
+	const float ComponentPitchRadians = FMath::DegreesToRadians(Params.ComponentPitch);
+	for (int ParticleIndex = StartIndex; ParticleIndex < EndIndex; ++ParticleIndex)
+	{
+		const MyVector2 Position(ReadSpriteStream(Streams.PositionX, ParticleIndex, 0.f), ReadSpriteStream(Streams.PositionZ, ParticleIndex, 0.f));
+		const MyVector2 ParticlePosition = Params.AxisX * Position.X + Params.AxisY * Position.Y + Params.Translation;
+		const MyVector2 ParticleSize = MyVector2(ReadSpriteStream(Streams.SizeX, ParticleIndex, 0.f), ReadSpriteStream(Streams.SizeY, ParticleIndex, 0.f)) * Params.SizeScale;
+		const MyVector2 ParticleHalfSize = ParticleSize * 0.5;
+
+		const FColor ParticleColor = Streams.ColorR != nullptr
+			? MakeSpriteColor(Streams.ColorR[ParticleIndex], Streams.ColorG[ParticleIndex], Streams.ColorB[ParticleIndex], Streams.ColorA[ParticleIndex], Params.Alpha01)
+			: MakeSpriteColor(1.f, 1.f, 1.f, 1.f, Params.Alpha01);
+
+		float ParticleRotationSin = 0, ParticleRotationCos = 0;
+		if (Params.bVelocityAligned)
+		{
+			const MyVector2 ParticleVelocity(ReadSpriteStream(Streams.VelocityX, ParticleIndex, 0.f), -ReadSpriteStream(Streams.VelocityZ, ParticleIndex, 0.f));
+
+			ParticleRotationCos = MyVector2::DotProduct(ParticleVelocity.GetSafeNormal(), MyVector2(0.f, 1.f));
+			const float SinSign = FMath::Sign(MyVector2::DotProduct(ParticleVelocity, MyVector2(1.f, 0.f)));
+
+			if (Params.bLocalSpace)
+			{
+				const float ParticleRotation = FMath::Acos(ParticleRotationCos * SinSign) - ComponentPitchRadians;
+				FMath::SinCos(&ParticleRotationSin, &ParticleRotationCos, ParticleRotation);
+			}
+			else
+			{
+				ParticleRotationSin = FMath::Sqrt(1 - ParticleRotationCos * ParticleRotationCos) * SinSign;
+			}
+		}
+		else
+		{
+			const float ParticleRotation = ReadSpriteStream(Streams.Rotation, ParticleIndex, 0.f) - Params.ComponentPitch;
+			FMath::SinCos(&ParticleRotationSin, &ParticleRotationCos, FMath::DegreesToRadians(ParticleRotation));
+		}
+
+		MyVector2 TextureCoordinates[4];
+		GetSpriteTextureCoordinates(Params, ReadSpriteStream(Streams.SubImage, ParticleIndex, 0.f), TextureCoordinates);
+
+		MyVector2 PositionArray[4];
+		PositionArray[0] = SpriteFastRotate(MyVector2(-ParticleHalfSize.X, -ParticleHalfSize.Y), ParticleRotationSin, ParticleRotationCos);
+		PositionArray[1] = SpriteFastRotate(MyVector2(ParticleHalfSize.X, -ParticleHalfSize.Y), ParticleRotationSin, ParticleRotationCos);
+		PositionArray[2] = -PositionArray[1];
+		PositionArray[3] = -PositionArray[0];
+		for (int i = 0; i < 4; ++i)
+		{
+			PositionArray[i] += ParticlePosition;
+		}
+
+		WriteSpriteVertices(OutVertices + ParticleIndex * 4, Params, PositionArray, ParticleColor, TextureCoordinates, ReadSpriteMaterialData(Streams, Params, ParticleIndex));
+	}
+}
+
+int32 LGUIParticleSpriteBuilder::CullAndCompact(FLGUISpriteParticleStreams& InOutStreams, const FLGUISpriteBuildParams& Params, const FLGUIParticleCullRect& CullRect, int32 Stride, TArray<float>& Scratch)
+{
+	const int32 Count = InOutStreams.Count;
+	//survived particle indices are written at the end of scratch, streams are compacted to the front
+	const float** Streams[FLGUISpriteParticleStreams::NumStreams];
+	InOutStreams.GetStreamPointers(Streams);
+	int32 NumValidStreams = 0;
+	for (auto Stream : Streams)
+	{
+		NumValidStreams += *Stream != nullptr ? 1 : 0;
+	}
+	Scratch.SetNumUninitialized((NumValidStreams + 1) * Count, false);
+	int32* SurvivedIndices = (int32*)(Scratch.GetData() + NumValidStreams * Count);
+	static_assert(sizeof(int32) == sizeof(float), "survived index is stored in float array");
+
+	int32 SurvivedCount = 0;
+	for (int32 ParticleIndex = 0; ParticleIndex < Count; ParticleIndex++)
+	{
+		const MyVector2 Position(ReadSpriteStream(InOutStreams.PositionX, ParticleIndex, 0.f), ReadSpriteStream(InOutStreams.PositionZ, ParticleIndex, 0.f));
+		const MyVector2 Center = Params.AxisX * Position.X + Params.AxisY * Position.Y + Params.Translation;
+		const MyVector2 HalfSize = MyVector2(ReadSpriteStream(InOutStreams.SizeX, ParticleIndex, 0.f), ReadSpriteStream(InOutStreams.SizeY, ParticleIndex, 0.f)) * Params.SizeScale * 0.5f;
+		//rotated quad is always inside the circle of half diagonal
+		const float Radius = HalfSize.Size();
+		const bool bInsideRect = !CullRect.bEnable
+			|| (Center.X + Radius >= CullRect.Min.X && Center.X - Radius <= CullRect.Max.X
+				&& Center.Y + Radius >= CullRect.Min.Y && Center.Y - Radius <= CullRect.Max.Y);
+		//decimate by particle ID if have it, so the same particles are kept every frame
+		const bool bKeptByStride = Stride <= 1 || (ReadSpriteStream(InOutStreams.IDIndex, ParticleIndex, ParticleIndex) % Stride) == 0;
+		if (bInsideRect && bKeptByStride)
+		{
+			SurvivedIndices[SurvivedCount++] = ParticleIndex;
+		}
+	}
+	if (SurvivedCount == Count)
+		return Count;
+
+	float* Dest = Scratch.GetData();
+	for (auto Stream : Streams)
+	{
+		if (*Stream == nullptr)
+			continue;
+		const float* Source = *Stream;
+		for (int32 i = 0; i < SurvivedCount; i++)
+		{
+			Dest[i] = Source[SurvivedIndices[i]];
+		}
+		*Stream = Dest;
+		Dest += Count;
+	}
+	InOutStreams.IDIndex = nullptr;//not compacted
+	InOutStreams.Count = SurvivedCount;
+	return SurvivedCount;
+}
+
+FORCEINLINE VectorRegister LoadSpriteStream(const float* Stream, int32 Index, const VectorRegister& Default)
+{
+	return Stream != nullptr ? VectorLoad(Stream + Index) : Default;
+}
+
+/** Sqrt for non-negative input, return 0 for 0 */
+FORCEINLINE VectorRegister SpriteVectorSqrt(const VectorRegister& Value, const VectorRegister& SmallNumber)
+{
+	return VectorMultiply(Value, VectorReciprocalSqrtAccurate(VectorMax(Value, SmallNumber)));
+}
+
+/**
+ * Sin and cos of angle in degrees, for bFastMath. Reduce to [-pi/2, pi/2] then 7th degree polynomial for sin and 6th degree for cos,
+ * VectorSinCos use 11th and 10th degree. Coefficients are fitted for minimal max error, which is 1e-6 for sin and 8e-6 for cos.
+ */
+FORCEINLINE void SpriteVectorSinCosDegreesFast(VectorRegister* RESTRICT OutSin, VectorRegister* RESTRICT OutCos, const VectorRegister& Degrees)
+{
+	const VectorRegister Zero = VectorZero();
+	const VectorRegister One = VectorOne();
+	const VectorRegister Half = VectorSetFloat1(0.5f);
+	const VectorRegister Pi = VectorSetFloat1(PI);
+	//map to [-pi, pi]: Degrees - 360 * round(Degrees / 360)
+	const VectorRegister Turns = VectorMultiply(Degrees, VectorSetFloat1(1.f / 360.f));
+	const VectorRegister RoundedTurns = VectorTruncate(VectorAdd(Turns, VectorSelect(VectorCompareGE(Turns, Zero), Half, VectorNegate(Half))));
+	VectorRegister X = VectorMultiply(VectorSubtract(Turns, RoundedTurns), VectorSetFloat1(2.f * PI));
+	//map to [-pi/2, pi/2]: sin(x) = sin(pi - x), cos(x) = -cos(pi - x)
+	const VectorRegister ReflectMask = VectorCompareGT(VectorAbs(X), VectorSetFloat1(HALF_PI));
+	X = VectorSelect(ReflectMask, VectorSubtract(VectorSelect(VectorCompareGE(X, Zero), Pi, VectorNegate(Pi)), X), X);
+	const VectorRegister CosSign = VectorSelect(ReflectMask, VectorNegate(One), One);
+	const VectorRegister X2 = VectorMultiply(X, X);
+
+	VectorRegister Sin = VectorMultiplyAdd(X2, VectorSetFloat1(-1.849217468e-4f), VectorSetFloat1(8.312365984e-3f));
+	Sin = VectorMultiplyAdd(X2, Sin, VectorSetFloat1(-0.1666568106f));
+	Sin = VectorMultiplyAdd(X2, Sin, One);
+	*OutSin = VectorMultiply(X, Sin);
+
+	VectorRegister Cos = VectorMultiplyAdd(X2, VectorSetFloat1(-1.275751654e-3f), VectorSetFloat1(4.150706603e-2f));
+	Cos = VectorMultiplyAdd(X2, Cos, VectorSetFloat1(-0.4999356304f));
+	Cos = VectorMultiplyAdd(X2, Cos, One);
+	*OutCos = VectorMultiply(Cos, CosSign);
+}
+
+void LGUIParticleSpriteBuilder::SinCosDegreesFast(const float* Degrees, float* OutSin, float* OutCos)
+{
+	VectorRegister Sin, Cos;
+	SpriteVectorSinCosDegreesFast(&Sin, &Cos, VectorLoad(Degrees));
+	VectorStore(Sin, OutSin);
+	VectorStore(Cos, OutCos);
+}
+
+/** Features of a sprite kernel variant, each variant only read the attributes and do the math its features need. */
+namespace ELGUISpriteVariant
+{
+	enum Type : uint32
+	{
+		/** Particle rotated by velocity, rotation attribute or component pitch, otherwise quad is axis aligned */
+		Rotated = 1 << 0,
+		VelocityAligned = 1 << 1,
+		/** Velocity aligned in local space, need to rotate by component pitch */
+		LocalSpace = 1 << 2,
+		SubImage = 1 << 3,
+		/** Dynamic material data is written to uv1 or uv2 */
+		MaterialData = 1 << 4,
+		/** Rotated but rotation attribute not bound, every particle rotate by -pitch */
+		ConstantRotation = 1 << 5,
+
+		Count = 1 << 6,
+	};
+}
+
+template<uint32 Variant>
+static void BuildVectorizedVariant(const FLGUISpriteParticleStreams& Streams, const FLGUISpriteBuildParams& Params, int32 StartIndex, int32 EndIndex, FDynamicMeshVertex* OutVertices)
+{
+	//branches on these are plain if (module is C++14 on UE4), every branch compile in every variant and compiler remove the dead ones
+	constexpr bool bRotated = (Variant & ELGUISpriteVariant::Rotated) != 0;
+	constexpr bool bVelocityAligned = (Variant & ELGUISpriteVariant::VelocityAligned) != 0;
+	constexpr bool bLocalSpace = (Variant & ELGUISpriteVariant::LocalSpace) != 0;
+	constexpr bool bUseSubImage = (Variant & ELGUISpriteVariant::SubImage) != 0;
+	constexpr bool bMaterialData = (Variant & ELGUISpriteVariant::MaterialData) != 0;
+	constexpr bool bConstantRotation = (Variant & ELGUISpriteVariant::ConstantRotation) != 0;
+
+	const VectorRegister Zero = VectorZero();
+	const VectorRegister One = VectorOne();
+	const VectorRegister MinusOne = VectorSetFloat1(-1.f);
+	const VectorRegister SmallNumber = VectorSetFloat1(SMALL_NUMBER);
+	const VectorRegister ColorScale = VectorSetFloat1(255.999f);
+	const VectorRegister DegreesToRadians = VectorSetFloat1(PI / 180.f);
+
+	const VectorRegister AxisXX = VectorSetFloat1(Params.AxisX.X);
+	const VectorRegister AxisXY = VectorSetFloat1(Params.AxisX.Y);
+	const VectorRegister AxisYX = VectorSetFloat1(Params.AxisY.X);
+	const VectorRegister AxisYY = VectorSetFloat1(Params.AxisY.Y);
+	const VectorRegister TranslationX = VectorSetFloat1(Params.Translation.X);
+	const VectorRegister TranslationY = VectorSetFloat1(Params.Translation.Y);
+	const VectorRegister HalfSizeScaleX = VectorSetFloat1(Params.SizeScale.X * 0.5f);
+	const VectorRegister HalfSizeScaleY = VectorSetFloat1(Params.SizeScale.Y * 0.5f);
+	const VectorRegister ComponentPitch = VectorSetFloat1(Params.ComponentPitch);
+	float PitchSin, PitchCos;
+	FMath::SinCos(&PitchSin, &PitchCos, FMath::DegreesToRadians(Params.ComponentPitch));
+	const VectorRegister ComponentPitchSin = VectorSetFloat1(PitchSin);
+	const VectorRegister ComponentPitchCos = VectorSetFloat1(PitchCos);
+	const VectorRegister ConstantRotationSin = VectorSetFloat1(-PitchSin);
+	const VectorRegister ConstantRotationCos = ComponentPitchCos;
+
+	MyVector2 ConstantTextureCoordinates[4];
+	GetSpriteTextureCoordinates(Params, 0.f, ConstantTextureCoordinates);
+
+	//lane results, VectorStore to here then scatter to vertices
+	float CornerX[4][4], CornerY[4][4];
+	float ColorR[4], ColorG[4], ColorB[4], ColorA[4];
+
+	int32 ParticleIndex = StartIndex;
+	for (; ParticleIndex + 4 <= EndIndex; ParticleIndex += 4)
+	{
+		const VectorRegister PositionX = LoadSpriteStream(Streams.PositionX, ParticleIndex, Zero);
+		const VectorRegister PositionZ = LoadSpriteStream(Streams.PositionZ, ParticleIndex, Zero);
+		const VectorRegister CenterX = VectorMultiplyAdd(PositionX, AxisXX, VectorMultiplyAdd(PositionZ, AxisYX, TranslationX));
+		const VectorRegister CenterY = VectorMultiplyAdd(PositionX, AxisXY, VectorMultiplyAdd(PositionZ, AxisYY, TranslationY));
+
+		const VectorRegister HalfSizeX = VectorMultiply(LoadSpriteStream(Streams.SizeX, ParticleIndex, Zero), HalfSizeScaleX);
+		const VectorRegister HalfSizeY = VectorMultiply(LoadSpriteStream(Streams.SizeY, ParticleIndex, Zero), HalfSizeScaleY);
+
+		//corner 0 is rotated (-HalfSize.X, -HalfSize.Y), corner 1 is rotated (HalfSize.X, -HalfSize.Y), corner 2 and 3 are opposite of 1 and 0
+		VectorRegister Corner0X, Corner0Y, Corner1X, Corner1Y;
+		if (bRotated)
+		{
+			VectorRegister Sin, Cos;
+			if (bVelocityAligned)
+			{
+				const VectorRegister VelocityX = LoadSpriteStream(Streams.VelocityX, ParticleIndex, Zero);
+				const VectorRegister VelocityY = VectorNegate(LoadSpriteStream(Streams.VelocityZ, ParticleIndex, Zero));
+				const VectorRegister LengthSquared = VectorMultiplyAdd(VelocityX, VelocityX, VectorMultiply(VelocityY, VelocityY));
+				const VectorRegister ValidMask = VectorCompareGT(LengthSquared, SmallNumber);
+				const VectorRegister InvLength = VectorReciprocalSqrtAccurate(VectorSelect(ValidMask, LengthSquared, One));
+				const VectorRegister SinSign = VectorSelect(VectorCompareGT(VelocityX, Zero), One, VectorSelect(VectorCompareGT(Zero, VelocityX), MinusOne, Zero));
+				const VectorRegister VelocityCos = VectorSelect(ValidMask, VectorMultiply(VelocityY, InvLength), Zero);
+				if (bLocalSpace)
+				{
+					//Acos(VelocityCos * SinSign) - Pitch, without Acos: rotate (S, C) by -Pitch
+					const VectorRegister C = VectorMultiply(VelocityCos, SinSign);
+					const VectorRegister S = SpriteVectorSqrt(VectorMax(VectorSubtract(One, VectorMultiply(C, C)), Zero), SmallNumber);
+					Sin = VectorSubtract(VectorMultiply(S, ComponentPitchCos), VectorMultiply(C, ComponentPitchSin));
+					Cos = VectorMultiplyAdd(C, ComponentPitchCos, VectorMultiply(S, ComponentPitchSin));
+				}
+				else
+				{
+					Cos = VelocityCos;
+					Sin = VectorMultiply(SpriteVectorSqrt(VectorMax(VectorSubtract(One, VectorMultiply(Cos, Cos)), Zero), SmallNumber), SinSign);
+				}
+			}
+			else if (bConstantRotation)
+			{
+				Sin = ConstantRotationSin;
+				Cos = ConstantRotationCos;
+			}
+			else
+			{
+				const VectorRegister Rotation = VectorSubtract(VectorLoad(Streams.Rotation + ParticleIndex), ComponentPitch);
+				if (VectorMaskBits(VectorCompareNE(Rotation, Zero)) == 0)
+				{
+					//common for ui particles that don't rotate
+					Sin = Zero;
+					Cos = One;
+				}
+				else if (Params.bFastMath)
+				{
+					SpriteVectorSinCosDegreesFast(&Sin, &Cos, Rotation);
+				}
+				else
+				{
+					const VectorRegister Angle = VectorMultiply(Rotation, DegreesToRadians);
+					VectorSinCos(&Sin, &Cos, &Angle);
+				}
+			}
+
+			const VectorRegister CosHalfX = VectorMultiply(Cos, HalfSizeX);
+			const VectorRegister SinHalfX = VectorMultiply(Sin, HalfSizeX);
+			const VectorRegister CosHalfY = VectorMultiply(Cos, HalfSizeY);
+			const VectorRegister SinHalfY = VectorMultiply(Sin, HalfSizeY);
+			Corner0X = VectorSubtract(SinHalfY, CosHalfX);
+			Corner0Y = VectorNegate(VectorAdd(SinHalfX, CosHalfY));
+			Corner1X = VectorAdd(CosHalfX, SinHalfY);
+			Corner1Y = VectorSubtract(SinHalfX, CosHalfY);
+		}
+		else
+		{
+			Corner0X = VectorNegate(HalfSizeX);
+			Corner0Y = VectorNegate(HalfSizeY);
+			Corner1X = HalfSizeX;
+			Corner1Y = Corner0Y;
+		}
+		VectorStore(VectorAdd(CenterX, Corner0X), CornerX[0]);
+		VectorStore(VectorAdd(CenterY, Corner0Y), CornerY[0]);
+		VectorStore(VectorAdd(CenterX, Corner1X), CornerX[1]);
+		VectorStore(VectorAdd(CenterY, Corner1Y), CornerY[1]);
+		VectorStore(VectorSubtract(CenterX, Corner1X), CornerX[2]);
+		VectorStore(VectorSubtract(CenterY, Corner1Y), CornerY[2]);
+		VectorStore(VectorSubtract(CenterX, Corner0X), CornerX[3]);
+		VectorStore(VectorSubtract(CenterY, Corner0Y), CornerY[3]);
+
+		//same as FLinearColor::ToFColor(false)
+		VectorStore(VectorMultiply(VectorMin(VectorMax(LoadSpriteStream(Streams.ColorR, ParticleIndex, One), Zero), One), ColorScale), ColorR);
+		VectorStore(VectorMultiply(VectorMin(VectorMax(LoadSpriteStream(Streams.ColorG, ParticleIndex, One), Zero), One), ColorScale), ColorG);
+		VectorStore(VectorMultiply(VectorMin(VectorMax(LoadSpriteStream(Streams.ColorB, ParticleIndex, One), Zero), One), ColorScale), ColorB);
+		VectorStore(VectorMultiply(VectorMin(VectorMax(LoadSpriteStream(Streams.ColorA, ParticleIndex, One), Zero), One), ColorScale), ColorA);
+
+		for (int Lane = 0; Lane < 4; Lane++)
+		{
+			const int32 LaneParticleIndex = ParticleIndex + Lane;
+			FColor ParticleColor((uint8)ColorR[Lane], (uint8)ColorG[Lane], (uint8)ColorB[Lane], (uint8)ColorA[Lane]);
+			ParticleColor.A = ParticleColor.A * Params.Alpha01;
+
+			MyVector2 TextureCoordinates[4];
+			if (bUseSubImage)
+			{
+				GetSpriteTextureCoordinates(Params, ReadSpriteStream(Streams.SubImage, LaneParticleIndex, 0.f), TextureCoordinates);
+			}
+			else
+			{
+				FMemory::Memcpy(TextureCoordinates, ConstantTextureCoordinates, sizeof(TextureCoordinates));
+			}
+
+			const MyVector2 PositionArray[4] =
+			{
+				MyVector2(CornerX[0][Lane], CornerY[0][Lane]),
+				MyVector2(CornerX[1][Lane], CornerY[1][Lane]),
+				MyVector2(CornerX[2][Lane], CornerY[2][Lane]),
+				MyVector2(CornerX[3][Lane], CornerY[3][Lane]),
+			};
+			FDynamicMeshVertex* RESTRICT Vertices = OutVertices + LaneParticleIndex * 4;
+			if (bMaterialData)
+			{
+				WriteSpriteVertices(Vertices, Params, PositionArray, ParticleColor, TextureCoordinates, ReadSpriteMaterialData(Streams, Params, LaneParticleIndex));
+			}
+			else
+			{
+				for (int i = 0; i < 4; ++i)
+				{
+					Vertices[i].Position = MyVector3(0, PositionArray[i].X, PositionArray[i].Y);
+					Vertices[i].Color = ParticleColor;
+					Vertices[i].TextureCoordinate[0] = TextureCoordinates[i];
+				}
+			}
+		}
+	}
+
+	//remaining particles
+	LGUIParticleSpriteBuilder::BuildScalar(Streams, Params, ParticleIndex, EndIndex, OutVertices);
+}
+
+template<uint32... Variants>
+static const LGUIParticleSpriteBuilder::FBuildFunction* GetVectorizedVariantTable(TIntegerSequence<uint32, Variants...>)
+{
+	static const LGUIParticleSpriteBuilder::FBuildFunction Table[] = { &BuildVectorizedVariant<Variants>... };
+	return Table;
+}
+
+LGUIParticleSpriteBuilder::FBuildFunction LGUIParticleSpriteBuilder::SelectVectorized(const FLGUISpriteParticleStreams& Streams, const FLGUISpriteBuildParams& Params)
+{
+	uint32 Variant = 0;
+	if (Params.bVelocityAligned)
+	{
+		Variant |= ELGUISpriteVariant::Rotated | ELGUISpriteVariant::VelocityAligned;
+		if (Params.bLocalSpace)
+		{
+			Variant |= ELGUISpriteVariant::LocalSpace;
+		}
+	}
+	else if (Streams.Rotation != nullptr)
+	{
+		Variant |= ELGUISpriteVariant::Rotated;
+	}
+	else if (Params.ComponentPitch != 0.f)
+	{
+		Variant |= ELGUISpriteVariant::Rotated | ELGUISpriteVariant::ConstantRotation;
+	}
+	if (Params.bUseSubImage)
+	{
+		Variant |= ELGUISpriteVariant::SubImage;
+	}
+	if (Params.bWriteMaterialDataUV1 || Params.bWriteMaterialDataUV2)
+	{
+		Variant |= ELGUISpriteVariant::MaterialData;
+	}
+	static const FBuildFunction* Table = GetVectorizedVariantTable(TMakeIntegerSequence<uint32, ELGUISpriteVariant::Count>());
+	return Table[Variant];
+}
+
+void LGUIParticleSpriteBuilder::BuildVectorized(const FLGUISpriteParticleStreams& Streams, const FLGUISpriteBuildParams& Params, int32 StartIndex, int32 EndIndex, FDynamicMeshVertex* OutVertices)
+{
+	SelectVectorized(Streams, Params)(Streams, Params, StartIndex, EndIndex, OutVertices);
+}
+//PRAGMA_ENABLE_OPTIMIZATION
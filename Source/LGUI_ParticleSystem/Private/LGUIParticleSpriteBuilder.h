@@ -0,0 +1,99 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "DynamicMeshBuilder.h"
+#include "LGUIWorldParticleSystemComponent.h"
+
+class FNiagaraDataSet;
+class FNiagaraDataBuffer;
+class UNiagaraSpriteRendererProperties;
+
+/**
+ * Sprite particle attributes read directly from niagara's float component streams (SoA).
+ * A null stream means the attribute is not bound, the builder use the same default value as FNiagaraDataSetAccessor::GetSafe.
+ */
+struct FLGUISpriteParticleStreams
+{
+	const float* PositionX = nullptr;
+	const float* PositionZ = nullptr;
+	const float* ColorR = nullptr;
+	const float* ColorG = nullptr;
+	const float* ColorB = nullptr;
+	const float* ColorA = nullptr;
+	const float* VelocityX = nullptr;
+	const float* VelocityZ = nullptr;
+	const float* SizeX = nullptr;
+	const float* SizeY = nullptr;
+	const float* Rotation = nullptr;
+	const float* SubImage = nullptr;
+	const float* DynamicMaterial[4] = { nullptr, nullptr, nullptr, nullptr };
+	/** Not a vertex attribute, only used to select particles */
+	const int32* IDIndex = nullptr;
+	int32 Count = 0;
+
+	static constexpr int32 NumStreams = 16;
+	/** Address of every stream pointer, for processing all streams the same way */
+	void GetStreamPointers(const float** (&OutStreams)[NumStreams]);
+
+	/** Find data set components of the attributes that SpriteRenderer bind, result go to OutPlan.SpriteFloatComponents in GetStreamPointers order. */
+	static void ResolveBindingPlan(FLGUIParticleBindingPlan& OutPlan, const FNiagaraDataSet& DataSet, const UNiagaraSpriteRendererProperties* SpriteRenderer);
+	void Init(const FLGUIParticleBindingPlan& Plan, FNiagaraDataBuffer& DataBuffer);
+};
+static_assert(FLGUISpriteParticleStreams::NumStreams == FLGUIParticleBindingPlan::NumSpriteStreams, "binding plan must have a component for every sprite stream");
+
+namespace LGUIParticleDataSetLayout
+{
+	/** Component index in data set's float/int32 buffers of VariableName's ComponentOffset, INDEX_NONE if not found. */
+	int32 FindFloatComponent(const FNiagaraDataSet& DataSet, const FName& VariableName, uint32 ComponentOffset);
+	int32 FindInt32Component(const FNiagaraDataSet& DataSet, const FName& VariableName, uint32 ComponentOffset);
+}
+
+/** Per-emitter constants for building sprites, resolved once before the particle loop so the loop itself don't need to check LocalSpace. */
+struct FLGUISpriteBuildParams
+{
+	/** Particle position (X, Z) to UI position: AxisX * X + AxisY * Z + Translation */
+	MyVector2 AxisX = MyVector2(1.f, 0.f);
+	MyVector2 AxisY = MyVector2(0.f, 1.f);
+	MyVector2 Translation = MyVector2(0.f, 0.f);
+	/** Multiply to particle size */
+	MyVector2 SizeScale = MyVector2(1.f, 1.f);
+	/** Component pitch in degrees, subtract from particle rotation when LocalSpace */
+	float ComponentPitch = 0.f;
+	float Alpha01 = 1.f;
+	MyVector2 SubImageSize = MyVector2(1.f, 1.f);
+	MyVector2 SubImageDelta = MyVector2(1.f, 1.f);
+	bool bLocalSpace = false;
+	bool bVelocityAligned = false;
+	bool bUseSubImage = false;
+	/** Dynamic material data go to uv1 and uv2, skip writing the channel if it is not bound or canvas don't have it */
+	bool bWriteMaterialDataUV1 = true;
+	bool bWriteMaterialDataUV2 = true;
+	/** Vectorized kernel use lower degree sin/cos polynomial for particle rotation. lgui.ParticleSystem.SpriteFastMath */
+	bool bFastMath = false;
+
+	void Init(bool bInLocalSpace, const FVector& ComponentLocation, const FVector& ComponentScale, const FRotator& ComponentRotation
+		, float ScaleFactor, MyVector2 LocationOffset, float InAlpha01, const UNiagaraSpriteRendererProperties* SpriteRenderer);
+};
+
+namespace LGUIParticleSpriteBuilder
+{
+	/** Reference implementation, one particle at a time. Write vertices of particle [StartIndex, EndIndex) to OutVertices[ParticleIndex * 4]. */
+	void BuildScalar(const FLGUISpriteParticleStreams& Streams, const FLGUISpriteBuildParams& Params, int32 StartIndex, int32 EndIndex, FDynamicMeshVertex* OutVertices);
+	/**
+	 * Remove particles whose quad bounds is totally outside of CullRect (if enabled), and keep only one of every Stride particles (if Stride > 1).
+	 * Survived particles are copied to Scratch and InOutStreams point to there. Return survived particle count.
+	 */
+	int32 CullAndCompact(FLGUISpriteParticleStreams& InOutStreams, const FLGUISpriteBuildParams& Params, const FLGUIParticleCullRect& CullRect, int32 Stride, TArray<float>& Scratch);
+	/** Same result as BuildScalar (except float rounding), but process 4 particles per iteration with VectorRegister. */
+	void BuildVectorized(const FLGUISpriteParticleStreams& Streams, const FLGUISpriteBuildParams& Params, int32 StartIndex, int32 EndIndex, FDynamicMeshVertex* OutVertices);
+	typedef void(*FBuildFunction)(const FLGUISpriteParticleStreams& Streams, const FLGUISpriteBuildParams& Params, int32 StartIndex, int32 EndIndex, FDynamicMeshVertex* OutVertices);
+	/**
+	 * BuildVectorized is compiled into variants for rotation, velocity alignment, sub image and material data, so each variant's loop only do what it need.
+	 * Select the variant once for an emitter and call it for every chunk.
+	 */
+	FBuildFunction SelectVectorized(const FLGUISpriteParticleStreams& Streams, const FLGUISpriteBuildParams& Params);
+	/** Sin and cos of 4 angles in degrees, what bFastMath use. Max error is about 1e-5 compare to FMath::SinCos. */
+	void SinCosDegreesFast(const float* Degrees, float* OutSin, float* OutCos);
+}
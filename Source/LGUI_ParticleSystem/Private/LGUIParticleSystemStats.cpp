@@ -0,0 +1,65 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#include "LGUIParticleSystemStats.h"
+#include "HAL/IConsoleManager.h"
+#include "Algo/Sort.h"
+#include "Engine/World.h"
+#include "UIParticleSystem.h"
+#include "LGUIParticleSystemSubsystem.h"
+
+DEFINE_STAT(STAT_UIParticleSystem);
+DEFINE_STAT(STAT_LGUIParticle_DataSetRead);
+DEFINE_STAT(STAT_LGUIParticle_SpriteCull);
+DEFINE_STAT(STAT_LGUIParticle_SpriteBuild);
+DEFINE_STAT(STAT_LGUIParticle_SpriteIndexFill);
+DEFINE_STAT(STAT_LGUIParticle_RibbonSort);
+DEFINE_STAT(STAT_LGUIParticle_RibbonBuild);
+DEFINE_STAT(STAT_LGUIParticle_MeshCreate);
+DEFINE_STAT(STAT_LGUIParticle_MeshUpdate);
+DEFINE_STAT(STAT_LGUIParticle_SnapshotPublish);
+DEFINE_STAT(STAT_LGUIParticle_BakedPlayback);
+
+DEFINE_STAT(STAT_LGUIParticle_Particles);
+DEFINE_STAT(STAT_LGUIParticle_Vertices);
+DEFINE_STAT(STAT_LGUIParticle_BytesUploaded);
+DEFINE_STAT(STAT_LGUIParticle_Reallocations);
+DEFINE_STAT(STAT_LGUIParticle_SnapshotsDropped);
+
+UE_TRACE_CHANNEL_DEFINE(LGUIParticleChannel);
+
+DEFINE_LOG_CATEGORY_STATIC(LogLGUIParticleStats, Log, All);
+
+static FAutoConsoleCommandWithWorldAndArgs LGUIParticleDumpTopCommand(
+	TEXT("lgui.ParticleSystem.DumpTop"),
+	TEXT("Log the most expensive UIParticleSystems of current world, sorted by last mesh build time. Arguments: [Count=10]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			auto Subsystem = ULGUIParticleSystemSubsystem::GetInstance(World);
+			if (Subsystem == nullptr)
+				return;
+			const int32 Count = FMath::Max(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 10, 1);
+
+			TArray<UUIParticleSystem*> SortedList;
+			for (auto& ItemPtr : Subsystem->GetUIParticleSystems())
+			{
+				if (auto Item = ItemPtr.Get())
+				{
+					SortedList.Add(Item);
+				}
+			}
+			Algo::Sort(SortedList, [](UUIParticleSystem* A, UUIParticleSystem* B) {
+				return A->GetBuildStats().BuildTimeMs > B->GetBuildStats().BuildTimeMs;
+				});
+
+			UE_LOG(LogLGUIParticleStats, Log, TEXT("Top %d of %d UIParticleSystems in %s:"), FMath::Min(Count, SortedList.Num()), SortedList.Num(), *World->GetName());
+			for (int32 i = 0; i < SortedList.Num() && i < Count; i++)
+			{
+				const auto Item = SortedList[i];
+				const auto& Stats = Item->GetBuildStats();
+				const auto CullStats = Item->GetCullStats();
+				UE_LOG(LogLGUIParticleStats, Log, TEXT("%2d. %s: %.3f ms, %d particles, %d culled, %d vertices, %d bytes uploaded, %d reallocations, budget stride %d")
+					, i + 1, *Item->GetPathName()
+					, Stats.BuildTimeMs, Stats.Particles, CullStats.Culled, Stats.Vertices, Stats.BytesUploaded, Stats.Reallocations
+					, Item->GetBudgetStride());
+			}
+		}));
@@ -0,0 +1,37 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "Trace/Trace.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+/** "stat LGUIParticle" */
+DECLARE_STATS_GROUP(TEXT("LGUIParticle"), STATGROUP_LGUIParticle, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("UIParticleSystem RenderToUI"), STAT_UIParticleSystem, STATGROUP_LGUIParticle, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("DataSet Read"), STAT_LGUIParticle_DataSetRead, STATGROUP_LGUIParticle, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Sprite Cull"), STAT_LGUIParticle_SpriteCull, STATGROUP_LGUIParticle, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Sprite Build"), STAT_LGUIParticle_SpriteBuild, STATGROUP_LGUIParticle, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Sprite Index Fill"), STAT_LGUIParticle_SpriteIndexFill, STATGROUP_LGUIParticle, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Ribbon Sort"), STAT_LGUIParticle_RibbonSort, STATGROUP_LGUIParticle, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Ribbon Build"), STAT_LGUIParticle_RibbonBuild, STATGROUP_LGUIParticle, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Mesh Create"), STAT_LGUIParticle_MeshCreate, STATGROUP_LGUIParticle, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Mesh Update"), STAT_LGUIParticle_MeshUpdate, STATGROUP_LGUIParticle, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Snapshot Publish"), STAT_LGUIParticle_SnapshotPublish, STATGROUP_LGUIParticle, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Baked Playback"), STAT_LGUIParticle_BakedPlayback, STATGROUP_LGUIParticle, );
+
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Particles"), STAT_LGUIParticle_Particles, STATGROUP_LGUIParticle, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Vertices"), STAT_LGUIParticle_Vertices, STATGROUP_LGUIParticle, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Bytes Uploaded"), STAT_LGUIParticle_BytesUploaded, STATGROUP_LGUIParticle, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Reallocations"), STAT_LGUIParticle_Reallocations, STATGROUP_LGUIParticle, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Snapshots Dropped"), STAT_LGUIParticle_SnapshotsDropped, STATGROUP_LGUIParticle, );
+
+/** Insights channel, enable with -trace=cpu,LGUIParticle */
+UE_TRACE_CHANNEL_EXTERN(LGUIParticleChannel);
+
+/** Cycle stat and insights cpu event of the same name */
+#define LGUIPARTICLE_SCOPE_CYCLE_COUNTER(Stat) \
+	SCOPE_CYCLE_COUNTER(Stat); \
+	TRACE_CPUPROFILER_EVENT_SCOPE_ON_CHANNEL(Stat, LGUIParticleChannel)
@@ -0,0 +1,445 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#include "LGUIParticleSystemSubsystem.h"
+#include "Engine/World.h"
+#include "Engine/GameViewportClient.h"
+#include "UObject/UObjectGlobals.h"
+#include "Algo/Sort.h"
+#include "Algo/StableSort.h"
+#include "UIParticleSystem.h"
+#include "UIParticleSystemRendererItem.h"
+#include "LGUIWorldParticleSystemComponent.h"
+#include "SLGUIParticleSystemUpdateAgentWidget.h"
+#include "Core/ActorComponent/LGUICanvas.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<int32> CVarLGUIParticleBudget(
+	TEXT("lgui.ParticleSystem.ParticleBudget"),
+	0,
+	TEXT("Max particle count rendered by all UIParticleSystems of a world, 0 means no limit. When over budget, lower BudgetPriority UIParticleSystem only render one of every N particles."));
+static TAutoConsoleVariable<int32> CVarLGUIParticleMaxRateLimitedUpdates(
+	TEXT("lgui.ParticleSystem.MaxRateLimitedUpdatesPerFrame"),
+	0,
+	TEXT("Max rate limited (FixedRate or Automatic) UIParticleSystems that rebuild mesh in one frame, the ones waited longest go first, others wait for next frame. 0 means no limit."));
+static TAutoConsoleVariable<int32> CVarLGUIParticlePoolSize(
+	TEXT("lgui.ParticleSystem.PoolSize"),
+	4,
+	TEXT("Max deactivated world particle actors kept for each niagara system when UIParticleSystem end play, so the next UIParticleSystem of the same system reset it instead of spawn a new one. 0 disable pooling."));
+static TAutoConsoleVariable<int32> CVarLGUIParticleRendererItemPoolSize(
+	TEXT("lgui.ParticleSystem.RendererItemPoolSize"),
+	16,
+	TEXT("Max renderer item actors kept for reuse when UIParticleSystem end play. 0 disable pooling."));
+
+ULGUIParticleSystemSubsystem* ULGUIParticleSystemSubsystem::GetInstance(UWorld* World)
+{
+	if (World)
+	{
+		return World->GetSubsystem<ULGUIParticleSystemSubsystem>();
+	}
+	return nullptr;
+}
+
+void ULGUIParticleSystemSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+	PreActorTickDelegateHandle = FWorldDelegates::OnWorldPreActorTick.AddUObject(this, &ULGUIParticleSystemSubsystem::OnWorldPreActorTick);
+	PostActorTickDelegateHandle = FWorldDelegates::OnWorldPostActorTick.AddUObject(this, &ULGUIParticleSystemSubsystem::OnWorldPostActorTick);
+	//async build read particle system component, so finish it before anything is collected
+	PreGarbageCollectDelegateHandle = FCoreUObjectDelegates::GetPreGarbageCollectDelegate().AddUObject(this, &ULGUIParticleSystemSubsystem::FinishAsyncMeshBuild);
+}
+
+void ULGUIParticleSystemSubsystem::Deinitialize()
+{
+	FinishAsyncMeshBuild();
+	FWorldDelegates::OnWorldPreActorTick.Remove(PreActorTickDelegateHandle);
+	FWorldDelegates::OnWorldPostActorTick.Remove(PostActorTickDelegateHandle);
+	FCoreUObjectDelegates::GetPreGarbageCollectDelegate().Remove(PreGarbageCollectDelegateHandle);
+	RemoveAgentWidget();
+	UIParticleSystems.Empty();
+	UpdateList.Empty();
+	BudgetList.Empty();
+	//pooled actors are destroyed with world
+	WorldParticleSystemPool.Empty();
+	RendererItemActorPool.Empty();
+	SharedSimulations.Empty();
+	Super::Deinitialize();
+}
+
+void ULGUIParticleSystemSubsystem::RegisterUIParticleSystem(UUIParticleSystem* InItem)
+{
+	UIParticleSystems.AddUnique(InItem);
+	if (!UpdateAgentWidget.IsValid())
+	{
+		AddAgentWidget();
+	}
+}
+
+void ULGUIParticleSystemSubsystem::UnregisterUIParticleSystem(UUIParticleSystem* InItem)
+{
+	UIParticleSystems.RemoveSwap(InItem);
+}
+
+bool ULGUIParticleSystemSubsystem::CanPool()const
+{
+	auto World = GetWorld();
+	return World != nullptr && !World->bIsTearingDown;
+}
+
+ULGUIWorldParticleSystemComponent* ULGUIParticleSystemSubsystem::SpawnWorldParticleSystem(UNiagaraSystem* InSystem, bool AutoActivate)
+{
+	auto WorldParticleSystemActor = GetWorld()->SpawnActor<ALGUIWorldParticleSystemActor>();
+	return WorldParticleSystemActor->Emit(InSystem, AutoActivate);
+}
+
+ULGUIWorldParticleSystemComponent* ULGUIParticleSystemSubsystem::AcquireWorldParticleSystem(UNiagaraSystem* InSystem, bool AutoActivate)
+{
+	if (auto Pool = WorldParticleSystemPool.Find(InSystem))
+	{
+		while (Pool->Actors.Num() > 0)
+		{
+			auto Actor = Pool->Actors.Pop(false);
+			if (IsValid(Actor) && IsValid(Actor->Niagara))
+			{
+				auto ParticleComponent = Actor->Niagara;
+				ParticleComponent->SetAutoActivate(AutoActivate);
+				if (AutoActivate)
+				{
+					//reset keep the system instance, only particles are cleared
+					ParticleComponent->Activate(true);
+				}
+				return ParticleComponent;
+			}
+		}
+	}
+	return SpawnWorldParticleSystem(InSystem, AutoActivate);
+}
+
+void ULGUIParticleSystemSubsystem::ReleaseWorldParticleSystem(ULGUIWorldParticleSystemComponent* InComponent)
+{
+	auto Actor = Cast<ALGUIWorldParticleSystemActor>(InComponent->GetOwner());
+	if (!IsValid(Actor))
+		return;
+	auto System = InComponent->GetAsset();
+	if (IsValid(System) && CanPool())
+	{
+		auto& Pool = WorldParticleSystemPool.FindOrAdd(System);
+		if (Pool.Actors.Num() < CVarLGUIParticlePoolSize.GetValueOnGameThread())
+		{
+			InComponent->DeactivateImmediate();
+			Pool.Actors.Add(Actor);
+			return;
+		}
+	}
+	Actor->Destroy();
+}
+
+AUIParticleSystemRendererItemActor* ULGUIParticleSystemSubsystem::AcquireRendererItemActor()
+{
+	while (RendererItemActorPool.Num() > 0)
+	{
+		auto Actor = RendererItemActorPool.Pop(false);
+		if (IsValid(Actor))
+		{
+			return Actor;
+		}
+	}
+	return GetWorld()->SpawnActor<AUIParticleSystemRendererItemActor>();
+}
+
+void ULGUIParticleSystemSubsystem::ReleaseRendererItemActor(AUIParticleSystemRendererItemActor* InActor)
+{
+	if (CanPool() && RendererItemActorPool.Num() < CVarLGUIParticleRendererItemPoolSize.GetValueOnGameThread())
+	{
+		//detach from UIParticleSystem, so it is removed from canvas and not rendered
+		auto RendererItem = InActor->GetUIParticleSystemRendererItem();
+		RendererItem->DetachFromComponent(FDetachmentTransformRules::KeepRelativeTransform);
+		RendererItem->SetMaterial(nullptr);
+		RendererItem->Manager = nullptr;
+		RendererItemActorPool.Add(InActor);
+		return;
+	}
+	InActor->Destroy();
+}
+
+ULGUIWorldParticleSystemComponent* ULGUIParticleSystemSubsystem::AcquireSharedSimulation(UNiagaraSystem* InSystem, bool AutoActivate)
+{
+	auto& Simulation = SharedSimulations.FindOrAdd(InSystem);
+	if (!IsValid(Simulation.Component))
+	{
+		//shared simulation stay at origin, every instance stamp particles at its own transform
+		Simulation.Component = AcquireWorldParticleSystem(InSystem, AutoActivate);
+		Simulation.Component->SetRelativeTransform(FTransform::Identity);
+		Simulation.RefCount = 0;
+	}
+	else if (AutoActivate && !Simulation.Component->IsActive())
+	{
+		Simulation.Component->Activate(true);
+	}
+	Simulation.RefCount++;
+	return Simulation.Component;
+}
+
+void ULGUIParticleSystemSubsystem::ReleaseSharedSimulation(ULGUIWorldParticleSystemComponent* InComponent)
+{
+	for (auto Iter = SharedSimulations.CreateIterator(); Iter; ++Iter)
+	{
+		auto& Simulation = Iter->Value;
+		if (Simulation.Component == InComponent)
+		{
+			if (--Simulation.RefCount <= 0)
+			{
+				ReleaseWorldParticleSystem(InComponent);
+				Iter.RemoveCurrent();
+			}
+			return;
+		}
+	}
+}
+
+void ULGUIParticleSystemSubsystem::PrewarmPool(UNiagaraSystem* InSystem, int32 Count)
+{
+	if (!IsValid(InSystem) || !CanPool())
+		return;
+	TArray<FLGUINiagaraRendererEntry> RenderEntries;
+	auto& Pool = WorldParticleSystemPool.FindOrAdd(InSystem);
+	while (Pool.Actors.Num() < Count)
+	{
+		//activate once, so niagara create system instance now, and we know how many renderer items it need
+		auto ParticleComponent = SpawnWorldParticleSystem(InSystem, true);
+		ParticleComponent->GetRenderEntries(RenderEntries);
+		ParticleComponent->DeactivateImmediate();
+		ParticleComponent->SetAutoActivate(false);
+		Pool.Actors.Add(CastChecked<ALGUIWorldParticleSystemActor>(ParticleComponent->GetOwner()));
+		for (int i = 0; i < RenderEntries.Num(); i++)
+		{
+			RendererItemActorPool.Add(GetWorld()->SpawnActor<AUIParticleSystemRendererItemActor>());
+		}
+	}
+}
+
+void ULGUIParticleSystemSubsystem::EmptyPool()
+{
+	for (auto& KeyValue : WorldParticleSystemPool)
+	{
+		for (auto Actor : KeyValue.Value.Actors)
+		{
+			if (IsValid(Actor))
+			{
+				Actor->Destroy();
+			}
+		}
+	}
+	WorldParticleSystemPool.Empty();
+	for (auto Actor : RendererItemActorPool)
+	{
+		if (IsValid(Actor))
+		{
+			Actor->Destroy();
+		}
+	}
+	RendererItemActorPool.Empty();
+}
+
+void ULGUIParticleSystemSubsystem::OnWorldPreActorTick(UWorld* InWorld, ELevelTick InTickType, float InDeltaSeconds)
+{
+	if (InWorld != GetWorld())return;
+	//niagara is going to tick and swap its data buffer, so async build must finish before that
+	FinishAsyncMeshBuild();
+}
+
+void ULGUIParticleSystemSubsystem::OnWorldPostActorTick(UWorld* InWorld, ELevelTick InTickType, float InDeltaSeconds)
+{
+	if (InWorld != GetWorld())return;
+	//before async build begin, so async build and build on paint use the same stride
+	ApplyParticleBudget();
+	ScheduleMeshUpdates();
+	//niagara's last tick group is done, so simulation of this frame is finalized
+	for (auto& ItemPtr : UIParticleSystems)
+	{
+		if (auto Item = ItemPtr.Get())
+		{
+			if (Item->GetRenderCanvas() != nullptr)
+			{
+				Item->PublishParticleSnapshots();
+				Item->BeginAsyncMeshBuild();
+			}
+		}
+	}
+}
+
+void ULGUIParticleSystemSubsystem::ScheduleMeshUpdates()
+{
+	const double Now = GetWorld()->GetRealTimeSeconds();
+	RateLimitedList.Reset();
+	for (auto& ItemPtr : UIParticleSystems)
+	{
+		if (auto Item = ItemPtr.Get())
+		{
+			const float Interval = Item->GetMeshUpdateInterval();
+			if (Interval <= 0.f || Item->LastMeshUpdateTime < 0.0)
+			{
+				Item->bMeshUpdateScheduled = true;
+				Item->LastMeshUpdateTime = Now;
+			}
+			else
+			{
+				Item->bMeshUpdateScheduled = false;
+				if (Now - Item->LastMeshUpdateTime >= Interval)
+				{
+					RateLimitedList.Add(Item);
+				}
+			}
+		}
+	}
+	//round-robin, so many rate limited items don't update in the same frame
+	const int32 MaxUpdates = CVarLGUIParticleMaxRateLimitedUpdates.GetValueOnGameThread();
+	if (MaxUpdates > 0 && RateLimitedList.Num() > MaxUpdates)
+	{
+		Algo::Sort(RateLimitedList, [](UUIParticleSystem* A, UUIParticleSystem* B) {
+			return A->LastMeshUpdateTime < B->LastMeshUpdateTime;
+			});
+		RateLimitedList.SetNum(MaxUpdates, false);
+	}
+	for (auto Item : RateLimitedList)
+	{
+		Item->bMeshUpdateScheduled = true;
+		Item->LastMeshUpdateTime = Now;
+	}
+}
+
+void ULGUIParticleSystemSubsystem::FinishAsyncMeshBuild()
+{
+	for (auto& ItemPtr : UIParticleSystems)
+	{
+		if (auto Item = ItemPtr.Get())
+		{
+			Item->FinishAsyncMeshBuild();
+		}
+	}
+}
+
+void ULGUIParticleSystemSubsystem::ApplyParticleBudget()
+{
+	OverBudgetCount = 0;
+	int32 RemainBudget = CVarLGUIParticleBudget.GetValueOnGameThread();
+	BudgetList.Reset();
+	for (auto& ItemPtr : UIParticleSystems)
+	{
+		if (auto Item = ItemPtr.Get())
+		{
+			Item->BudgetStride = 1;
+			//same items that OnPaintUpdate update
+			if (RemainBudget > 0 && Item->GetParticleSystemInstance() != nullptr && Item->GetIsUIActiveInHierarchy() && Item->GetRenderCanvas() != nullptr)
+			{
+				BudgetList.Add(Item);
+			}
+		}
+	}
+	if (RemainBudget <= 0)
+		return;
+
+	Algo::StableSort(BudgetList, [](UUIParticleSystem* A, UUIParticleSystem* B) {
+		return A->GetBudgetPriority() > B->GetBudgetPriority();
+		});
+	for (auto Item : BudgetList)
+	{
+		const auto CullStats = Item->GetCullStats();
+		const int32 ParticleCount = CullStats.Emitted + CullStats.Culled;
+		if (ParticleCount <= RemainBudget)
+		{
+			Item->BudgetStride = 1;
+			RemainBudget -= ParticleCount;
+		}
+		else
+		{
+			//nothing left still render a few particles, so the effect don't disappear
+			Item->BudgetStride = RemainBudget > 0 ? FMath::DivideAndRoundUp(ParticleCount, RemainBudget) : ParticleCount;
+			RemainBudget -= ParticleCount / Item->BudgetStride;
+			RemainBudget = FMath::Max(RemainBudget, 0);
+			OverBudgetCount++;
+		}
+	}
+}
+
+void ULGUIParticleSystemSubsystem::AddAgentWidget()
+{
+	auto World = GetWorld();
+	if (World == nullptr)return;
+	auto GameViewport = World->GetGameViewport();
+	if (!IsValid(GameViewport))return;
+
+	UpdateAgentWidget = SNew(SLGUIParticleSystemUpdateAgentWidget);
+	GameViewport->AddViewportWidgetContent(UpdateAgentWidget.ToSharedRef());
+	UpdateAgentWidget->OnPaintCallbackDelegate.BindUObject(this, &ULGUIParticleSystemSubsystem::OnPaintUpdate);
+}
+
+void ULGUIParticleSystemSubsystem::RemoveAgentWidget()
+{
+	if (UpdateAgentWidget.IsValid())
+	{
+		UpdateAgentWidget->OnPaintCallbackDelegate.Unbind();
+		auto World = GetWorld();
+		auto GameViewport = World != nullptr ? World->GetGameViewport() : nullptr;
+		if (IsValid(GameViewport))
+		{
+			GameViewport->RemoveViewportWidgetContent(UpdateAgentWidget.ToSharedRef());
+		}
+		UpdateAgentWidget.Reset();
+	}
+}
+
+void ULGUIParticleSystemSubsystem::OnPaintUpdate()
+{
+	UpdateStats = FLGUIParticleSystemUpdateStats();
+
+	UpdateList.Reset();
+	for (int i = UIParticleSystems.Num() - 1; i >= 0; i--)
+	{
+		auto Item = UIParticleSystems[i].Get();
+		if (Item == nullptr)
+		{
+			UIParticleSystems.RemoveAtSwap(i);
+			continue;
+		}
+		const bool bVisible = Item->GetIsUIActiveInHierarchy() && Item->GetRenderCanvas() != nullptr;
+		Item->SetPausedByHidden(!bVisible);
+		//baked effect have no particle system instance, it play frames in OnPaintUpdate
+		if (bVisible && (Item->GetParticleSystemInstance() != nullptr || Item->IsUsingBakedEffect()))
+		{
+			UpdateList.Add(Item);
+		}
+		else
+		{
+			UpdateStats.Skipped++;
+		}
+	}
+	UpdateStats.Registered = UIParticleSystems.Num();
+
+	//same canvas together, so canvas data stay in cache
+	Algo::Sort(UpdateList, [](UUIParticleSystem* A, UUIParticleSystem* B) {
+		return A->GetRenderCanvas() < B->GetRenderCanvas();
+		});
+
+	//budget is applied in OnWorldPostActorTick
+	UpdateStats.OverBudget = OverBudgetCount;
+
+	ULGUICanvas* PrevCanvas = nullptr;
+	for (auto Item : UpdateList)
+	{
+		auto Canvas = Item->GetRenderCanvas();
+		if (Canvas != PrevCanvas)
+		{
+			PrevCanvas = Canvas;
+			UpdateStats.Canvases++;
+		}
+		if (!Item->bMeshUpdateScheduled)
+		{
+			UpdateStats.RateLimited++;
+		}
+		Item->OnPaintUpdate();
+		UpdateStats.Updated++;
+		const auto CullStats = Item->GetCullStats();
+		UpdateStats.ParticlesEmitted += CullStats.Emitted;
+		UpdateStats.ParticlesCulled += CullStats.Culled;
+	}
+}
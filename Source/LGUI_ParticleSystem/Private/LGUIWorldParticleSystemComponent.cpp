@@ -4,11 +4,42 @@
 #include "NiagaraRibbonRendererProperties.h"
 #include "NiagaraSpriteRendererProperties.h"
 #include "NiagaraRenderer.h"
+#include "NiagaraDataSet.h"
 #include "Core/LGUIMesh/LGUIMeshComponent.h"
 #include "Core/LGUIIndexBuffer.h"
+#include "Core/ActorComponent/LGUICanvas.h"
+#include "LGUIParticleSpriteBuilder.h"
+#include "LGUIParticleRibbonBuilder.h"
+#include "LGUIParticleSnapshot.h"
+#include "LGUIParticleCapture.h"
+#include "LGUIParticleSystemStats.h"
+#include "HAL/IConsoleManager.h"
+#include "Async/ParallelFor.h"
+#include "Misc/ScopeRWLock.h"
 
 //PRAGMA_DISABLE_OPTIMIZATION
 
+static TAutoConsoleVariable<int32> CVarLGUIParticleSpriteKernel(
+	TEXT("lgui.ParticleSystem.SpriteKernel"),
+	1,
+	TEXT("Which kernel is used to build sprite particle vertices. 0: scalar reference, one particle at a time. 1: vectorized, 4 particles per iteration."));
+static TAutoConsoleVariable<int32> CVarLGUIParticleSpriteFastMath(
+	TEXT("lgui.ParticleSystem.SpriteFastMath"),
+	0,
+	TEXT("Vectorized sprite kernel use lower degree sin/cos polynomial for particle rotation, max error is about 1e-5 of sprite size. Check with lgui.ParticleSystem.Benchmark."));
+static TAutoConsoleVariable<int32> CVarLGUIParticleLocalSpaceSkipTransform(
+	TEXT("lgui.ParticleSystem.LocalSpaceSkipTransform"),
+	0,
+	TEXT("Don't set transform of niagara component if all of its emitters are local space, mesh build apply UI transform directly. Only enable it if no module of a local space emitter read owner's transform (Engine.Owner.*), they would see identity transform."));
+static TAutoConsoleVariable<int32> CVarLGUIParticleCull(
+	TEXT("lgui.ParticleSystem.Cull"),
+	1,
+	TEXT("Skip sprite particles outside of render canvas's clip rect, or outside of screen for screen space root canvas."));
+static TAutoConsoleVariable<int32> CVarLGUIParticleSpriteChunkSize(
+	TEXT("lgui.ParticleSystem.SpriteChunkSize"),
+	2048,
+	TEXT("Sprite emitters with more particles than this are built in parallel chunks of this size. 0 means never split a sprite emitter."));
+
 ALGUIWorldParticleSystemActor::ALGUIWorldParticleSystemActor()
 {
 	PrimaryActorTick.bCanEverTick = false;
@@ -61,11 +92,15 @@ void ULGUIWorldParticleSystemComponent::GetRenderEntries(TArray<FLGUINiagaraRend
 						if (UNiagaraSpriteRendererProperties* SpriteRenderer = Cast<UNiagaraSpriteRendererProperties>(Property))
 						{
 							FLGUINiagaraRendererEntry NewEntry(Property, EmitterInst, Emitter, SpriteRenderer->Material);
+							NewEntry.MaxParticleCount = Emitter->GetMaxParticleCountEstimate();
+							NewEntry.BindingPlan.RendererType = ELGUIParticleRendererType::Sprite;
 							Renderers.Add(NewEntry);
 						}
 						else if (UNiagaraRibbonRendererProperties* RibbonRenderer = Cast<UNiagaraRibbonRendererProperties>(Property))
 						{
 							FLGUINiagaraRendererEntry NewEntry(Property, EmitterInst, Emitter, RibbonRenderer->Material);
+							NewEntry.MaxParticleCount = Emitter->GetMaxParticleCountEstimate();
+							NewEntry.BindingPlan.RendererType = ELGUIParticleRendererType::Ribbon;
 							Renderers.Add(NewEntry);
 						}
 					}
@@ -78,570 +113,579 @@ void ULGUIWorldParticleSystemComponent::GetRenderEntries(TArray<FLGUINiagaraRend
 }
 
 void ULGUIWorldParticleSystemComponent::SetTransformationForUIRendering(MyVector2 Location, MyVector2 Scale, float Angle)
+{
+	//mesh build take the transform directly, component only need it for world space emitters to spawn at the right place
+	if (CVarLGUIParticleLocalSpaceSkipTransform.GetValueOnGameThread() != 0 && !NeedsTransformForSimulation())
+	{
+		bUITransformApplied = false;
+		return;
+	}
+	//SetRelativeTransform propagate to children, update bounds and dirty render state, even if UI element don't move
+	if (bUITransformApplied && AppliedUILocation == Location && AppliedUIScale == Scale && AppliedUIAngle == Angle)
+		return;
+	bUITransformApplied = true;
+	AppliedUILocation = Location;
+	AppliedUIScale = Scale;
+	AppliedUIAngle = Angle;
+	SetRelativeTransform(MakeTransformationForUIRendering(Location, Scale, Angle));
+}
+
+bool ULGUIWorldParticleSystemComponent::NeedsTransformForSimulation()
+{
+	auto SystemInstance = GetSystemInstance();
+	if (!SystemInstance)
+		return true;
+	for (const auto& EmitterInst : SystemInstance->GetEmitters())
+	{
+		auto Emitter = EmitterInst->GetCachedEmitter();
+		if (Emitter != nullptr && !Emitter->bLocalSpace)
+			return true;
+	}
+	return false;
+}
+
+FTransform ULGUIWorldParticleSystemComponent::MakeTransformationForUIRendering(MyVector2 Location, MyVector2 Scale, float Angle)
 {
 	const FVector NewLocation(Location.X, 0, Location.Y);
 	const FVector NewScale(Scale.X, 1, Scale.Y);
 	const FRotator NewRotation(0.f, 0.f, FMath::RadiansToDegrees(Angle));
 
-	SetRelativeTransform(FTransform(NewRotation, NewLocation, NewScale));
+	return FTransform(NewRotation, NewLocation, NewScale);
 }
 
-void ULGUIWorldParticleSystemComponent::RenderUI(FLGUIMeshSection* UIMeshSection, FLGUINiagaraRendererEntry RendererEntry, float ScaleFactor, MyVector2 LocationOffset, float Alpha01, const int ParticleCountIncreaseAndDecrease)
+void ULGUIWorldParticleSystemComponent::RenderUI(FLGUIMeshSection* UIMeshSection, FLGUINiagaraRendererEntry& RendererEntry, const FLGUIParticleRenderTransform& RenderTransform, float ScaleFactor, MyVector2 LocationOffset, float Alpha01, const FLGUIParticleMeshCapacitySettings& MeshCapacity, const FLGUIParticleCullRect& CullRect, uint8 AdditionalChannels)
 {
 	if (!GetSystemInstance())
 		return;
 
-	if (UNiagaraSpriteRendererProperties* SpriteRenderer = Cast<UNiagaraSpriteRendererProperties>(RendererEntry.RendererProperties))
+	//renderer type is decided when entry is created, so no need to cast every frame
+	RendererEntry.BindingPlan.Update(RendererEntry.EmitterInstance->GetData(), RendererEntry.RendererProperties);
+	if (RendererEntry.BindingPlan.RendererType == ELGUIParticleRendererType::Sprite)
 	{
-		AddSpriteRendererData(UIMeshSection, RendererEntry.EmitterInstance, SpriteRenderer, ScaleFactor, LocationOffset, Alpha01, ParticleCountIncreaseAndDecrease);
+		auto SpriteRenderer = static_cast<UNiagaraSpriteRendererProperties*>(RendererEntry.RendererProperties);
+		AddSpriteRendererData(UIMeshSection, RendererEntry, SpriteRenderer, RenderTransform, ScaleFactor, LocationOffset, Alpha01, MeshCapacity, CullRect, AdditionalChannels);
 	}
-	else if (UNiagaraRibbonRendererProperties* RibbonRenderer = Cast<UNiagaraRibbonRendererProperties>(RendererEntry.RendererProperties))
+	else if (RendererEntry.BindingPlan.RendererType == ELGUIParticleRendererType::Ribbon)
 	{
-		AddRibbonRendererData(UIMeshSection, RendererEntry.EmitterInstance, RibbonRenderer, ScaleFactor, LocationOffset, Alpha01, ParticleCountIncreaseAndDecrease);
+		auto RibbonRenderer = static_cast<UNiagaraRibbonRendererProperties*>(RendererEntry.RendererProperties);
+		AddRibbonRendererData(UIMeshSection, RendererEntry, RibbonRenderer, RenderTransform, ScaleFactor, LocationOffset, Alpha01, MeshCapacity, AdditionalChannels);
+		RendererEntry.bIndicesChanged = true;
+		RendererEntry.CulledParticleCount = 0;
+		RendererEntry.EmittedParticleCount = RendererEntry.EmitterInstance->GetData().GetCurrentDataChecked().GetNumInstances();
 	}
 }
 
-FORCEINLINE MyVector2 FastRotate(const MyVector2 Vector, float Sin, float Cos)
-{
-	return MyVector2(Cos * Vector.X - Sin * Vector.Y,
-		Sin * Vector.X + Cos * Vector.Y);
-}
-FORCEINLINE MyVector3 MakePositionVector(const MyVector2& InVector2D)
-{
-	return MyVector3(0, InVector2D.X, InVector2D.Y);
-}
-
-void ULGUIWorldParticleSystemComponent::AddSpriteRendererData(FLGUIMeshSection* UIMeshSection
-	, TSharedRef<const FNiagaraEmitterInstance, ESPMode::ThreadSafe> EmitterInst
-	, UNiagaraSpriteRendererProperties* SpriteRenderer
-	, float ScaleFactor, MyVector2 LocationOffset, float Alpha01
-	, const int ParticleCountIncreaseAndDecrease
-)
+void FLGUIParticleBindingPlan::Update(const FNiagaraDataSet& DataSet, const UNiagaraRendererProperties* RendererProperties)
 {
-	FVector ComponentLocation = this->GetRelativeLocation();
-	FVector ComponentScale = this->GetRelativeScale3D();
-	FRotator ComponentRotation = this->GetRelativeRotation();
-	float ComponentPitchRadians = FMath::DegreesToRadians(ComponentRotation.Pitch);
-
-	FNiagaraDataSet& DataSet = EmitterInst->GetData();
-	FNiagaraDataBuffer& ParticleData = DataSet.GetCurrentDataChecked();
-	const int32 ParticleCount = ParticleData.GetNumInstances();
-
-	int VertexCount = ParticleCount * 4;
-	int IndexCount = ParticleCount * 6;
-	auto& VertexData = UIMeshSection->vertices;
-	auto& IndexData = UIMeshSection->triangles;
-
-	const int VertexCountIncreaseAndDecrease = ParticleCountIncreaseAndDecrease * 4;
-	const int IndexCountIncreaseAndDecrease = ParticleCountIncreaseAndDecrease * 6;
-
-	int NewTotalVertexCount = ((VertexCount / VertexCountIncreaseAndDecrease) + (VertexCount % VertexCountIncreaseAndDecrease > 0 ? 1 : 0)) * VertexCountIncreaseAndDecrease;
-	VertexData.SetNumZeroed(NewTotalVertexCount);
+	const FNiagaraDataSetCompiledData& Compiled = DataSet.GetCompiledData();
+	if (CompiledData == &Compiled && NumVariables == Compiled.Variables.Num()
+		&& TotalFloatComponents == Compiled.TotalFloatComponents && TotalInt32Components == Compiled.TotalInt32Components)
+		return;
 
-	int NewTotalIndexCount = ((IndexCount / IndexCountIncreaseAndDecrease) + (IndexCount % IndexCountIncreaseAndDecrease > 0 ? 1 : 0)) * IndexCountIncreaseAndDecrease;
-	IndexData.SetNumZeroed(NewTotalIndexCount);
-	if (IndexData.Num() > IndexCount)//set not required triangle index to zero
+	CompiledData = &Compiled;
+	NumVariables = Compiled.Variables.Num();
+	TotalFloatComponents = Compiled.TotalFloatComponents;
+	TotalInt32Components = Compiled.TotalInt32Components;
+	switch (RendererType)
 	{
-		FMemory::Memzero(((uint8*)IndexData.GetData()) + IndexCount * sizeof(FLGUIIndexType), (IndexData.Num() - IndexCount) * sizeof(FLGUIIndexType));
+	case ELGUIParticleRendererType::Sprite:
+		FLGUISpriteParticleStreams::ResolveBindingPlan(*this, DataSet, static_cast<const UNiagaraSpriteRendererProperties*>(RendererProperties));
+		break;
+	case ELGUIParticleRendererType::Ribbon:
+	{
+		auto RibbonRenderer = static_cast<const UNiagaraRibbonRendererProperties*>(RendererProperties);
+		RibbonColorFloatComponent = LGUIParticleDataSetLayout::FindFloatComponent(DataSet, RibbonRenderer->ColorBinding.GetDataSetBindableVariable().GetName(), 0);
+		//color is all or nothing, same as reading a FLinearColor
+		if (LGUIParticleDataSetLayout::FindFloatComponent(DataSet, RibbonRenderer->ColorBinding.GetDataSetBindableVariable().GetName(), 3) == INDEX_NONE)
+		{
+			RibbonColorFloatComponent = INDEX_NONE;
+		}
+		const FName PositionName = RibbonRenderer->PositionBinding.GetDataSetBindableVariable().GetName();
+		RibbonPositionXFloatComponent = LGUIParticleDataSetLayout::FindFloatComponent(DataSet, PositionName, 0);
+		RibbonPositionZFloatComponent = LGUIParticleDataSetLayout::FindFloatComponent(DataSet, PositionName, 2);
+		RibbonWidthFloatComponent = LGUIParticleDataSetLayout::FindFloatComponent(DataSet, RibbonRenderer->RibbonWidthBinding.GetDataSetBindableVariable().GetName(), 0);
+		IDInt32Component = LGUIParticleDataSetLayout::FindInt32Component(DataSet, FName(TEXT("ID")), 0);
+		if (LGUIParticleDataSetLayout::FindInt32Component(DataSet, FName(TEXT("ID")), 1) == INDEX_NONE)
+		{
+			IDInt32Component = INDEX_NONE;
+		}
+	}
+		break;
+	default:
+		break;
 	}
+}
 
-	if (ParticleCount < 1)
+void ULGUIWorldParticleSystemComponent::PublishSpriteSnapshot(FLGUINiagaraRendererEntry& RendererEntry)
+{
+	auto SystemInstance = GetSystemInstance();
+	if (!SystemInstance || RendererEntry.BindingPlan.RendererType != ELGUIParticleRendererType::Sprite)
 		return;
 
-	bool LocalSpace = EmitterInst->GetCachedEmitter()->bLocalSpace;
-
-	//const float FakeDepthScaler = 1 / WidgetProperties->FakeDepthScaleDistance;
-
-	auto SubImageSize = (MyVector2)SpriteRenderer->SubImageSize;
-	auto SubImageDelta = MyVector2::UnitVector / SubImageSize;
-
-#if ENGINE_MAJOR_VERSION >= 5
-	const auto PositionData = FNiagaraDataSetAccessor<FNiagaraPosition>::CreateReader(DataSet, SpriteRenderer->PositionBinding.GetDataSetBindableVariable().GetName());
-#else
-	const auto PositionData = FNiagaraDataSetAccessor<MyVector3>::CreateReader(DataSet, SpriteRenderer->PositionBinding.GetDataSetBindableVariable().GetName());
-#endif
-	const auto ColorData = FNiagaraDataSetAccessor<FLinearColor>::CreateReader(DataSet, SpriteRenderer->ColorBinding.GetDataSetBindableVariable().GetName());
-	const auto VelocityData = FNiagaraDataSetAccessor<MyVector3>::CreateReader(DataSet, SpriteRenderer->VelocityBinding.GetDataSetBindableVariable().GetName());
-	const auto SizeData = FNiagaraDataSetAccessor<MyVector2>::CreateReader(DataSet, SpriteRenderer->SpriteSizeBinding.GetDataSetBindableVariable().GetName());
-	const auto RotationData = FNiagaraDataSetAccessor<float>::CreateReader(DataSet, SpriteRenderer->SpriteRotationBinding.GetDataSetBindableVariable().GetName());
-	const auto SubImageData = FNiagaraDataSetAccessor<float>::CreateReader(DataSet, SpriteRenderer->SubImageIndexBinding.GetDataSetBindableVariable().GetName());
-	const auto DynamicMaterialData = FNiagaraDataSetAccessor<MyVector4>::CreateReader(DataSet, SpriteRenderer->DynamicMaterialBinding.GetDataSetBindableVariable().GetName());
-
-	auto GetParticlePosition2D = [&PositionData](int32 Index)
-	{
-		const auto Position3D = PositionData.GetSafe(Index, MyVector3::ZeroVector);
-		return MyVector2(Position3D.X, Position3D.Z);
-	};
-
-	auto GetParticleDepth = [&PositionData](int32 Index)
-	{
-		return PositionData.GetSafe(Index, MyVector3::ZeroVector).Y;
-	};
-
-	auto GetParticleColor = [&ColorData](int32 Index)
+	if (!RendererEntry.SpriteSnapshots.IsValid())
 	{
-		return ColorData.GetSafe(Index, FLinearColor::White);
-	};
+		RendererEntry.SpriteSnapshots = MakeShared<FLGUISpriteSnapshotRing, ESPMode::ThreadSafe>();
+	}
+	auto& Ring = *RendererEntry.SpriteSnapshots;
+	FNiagaraDataSet& DataSet = RendererEntry.EmitterInstance->GetData();
+	FNiagaraDataBuffer* DataBuffer = DataSet.GetCurrentData();
+	const float SimulationAge = SystemInstance->GetAge();
+	//paused or finished, consumer keep using the last snapshot
+	if (Ring.LastDataBuffer == DataBuffer && Ring.LastSimulationAge == SimulationAge)
+		return;
 
-	auto GetParticleVelocity2D = [&VelocityData](int32 Index)
+	if (auto Snapshot = Ring.BeginWrite())
 	{
-		const auto Velocity3D = VelocityData.GetSafe(Index, MyVector3::ZeroVector);
-		return MyVector2(Velocity3D.X, -Velocity3D.Z);
-	};
-
-	auto GetParticleSize = [&SizeData](int32 Index)
+		LGUIPARTICLE_SCOPE_CYCLE_COUNTER(STAT_LGUIParticle_SnapshotPublish);
+		FLGUISpriteParticleStreams Streams;
+		if (DataBuffer != nullptr && DataBuffer->GetNumInstances() > 0)
+		{
+			Ring.BindingPlan.RendererType = ELGUIParticleRendererType::Sprite;
+			Ring.BindingPlan.Update(DataSet, RendererEntry.RendererProperties);
+			Streams.Init(Ring.BindingPlan, *DataBuffer);
+		}
+		Snapshot->CopyFrom(Streams, DataBuffer, SimulationAge);
+		Ring.EndWrite();
+		Ring.LastDataBuffer = DataBuffer;
+		Ring.LastSimulationAge = SimulationAge;
+	}
+	else
 	{
-		return SizeData.GetSafe(Index, MyVector2::ZeroVector);
-	};
+		INC_DWORD_STAT(STAT_LGUIParticle_SnapshotsDropped);
+	}
+}
 
-	auto GetParticleRotation = [&RotationData](int32 Index)
-	{
-		return RotationData.GetSafe(Index, 0.f);
-	};
+void ULGUIWorldParticleSystemComponent::BeginCapture(const TSharedPtr<FLGUIParticleCaptureWriter>& Writer)
+{
+	CaptureWriter = Writer;
+	CaptureSourceId = Writer->AddSource();
+	LastCaptureFrame = 0;
+	CaptureBindingPlans.Reset();
+}
 
-	auto GetParticleSubImage = [&SubImageData](int32 Index)
-	{
-		return SubImageData.GetSafe(Index, 0.f);
-	};
+void ULGUIWorldParticleSystemComponent::EndCapture()
+{
+	CaptureWriter.Reset();
+	CaptureBindingPlans.Reset();
+}
 
-	auto GetDynamicMaterialData = [&DynamicMaterialData](int32 Index)
-	{
-		return DynamicMaterialData.GetSafe(Index, MyVector4(0.f, 0.f, 0.f, 0.f));
-	};
+void ULGUIWorldParticleSystemComponent::CaptureFrame(const TArray<FLGUINiagaraRendererEntry>& RenderEntries, const FLGUIParticleRenderTransform& RenderTransform, float ScaleFactor, MyVector2 LocationOffset
+	, const FLGUIParticleMeshCapacitySettings& MeshCapacity, const FLGUIParticleCullRect& CullRect, uint8 AdditionalChannels)
+{
+	auto SystemInstance = GetSystemInstance();
+	if (!SystemInstance || !CaptureWriter.IsValid() || LastCaptureFrame == GFrameCounter)
+		return;
+	LastCaptureFrame = GFrameCounter;
 
-	for (int ParticleIndex = 0; ParticleIndex < ParticleCount; ++ParticleIndex)
+	CaptureBindingPlans.SetNum(RenderEntries.Num());
+	for (int32 EntryIndex = 0; EntryIndex < RenderEntries.Num(); EntryIndex++)
 	{
-		auto ParticlePosition = GetParticlePosition2D(ParticleIndex) * ScaleFactor;
-		auto ParticleSize = GetParticleSize(ParticleIndex) * ScaleFactor;
-
-		if (LocalSpace)
+		auto& RendererEntry = RenderEntries[EntryIndex];
+		const auto RendererType = RendererEntry.BindingPlan.RendererType;
+		if (RendererType != ELGUIParticleRendererType::Sprite && RendererType != ELGUIParticleRendererType::Ribbon)
+			continue;
+
+		FNiagaraDataSet& DataSet = RendererEntry.EmitterInstance->GetData();
+		FNiagaraDataBuffer* DataBuffer = DataSet.GetCurrentData();
+		const bool bHaveParticles = DataBuffer != nullptr && DataBuffer->GetNumInstances() > 0;
+		auto& BindingPlan = CaptureBindingPlans[EntryIndex];
+		if (bHaveParticles)
 		{
-			ParticlePosition *= MyVector2(ComponentScale.X, ComponentScale.Z);
-			ParticlePosition = ParticlePosition.GetRotated(-ComponentRotation.Pitch);
-			ParticlePosition += LocationOffset;
-			ParticlePosition += MyVector2(ComponentLocation.X, ComponentLocation.Z) * ScaleFactor;
-
-			ParticleSize *= MyVector2(ComponentScale.X, ComponentScale.Z);
+			BindingPlan.RendererType = RendererType;
+			BindingPlan.Update(DataSet, RendererEntry.RendererProperties);
+		}
+		const bool bLocalSpace = RendererEntry.EmitterInstance->GetCachedEmitter()->bLocalSpace || RenderTransform.bForceLocalSpace;
+		FLGUIParticleCaptureRecord Record;
+		Record.Frame = (uint32)GFrameCounter;
+		Record.SourceId = CaptureSourceId;
+		Record.EntryIndex = EntryIndex;
+		Record.SetMeshBuildInputs(CullRect, RendererEntry.LODStride, RendererEntry.MaxParticleCount, MeshCapacity, AdditionalChannels);
+		if (RendererType == ELGUIParticleRendererType::Sprite)
+		{
+			auto SpriteRenderer = static_cast<const UNiagaraSpriteRendererProperties*>(RendererEntry.RendererProperties);
+			FLGUISpriteParticleStreams Streams;
+			FLGUISpriteBuildParams Params;
+			Params.Init(bLocalSpace, RenderTransform.Location, RenderTransform.Scale, RenderTransform.Rotation, ScaleFactor, LocationOffset, 1.f, SpriteRenderer);
+			if (bHaveParticles)
+			{
+				Streams.Init(BindingPlan, *DataBuffer);
+			}
+			const bool bHaveMaterialData = Streams.DynamicMaterial[0] != nullptr || Streams.DynamicMaterial[1] != nullptr || Streams.DynamicMaterial[2] != nullptr || Streams.DynamicMaterial[3] != nullptr;
+			Params.bWriteMaterialDataUV1 = bHaveMaterialData && (AdditionalChannels & (uint8)ELGUICanvasAdditionalChannelType::UV1) != 0;
+			Params.bWriteMaterialDataUV2 = bHaveMaterialData && (AdditionalChannels & (uint8)ELGUICanvasAdditionalChannelType::UV2) != 0;
+			Record.SetBuildParams(Params);
+			CaptureWriter->Write(Record, Streams);
 		}
 		else
 		{
-			ParticlePosition += LocationOffset;
+			auto RibbonRenderer = static_cast<const UNiagaraRibbonRendererProperties*>(RendererEntry.RendererProperties);
+			FLGUIRibbonCaptureStreams Streams;
+			FLGUIRibbonBuildParams Params;
+			Params.Init(bLocalSpace, RenderTransform.Location, RenderTransform.Scale, RenderTransform.Rotation, ScaleFactor, LocationOffset, 1.f, RibbonRenderer);
+			Params.bWriteUV1 = (AdditionalChannels & (uint8)ELGUICanvasAdditionalChannelType::UV1) != 0;
+			if (bHaveParticles)
+			{
+				Streams.Streams.Init(BindingPlan, *DataBuffer);
+				const int32 ParticleCount = Streams.Streams.Count;
+				//sort key and ribbon id are read by accessor, copy them so they are streams like the others
+				const auto SortKeyReader = RibbonRenderer->SortKeyDataSetAccessor.GetReader(DataSet);
+				CaptureRibbonSortKeys.SetNumUninitialized(ParticleCount, false);
+				for (int32 i = 0; i < ParticleCount; i++)
+				{
+					CaptureRibbonSortKeys[i] = SortKeyReader.GetSafe(i, 0.f);
+				}
+				Streams.SortKey = CaptureRibbonSortKeys.GetData();
+				const auto RibbonFullIDData = RibbonRenderer->RibbonFullIDDataSetAccessor.GetReader(DataSet);
+				if (RibbonFullIDData.IsValid())
+				{
+					CaptureRibbonIDs.SetNumUninitialized(ParticleCount * 2, false);
+					for (int32 i = 0; i < ParticleCount; i++)
+					{
+						const FNiagaraID RibbonID = RibbonFullIDData[i];
+						CaptureRibbonIDs[i] = RibbonID.Index;
+						CaptureRibbonIDs[ParticleCount + i] = RibbonID.AcquireTag;
+					}
+					Streams.RibbonIDIndex = CaptureRibbonIDs.GetData();
+					Streams.RibbonIDAcquireTag = CaptureRibbonIDs.GetData() + ParticleCount;
+				}
+				Streams.IDIndex = BindingPlan.IDInt32Component != INDEX_NONE ? (const int32*)DataBuffer->GetComponentPtrInt32(BindingPlan.IDInt32Component) : nullptr;
+			}
+			Record.SetBuildParams(Params);
+			CaptureWriter->Write(Record, Streams);
 		}
+	}
+}
 
+bool ULGUIWorldParticleSystemComponent::UpdateBuildSignature(FLGUINiagaraRendererEntry& RendererEntry, uint32 InputHash)
+{
+	auto SystemInstance = GetSystemInstance();
+	if (!SystemInstance)
+		return false;
 
-		//if (WidgetProperties->FakeDepthScale)
-		//{
-		//	const float ParticleDepth = (-GetParticleDepth(ParticleIndex) + WidgetProperties->FakeDepthScaleDistance) * FakeDepthScaler;
-		//	ParticleSize *= ParticleDepth;
-		//}
-
-
-		const MyVector2 ParticleHalfSize = ParticleSize * 0.5;
-
-
-		FColor ParticleColor = GetParticleColor(ParticleIndex).ToFColor(false);
-		ParticleColor.A = ParticleColor.A * Alpha01;
-
+	FLGUIParticleBuildSignature Signature;
+	Signature.InputHash = InputHash;
+	if (RendererEntry.SpriteSnapshots.IsValid())
+	{
+		//consume snapshot here, so signature and mesh build see the same one
+		RendererEntry.SpriteSnapshot = RendererEntry.SpriteSnapshots->Acquire();
+		Signature.DataBuffer = RendererEntry.SpriteSnapshot != nullptr ? RendererEntry.SpriteSnapshot->DataBuffer : nullptr;
+		Signature.NumInstances = RendererEntry.SpriteSnapshot != nullptr ? RendererEntry.SpriteSnapshot->Streams.Count : 0;
+		Signature.SimulationAge = RendererEntry.SpriteSnapshot != nullptr ? RendererEntry.SpriteSnapshot->SimulationAge : -1.f;
+	}
+	else
+	{
+		const FNiagaraDataBuffer* DataBuffer = RendererEntry.EmitterInstance->GetData().GetCurrentData();
+		Signature.DataBuffer = DataBuffer;
+		Signature.NumInstances = DataBuffer != nullptr ? DataBuffer->GetNumInstances() : 0;
+		Signature.SimulationAge = SystemInstance->GetAge();
+	}
+	//last build already cleared the mesh, no need to clear again even if niagara is still ticking
+	const bool bStillEmpty = Signature.NumInstances == 0 && RendererEntry.LastBuildSignature.NumInstances == 0
+		&& Signature.InputHash == RendererEntry.LastBuildSignature.InputHash;
+	if (bStillEmpty || Signature == RendererEntry.LastBuildSignature)
+		return false;
+	RendererEntry.LastBuildSignature = Signature;
+	return true;
+}
 
-		float ParticleRotationSin = 0, ParticleRotationCos = 0;
+/** Quad indices (0,1,2,2,1,3 + 4 * QuadIndex) shared by all sprite mesh, only extended when a larger mesh need it. */
+static TArray<FLGUIIndexType> SpriteQuadIndexPattern;
+static FRWLock SpriteQuadIndexPatternLock;
 
-		if (SpriteRenderer->Alignment == ENiagaraSpriteAlignment::VelocityAligned)
+static void CopySpriteQuadIndices(FLGUIIndexType* Dest, int32 StartQuad, int32 EndQuad)
+{
+	{
+		FReadScopeLock ReadLock(SpriteQuadIndexPatternLock);
+		if (SpriteQuadIndexPattern.Num() >= EndQuad * 6)
 		{
-			const MyVector2 ParticleVelocity = GetParticleVelocity2D(ParticleIndex);
+			FMemory::Memcpy(Dest + StartQuad * 6, SpriteQuadIndexPattern.GetData() + StartQuad * 6, (EndQuad - StartQuad) * 6 * sizeof(FLGUIIndexType));
+			return;
+		}
+	}
+	FWriteScopeLock WriteLock(SpriteQuadIndexPatternLock);
+	const int32 PrevQuadCount = SpriteQuadIndexPattern.Num() / 6;
+	if (PrevQuadCount < EndQuad)
+	{
+		const int32 NewQuadCount = FMath::Max(EndQuad, PrevQuadCount * 2);
+		SpriteQuadIndexPattern.SetNumUninitialized(NewQuadCount * 6);
+		for (int32 QuadIndex = PrevQuadCount; QuadIndex < NewQuadCount; QuadIndex++)
+		{
+			const int VertexIndex = QuadIndex * 4;
+			FLGUIIndexType* Indices = SpriteQuadIndexPattern.GetData() + QuadIndex * 6;
+			Indices[0] = VertexIndex;
+			Indices[1] = VertexIndex + 1;
+			Indices[2] = VertexIndex + 2;
+
+			Indices[3] = VertexIndex + 2;
+			Indices[4] = VertexIndex + 1;
+			Indices[5] = VertexIndex + 3;
+		}
+	}
+	FMemory::Memcpy(Dest + StartQuad * 6, SpriteQuadIndexPattern.GetData() + StartQuad * 6, (EndQuad - StartQuad) * 6 * sizeof(FLGUIIndexType));
+}
 
-			ParticleRotationCos = MyVector2::DotProduct(ParticleVelocity.GetSafeNormal(), MyVector2(0.f, 1.f));
-			const float SinSign = FMath::Sign(MyVector2::DotProduct(ParticleVelocity, MyVector2(1.f, 0.f)));
+void ULGUIWorldParticleSystemComponent::AddSpriteRendererData(FLGUIMeshSection* UIMeshSection
+	, FLGUINiagaraRendererEntry& RendererEntry
+	, UNiagaraSpriteRendererProperties* SpriteRenderer
+	, const FLGUIParticleRenderTransform& RenderTransform
+	, float ScaleFactor, MyVector2 LocationOffset, float Alpha01
+	, const FLGUIParticleMeshCapacitySettings& MeshCapacity
+	, const FLGUIParticleCullRect& CullRect
+	, uint8 AdditionalChannels
+)
+{
+	const FVector& ComponentLocation = RenderTransform.Location;
+	const FVector& ComponentScale = RenderTransform.Scale;
+	const FRotator& ComponentRotation = RenderTransform.Rotation;
 
-			if (LocalSpace)
+	const auto& EmitterInst = RendererEntry.EmitterInstance;
+	FNiagaraDataSet& DataSet = EmitterInst->GetData();
+	//snapshot is published after simulation, so no need to touch niagara data set which may still be simulating
+	const FLGUISpriteParticleSnapshot* Snapshot = RendererEntry.SpriteSnapshots.IsValid() ? RendererEntry.SpriteSnapshot : nullptr;
+	FNiagaraDataBuffer* ParticleData = RendererEntry.SpriteSnapshots.IsValid() ? nullptr : &DataSet.GetCurrentDataChecked();
+	const int32 SimulatedParticleCount = Snapshot != nullptr ? Snapshot->Streams.Count : (ParticleData != nullptr ? ParticleData->GetNumInstances() : 0);
+
+	FLGUISpriteParticleStreams Streams;
+	FLGUISpriteBuildParams Params;
+	if (SimulatedParticleCount > 0)
+	{
+		{
+			LGUIPARTICLE_SCOPE_CYCLE_COUNTER(STAT_LGUIParticle_DataSetRead);
+			if (Snapshot != nullptr)
 			{
-				const float ParticleRotation = FMath::Acos(ParticleRotationCos * SinSign) - ComponentPitchRadians;
-				FMath::SinCos(&ParticleRotationSin, &ParticleRotationCos, ParticleRotation);
+				Streams = Snapshot->Streams;
 			}
 			else
 			{
-				ParticleRotationSin = FMath::Sqrt(1 - ParticleRotationCos * ParticleRotationCos) * SinSign;
+				Streams.Init(RendererEntry.BindingPlan, *ParticleData);
 			}
+			Params.Init(EmitterInst->GetCachedEmitter()->bLocalSpace || RenderTransform.bForceLocalSpace, ComponentLocation, ComponentScale, ComponentRotation, ScaleFactor, LocationOffset, Alpha01, SpriteRenderer);
 		}
-		else
-		{
-			float ParticleRotation = GetParticleRotation(ParticleIndex);
-
-			if (LocalSpace)
-				ParticleRotation -= ComponentRotation.Pitch;
-
-			FMath::SinCos(&ParticleRotationSin, &ParticleRotationCos, FMath::DegreesToRadians(ParticleRotation));
-		}
-
-		MyVector2 TextureCoordinates[4];
+		//dynamic material data is uv1 and uv2, only write them if bound and canvas have the channel
+		const bool bHaveMaterialData = Streams.DynamicMaterial[0] != nullptr || Streams.DynamicMaterial[1] != nullptr || Streams.DynamicMaterial[2] != nullptr || Streams.DynamicMaterial[3] != nullptr;
+		Params.bWriteMaterialDataUV1 = bHaveMaterialData && (AdditionalChannels & (uint8)ELGUICanvasAdditionalChannelType::UV1) != 0;
+		Params.bWriteMaterialDataUV2 = bHaveMaterialData && (AdditionalChannels & (uint8)ELGUICanvasAdditionalChannelType::UV2) != 0;
+	}
+	const int32 ParticleCount = BuildSpriteMesh(UIMeshSection, RendererEntry.SpriteBuildState, RendererEntry.bIndicesChanged
+		, Streams, Params, RendererEntry.LODStride, RendererEntry.MaxParticleCount, MeshCapacity, CullRect);
+	RendererEntry.EmittedParticleCount = ParticleCount;
+	RendererEntry.CulledParticleCount = SimulatedParticleCount - ParticleCount;
+}
 
-		if (SubImageSize != MyVector2(1.f, 1.f))
+int32 ULGUIWorldParticleSystemComponent::BuildSpriteMesh(FLGUIMeshSection* UIMeshSection, FLGUISpriteMeshBuildState& BuildState, bool& bOutIndicesChanged
+	, FLGUISpriteParticleStreams& Streams, FLGUISpriteBuildParams& Params, int32 LODStride, int32 MaxParticleCount
+	, const FLGUIParticleMeshCapacitySettings& MeshCapacity, const FLGUIParticleCullRect& CullRect)
+{
+	int32 ParticleCount = Streams.Count;
+	if (ParticleCount > 0)
+	{
+		Params.bFastMath = CVarLGUIParticleSpriteFastMath.GetValueOnAnyThread() != 0;
+		const int32 Stride = FMath::Max(LODStride, 1);
+		if (Stride > 1)
 		{
-			const float ParticleSubImage = GetParticleSubImage(ParticleIndex);
-			const int Row = (int)FMath::Floor(ParticleSubImage / SubImageSize.X) % (int)SubImageSize.Y;
-			const int Column = (int)(ParticleSubImage) % (int)(SubImageSize.X);
-
-			const float LeftUV = SubImageDelta.X * Column;
-			const float Right = SubImageDelta.X * (Column + 1);
-			const float TopUV = SubImageDelta.Y * Row;
-			const float BottomUV = SubImageDelta.Y * (Row + 1);
-
-			TextureCoordinates[0] = MyVector2(LeftUV, TopUV);
-			TextureCoordinates[1] = MyVector2(Right, TopUV);
-			TextureCoordinates[2] = MyVector2(LeftUV, BottomUV);
-			TextureCoordinates[3] = MyVector2(Right, BottomUV);
+			//over particle budget, emit one of every Stride particles, and enlarge them to keep similar coverage
+			Params.SizeScale *= FMath::Sqrt((float)Stride);
 		}
-		else
+		FLGUIParticleCullRect ActualCullRect = CullRect;
+		ActualCullRect.bEnable = CullRect.bEnable && CVarLGUIParticleCull.GetValueOnAnyThread() != 0;
+		if (ActualCullRect.bEnable || Stride > 1)
 		{
-			TextureCoordinates[0] = MyVector2(0.f, 0.f);
-			TextureCoordinates[1] = MyVector2(1.f, 0.f);
-			TextureCoordinates[2] = MyVector2(0.f, 1.f);
-			TextureCoordinates[3] = MyVector2(1.f, 1.f);
+			//from here Streams only contains particles inside CullRect and kept by Stride
+			LGUIPARTICLE_SCOPE_CYCLE_COUNTER(STAT_LGUIParticle_SpriteCull);
+			ParticleCount = LGUIParticleSpriteBuilder::CullAndCompact(Streams, Params, ActualCullRect, Stride, BuildState.CullStreams);
 		}
+	}
 
+	int VertexCount = ParticleCount * 4;
+	int IndexCount = ParticleCount * 6;
+	auto& VertexData = UIMeshSection->vertices;
+	auto& IndexData = UIMeshSection->triangles;
 
-		const auto MaterialData = GetDynamicMaterialData(ParticleIndex);
-
-		MyVector2 PositionArray[4];
-		PositionArray[0] = FastRotate(MyVector2(-ParticleHalfSize.X, -ParticleHalfSize.Y), ParticleRotationSin, ParticleRotationCos);
-		PositionArray[1] = FastRotate(MyVector2(ParticleHalfSize.X, -ParticleHalfSize.Y), ParticleRotationSin, ParticleRotationCos);
-		PositionArray[2] = -PositionArray[1];
-		PositionArray[3] = -PositionArray[0];
-
-		const int VertexIndex = ParticleIndex * 4;
-		const int indexIndex = ParticleIndex * 6;
-
+	//only recreate RenderResource when capacity change, good for performance
+	const int32 ParticleCapacity = MeshCapacity.GetParticleCapacity(ParticleCount, VertexData.Num() / 4, MaxParticleCount);
+	int NewTotalVertexCount = ParticleCapacity * 4;
+	VertexData.SetNumZeroed(NewTotalVertexCount);
 
-		for (int i = 0; i < 4; ++i)
+	//quad indices are same every frame, only write the range that particle count changed
+	{
+		LGUIPARTICLE_SCOPE_CYCLE_COUNTER(STAT_LGUIParticle_SpriteIndexFill);
+		if (BuildState.QuadSection != UIMeshSection || BuildState.QuadCount * 6 > IndexData.Num())
 		{
-			VertexData[VertexIndex + i].Position = MakePositionVector(PositionArray[i] + ParticlePosition);
-			VertexData[VertexIndex + i].Color = ParticleColor;
-			VertexData[VertexIndex + i].TextureCoordinate[0] = TextureCoordinates[i];
-			VertexData[VertexIndex + i].TextureCoordinate[1].X = MaterialData.X;
-			VertexData[VertexIndex + i].TextureCoordinate[1].Y = MaterialData.Y;
-			VertexData[VertexIndex + i].TextureCoordinate[2].X = MaterialData.Z;
-			VertexData[VertexIndex + i].TextureCoordinate[2].Y = MaterialData.W;
+			BuildState.QuadSection = UIMeshSection;
+			BuildState.QuadCount = 0;
+			IndexData.Reset();
 		}
+		int NewTotalIndexCount = ParticleCapacity * 6;
+		bOutIndicesChanged = IndexData.Num() != NewTotalIndexCount || BuildState.QuadCount != ParticleCount;
+		const int32 PrevQuadCount = FMath::Min(BuildState.QuadCount, NewTotalIndexCount / 6);
+		IndexData.SetNumZeroed(NewTotalIndexCount);
+		if (ParticleCount > PrevQuadCount)
+		{
+			CopySpriteQuadIndices(IndexData.GetData(), PrevQuadCount, ParticleCount);
+		}
+		else if (ParticleCount < PrevQuadCount)//set not required triangle index to zero
+		{
+			FMemory::Memzero(IndexData.GetData() + IndexCount, (PrevQuadCount - ParticleCount) * 6 * sizeof(FLGUIIndexType));
+		}
+		BuildState.QuadCount = ParticleCount;
+	}
 
+	if (ParticleCount < 1)
+		return ParticleCount;
 
-		IndexData[indexIndex] = VertexIndex;
-		IndexData[indexIndex + 1] = VertexIndex + 1;
-		IndexData[indexIndex + 2] = VertexIndex + 2;
+	LGUIPARTICLE_SCOPE_CYCLE_COUNTER(STAT_LGUIParticle_SpriteBuild);
 
-		IndexData[indexIndex + 3] = VertexIndex + 2;
-		IndexData[indexIndex + 4] = VertexIndex + 1;
-		IndexData[indexIndex + 5] = VertexIndex + 3;
+	//variant is selected once, so chunks run a loop without feature checks
+	const LGUIParticleSpriteBuilder::FBuildFunction BuildFunction = CVarLGUIParticleSpriteKernel.GetValueOnAnyThread() != 0
+		? LGUIParticleSpriteBuilder::SelectVectorized(Streams, Params)
+		: &LGUIParticleSpriteBuilder::BuildScalar;
+	auto BuildSprites = [&](int32 StartIndex, int32 EndIndex)
+	{
+		BuildFunction(Streams, Params, StartIndex, EndIndex, VertexData.GetData());
+	};
+	const int32 ChunkSize = Align(CVarLGUIParticleSpriteChunkSize.GetValueOnAnyThread(), 4);//keep chunk start aligned to vector lanes
+	if (ChunkSize > 0 && ParticleCount > ChunkSize)
+	{
+		const int32 NumChunks = FMath::DivideAndRoundUp(ParticleCount, ChunkSize);
+		ParallelFor(NumChunks, [&](int32 ChunkIndex)
+			{
+				const int32 StartIndex = ChunkIndex * ChunkSize;
+				BuildSprites(StartIndex, FMath::Min(StartIndex + ChunkSize, ParticleCount));
+			});
 	}
+	else
+	{
+		BuildSprites(0, ParticleCount);
+	}
+	return ParticleCount;
 }
 
 void ULGUIWorldParticleSystemComponent::AddRibbonRendererData(FLGUIMeshSection* UIMeshSection
-	, TSharedRef<const FNiagaraEmitterInstance, ESPMode::ThreadSafe> EmitterInst
+	, FLGUINiagaraRendererEntry& RendererEntry
 	, UNiagaraRibbonRendererProperties* RibbonRenderer
+	, const FLGUIParticleRenderTransform& RenderTransform
 	, float ScaleFactor, MyVector2 LocationOffset, float Alpha01
-	, const int ParticleCountIncreaseAndDecrease
+	, const FLGUIParticleMeshCapacitySettings& MeshCapacity
+	, uint8 AdditionalChannels
 )
 {
-	FVector ComponentLocation = GetRelativeLocation();
-	FVector ComponentScale = GetRelativeScale3D();
-	FRotator ComponentRotation = GetRelativeRotation();
-
+	const auto& EmitterInst = RendererEntry.EmitterInstance;
 	FNiagaraDataSet& DataSet = EmitterInst->GetData();
 	FNiagaraDataBuffer& ParticleData = DataSet.GetCurrentDataChecked();
 	const int32 ParticleCount = ParticleData.GetNumInstances();
 
-	auto& VertexData = UIMeshSection->vertices;
-	auto& IndexData = UIMeshSection->triangles;
-	VertexData.Reset();
-	IndexData.Reset();
-
-	if (ParticleCount < 2)
-		return;
-
-	const auto SortKeyReader = RibbonRenderer->SortKeyDataSetAccessor.GetReader(DataSet);
-
-	const auto PositionData = RibbonRenderer->PositionDataSetAccessor.GetReader(DataSet);
-	const auto ColorData = FNiagaraDataSetAccessor<FLinearColor>::CreateReader(DataSet, RibbonRenderer->ColorBinding.GetDataSetBindableVariable().GetName());
-	const auto RibbonWidthData = RibbonRenderer->SizeDataSetAccessor.GetReader(DataSet);
-
-	const auto RibbonFullIDData = RibbonRenderer->RibbonFullIDDataSetAccessor.GetReader(DataSet);
-
-	auto GetParticlePosition2D = [&PositionData](int32 Index)
-	{
-		const auto Position3D = PositionData.GetSafe(Index, MyVector3::ZeroVector);
-		return MyVector2(Position3D.X, Position3D.Z);
-	};
-
-	auto GetParticleColor = [&ColorData](int32 Index)
-	{
-		return ColorData.GetSafe(Index, FLinearColor::White);
-	};
-
-	auto GetParticleWidth = [&RibbonWidthData](int32 Index)
-	{
-		return RibbonWidthData.GetSafe(Index, 0.f);
-	};
-
-	auto AngleLargerThanPi = [](const MyVector2& A, const MyVector2& B)
+	const auto& BindingPlan = RendererEntry.BindingPlan;
+	FLGUIRibbonParticleStreams Streams;
+	FLGUIRibbonBuildParams Params;
+	bool MultiRibbons = false;
+	const int32* ParticleIDIndexData = nullptr;
+	auto& Scratch = RendererEntry.RibbonScratch;
+	if (ParticleCount >= 2)
 	{
-		float temp = A.X * B.Y - B.X * A.Y;
-		return temp < 0;
-	};
-
-	auto GenerateLinePoint = [AngleLargerThanPi](const MyVector2& InCurrentPoint, const MyVector2& InPrevPoint, const MyVector2& InNextPoint
-		, float InLineLeftWidth, float InLineRightWidth
-		, MyVector2& OutPosA, MyVector2& OutPosB
-		)
-	{
-		MyVector2 normalizedV1 = (InPrevPoint - InCurrentPoint).GetSafeNormal();
-		MyVector2 normalizedV2 = (InNextPoint - InCurrentPoint).GetSafeNormal();
-		if (normalizedV1 == -normalizedV2)
+		Streams.Init(BindingPlan, ParticleData);
+		const bool LocalSpace = EmitterInst->GetCachedEmitter()->bLocalSpace || RenderTransform.bForceLocalSpace;
+		Params.Init(LocalSpace, RenderTransform.Location, RenderTransform.Scale, RenderTransform.Rotation, ScaleFactor, LocationOffset, Alpha01, RibbonRenderer);
+		Params.bWriteUV1 = (AdditionalChannels & (uint8)ELGUICanvasAdditionalChannelType::UV1) != 0;
+
+		const auto SortKeyReader = RibbonRenderer->SortKeyDataSetAccessor.GetReader(DataSet);
+		const auto RibbonFullIDData = RibbonRenderer->RibbonFullIDDataSetAccessor.GetReader(DataSet);
+		MultiRibbons = RibbonFullIDData.IsValid();
+		ParticleIDIndexData = BindingPlan.IDInt32Component != INDEX_NONE ? (const int32*)ParticleData.GetComponentPtrInt32(BindingPlan.IDInt32Component) : nullptr;
+
+		//sort keys into entry's scratch, memory is reused every frame
+		LGUIPARTICLE_SCOPE_CYCLE_COUNTER(STAT_LGUIParticle_RibbonSort);
+		Scratch.SortKeys.SetNumUninitialized(ParticleCount, false);
+		for (int32 i = 0; i < ParticleCount; ++i)
 		{
-			auto itemNormal = MyVector2(normalizedV2.Y, -normalizedV2.X);
-			OutPosA = InCurrentPoint + InLineLeftWidth * itemNormal;
-			OutPosB = InCurrentPoint - InLineRightWidth * itemNormal;
+			Scratch.SortKeys[i] = LGUIParticleRibbonBuilder::MakeSortableFloatKey(SortKeyReader.GetSafe(i, 0.f));
 		}
-		else
+		if (MultiRibbons)
 		{
-			auto itemNormal = normalizedV1 + normalizedV2;
-			itemNormal.Normalize();
-			if (itemNormal.X == 0 && itemNormal.Y == 0)//wrong normal
+			// Sort the ribbons by ID so that the draw order stays consistent.
+			Scratch.RibbonKeys.SetNumUninitialized(ParticleCount, false);
+			for (int32 i = 0; i < ParticleCount; ++i)
 			{
-				itemNormal = MyVector2(normalizedV2.Y, -normalizedV2.X);
+				const FNiagaraID RibbonID = RibbonFullIDData[i];
+				Scratch.RibbonKeys[i] = LGUIParticleRibbonBuilder::MakeSortableRibbonKey(RibbonID.Index, RibbonID.AcquireTag);
 			}
-			float prevDotN = MyVector2::DotProduct(normalizedV1, itemNormal);
-			float angle = FMath::Acos(prevDotN);
-			float sin = FMath::Sin(angle);
-			itemNormal = AngleLargerThanPi(normalizedV1, normalizedV2) ? -itemNormal : itemNormal;
-			OutPosA = InCurrentPoint + InLineLeftWidth / sin * itemNormal;
-			OutPosB = InCurrentPoint - InLineRightWidth / sin * itemNormal;
 		}
-	};
-
-	const bool LocalSpace = EmitterInst->GetCachedEmitter()->bLocalSpace;
-	const bool FullIDs = RibbonFullIDData.IsValid();
-	const bool MultiRibbons = FullIDs;
+	}
+	BuildRibbonMesh(UIMeshSection, Scratch, Streams, Params, MultiRibbons, ParticleIDIndexData, RendererEntry.LODStride, RendererEntry.MaxParticleCount, MeshCapacity);
+}
 
-	const int VertexCountIncreaseAndDecrease = ParticleCountIncreaseAndDecrease * 2;
-	const int IndexCountIncreaseAndDecrease = ParticleCountIncreaseAndDecrease * 6;
+void ULGUIWorldParticleSystemComponent::BuildRibbonMesh(FLGUIMeshSection* UIMeshSection, FLGUIRibbonSortScratch& Scratch
+	, const FLGUIRibbonParticleStreams& Streams, const FLGUIRibbonBuildParams& Params, bool bMultiRibbons, const int32* ParticleIDIndexData
+	, int32 LODStride, int32 MaxParticleCount, const FLGUIParticleMeshCapacitySettings& MeshCapacity)
+{
+	const int32 ParticleCount = Streams.Count;
+	auto& VertexData = UIMeshSection->vertices;
+	auto& IndexData = UIMeshSection->triangles;
+	const int32 PrevParticleCapacity = VertexData.Num() / 2;
 
-	auto AddRibbonVerts = [&](TArray<int32>& RibbonIndices, int32& InOutVertexCount, int32& InOutIndexCount)
+	if (ParticleCount < 2)
 	{
-		const int32 numParticlesInRibbon = RibbonIndices.Num();
-		if (numParticlesInRibbon < 3)
-			return;
-
-		int VertexCount = (numParticlesInRibbon - 1) * 2;
-		int IndexCount = (numParticlesInRibbon - 2) * 6;
-
-		auto CurrentVertexIndex = InOutVertexCount;
-		auto CurrentIndexIndex = InOutIndexCount;
-		InOutVertexCount += VertexCount;
-		InOutIndexCount += IndexCount;
-
-		int NewTotalVertexCount = ((InOutVertexCount / VertexCountIncreaseAndDecrease) + (InOutVertexCount % VertexCountIncreaseAndDecrease > 0 ? 1 : 0)) * VertexCountIncreaseAndDecrease;
-		VertexData.SetNumZeroed(NewTotalVertexCount);
-
-		int NewTotalIndexCount = ((InOutIndexCount / IndexCountIncreaseAndDecrease) + (InOutIndexCount % IndexCountIncreaseAndDecrease > 0 ? 1 : 0)) * IndexCountIncreaseAndDecrease;
-		IndexData.SetNumZeroed(NewTotalIndexCount);
-
-		const int32 StartDataIndex = RibbonIndices[0];
-
-		float TotalDistance = 0.0f;
-
-		MyVector2 LastPosition = GetParticlePosition2D(StartDataIndex);
-		MyVector2 CurrentPosition = MyVector2::ZeroVector;
-		float CurrentWidth = 0.f;
-		MyVector2 LastToCurrentVector = MyVector2::ZeroVector;
-		float LastToCurrentSize = 0.f;
-		float LastU0 = 0.f;
-		float LastU1 = 0.f;
-
-		MyVector2 LastParticleUIPosition = LastPosition * ScaleFactor;
-
-		if (LocalSpace)
-		{
-			LastParticleUIPosition *= MyVector2(ComponentScale.X, ComponentScale.Z);
-			LastParticleUIPosition = LastParticleUIPosition.GetRotated(-ComponentRotation.Pitch);
-			LastParticleUIPosition += LocationOffset;
-
-			LastParticleUIPosition += MyVector2(ComponentLocation.X, ComponentLocation.Z) * ScaleFactor;
-		}
-		else
-		{
-			LastParticleUIPosition += LocationOffset;
-		}
-
-		int32 CurrentIndex = 1;
-		int32 CurrentDataIndex = RibbonIndices[CurrentIndex];
-
-		CurrentPosition = GetParticlePosition2D(CurrentDataIndex);
-		LastToCurrentVector = CurrentPosition - LastPosition;
-		LastToCurrentSize = LastToCurrentVector.Size();
-
-		// Normalize LastToCurrVec
-		LastToCurrentVector *= 1.f / LastToCurrentSize;
-
-
-		FColor InitialColor = GetParticleColor(StartDataIndex).ToFColor(false);
-		InitialColor.A = InitialColor.A * Alpha01;
-		const float InitialWidth = GetParticleWidth(StartDataIndex) * ScaleFactor;
-
-		MyVector2 InitialPositionArray[2];
-		InitialPositionArray[0] = LastToCurrentVector.GetRotated(90.f) * InitialWidth * 0.5f;
-		InitialPositionArray[1] = -InitialPositionArray[0];
-
-		for (int i = 0; i < 2; ++i)
-		{
-			VertexData[CurrentVertexIndex + i].Position = MakePositionVector(InitialPositionArray[i] + LastParticleUIPosition);
-			VertexData[CurrentVertexIndex + i].Color = InitialColor;
-			VertexData[CurrentVertexIndex + i].TextureCoordinate[0] = MyVector2(i, 0);
-		}
-
-		CurrentVertexIndex += 2;
+		const int32 ParticleCapacity = MeshCapacity.GetParticleCapacity(0, PrevParticleCapacity, MaxParticleCount);
+		VertexData.SetNumZeroed(ParticleCapacity * 2);
+		IndexData.SetNumZeroed(ParticleCapacity * 6);
+		FMemory::Memzero(IndexData.GetData(), IndexData.Num() * sizeof(FLGUIIndexType));
+		return;
+	}
 
-		int32 NextIndex = CurrentIndex + 1;
+	//sort all particles by (ribbon ID, sort key) into one flat index array
+	{
+		LGUIPARTICLE_SCOPE_CYCLE_COUNTER(STAT_LGUIParticle_RibbonSort);
+		LGUIParticleRibbonBuilder::SortRibbonParticles(Scratch, ParticleCount, bMultiRibbons);
 
-		while (NextIndex < numParticlesInRibbon)
+		const int32 Stride = LODStride;
+		if (Stride > 1)
 		{
-			const int32 NextDataIndex = RibbonIndices[NextIndex];
-			const MyVector2 NextPosition = GetParticlePosition2D(NextDataIndex);
-			MyVector2 CurrentToNextVector = NextPosition - CurrentPosition;
-			const float CurrentToNextSize = CurrentToNextVector.Size();
-			CurrentWidth = GetParticleWidth(CurrentDataIndex) * ScaleFactor;
-			FColor CurrentColor = GetParticleColor(CurrentDataIndex).ToFColor(false);
-			CurrentColor.A = CurrentColor.A * Alpha01;
-
-			// Normalize CurrToNextVec
-			CurrentToNextVector *= 1.f / CurrentToNextSize;
-
-			const MyVector2 CurrentTangent = (LastToCurrentVector + CurrentToNextVector).GetSafeNormal();
-
-			TotalDistance += LastToCurrentSize;
-
-			MyVector2 CurrentPositionArray[2];
-			CurrentPositionArray[0] = CurrentTangent.GetRotated(90.f) * CurrentWidth * 0.5f;
-			CurrentPositionArray[1] = -CurrentPositionArray[0];
-
-			MyVector2 CurrentParticleUIPosition = CurrentPosition * ScaleFactor;
-
-			if (LocalSpace)
-			{
-				CurrentParticleUIPosition *= MyVector2(ComponentScale.X, ComponentScale.Z);
-				CurrentParticleUIPosition = CurrentParticleUIPosition.GetRotated(-ComponentRotation.Pitch);
-				CurrentParticleUIPosition += LocationOffset;
-				CurrentParticleUIPosition += MyVector2(ComponentLocation.X, ComponentLocation.Z) * ScaleFactor;
-			}
-			else
+			//over particle budget, keep one of every Stride points (by particle ID if have it, so the same points are kept every frame), and both ends of ribbon
+			int32 WriteIndex = 0;
+			for (int32 RibbonIndex = 0; RibbonIndex + 1 < Scratch.RibbonOffsets.Num(); RibbonIndex++)
 			{
-				CurrentParticleUIPosition += LocationOffset;
-			}
-
-			float CurrentU0 = 0.f;
-
-			if (RibbonRenderer->UV0Settings.DistributionMode == ENiagaraRibbonUVDistributionMode::TiledOverRibbonLength)
-			{
-				CurrentU0 = LastU0 + LastToCurrentSize / RibbonRenderer->UV0Settings.TilingLength;
-			}
-			else
-			{
-				CurrentU0 = (float)CurrentIndex / (float)numParticlesInRibbon;
-			}
-
-			float CurrentU1 = 0.f;
-
-			if (RibbonRenderer->UV1Settings.DistributionMode == ENiagaraRibbonUVDistributionMode::TiledOverRibbonLength)
-			{
-				CurrentU1 = LastU1 + LastToCurrentSize / RibbonRenderer->UV1Settings.TilingLength;
-			}
-			else
-			{
-				CurrentU1 = (float)CurrentIndex / (float)numParticlesInRibbon;
-			}
-
-			MyVector2 TextureCoordinates0[2];
-			TextureCoordinates0[0] = MyVector2(CurrentU0, 1.f);
-			TextureCoordinates0[1] = MyVector2(CurrentU0, 0.f);
-
-			MyVector2 TextureCoordinates1[2];
-			TextureCoordinates1[0] = MyVector2(CurrentU1, 1.f);
-			TextureCoordinates1[1] = MyVector2(CurrentU1, 0.f);
-
-			for (int i = 0; i < 2; ++i)
-			{
-				VertexData[CurrentVertexIndex + i].Position = MakePositionVector(CurrentPositionArray[i] + CurrentParticleUIPosition);
-				VertexData[CurrentVertexIndex + i].Color = CurrentColor;
-				VertexData[CurrentVertexIndex + i].TextureCoordinate[0] = TextureCoordinates0[i];
-				VertexData[CurrentVertexIndex + i].TextureCoordinate[1] = TextureCoordinates1[i];
+				const int32 RibbonStart = Scratch.RibbonOffsets[RibbonIndex];
+				const int32 RibbonEnd = Scratch.RibbonOffsets[RibbonIndex + 1];
+				Scratch.RibbonOffsets[RibbonIndex] = WriteIndex;
+				for (int32 i = RibbonStart; i < RibbonEnd; i++)
+				{
+					const int32 DataIndex = Scratch.SortedIndices[i];
+					const int32 StrideKey = ParticleIDIndexData != nullptr ? ParticleIDIndexData[DataIndex] : i - RibbonStart;
+					if (i == RibbonStart || i == RibbonEnd - 1 || StrideKey % Stride == 0)
+					{
+						Scratch.SortedIndices[WriteIndex++] = DataIndex;
+					}
+				}
 			}
-
-			IndexData[CurrentIndexIndex] = CurrentVertexIndex - 2;
-			IndexData[CurrentIndexIndex + 1] = CurrentVertexIndex - 1;
-			IndexData[CurrentIndexIndex + 2] = CurrentVertexIndex;
-
-			IndexData[CurrentIndexIndex + 3] = CurrentVertexIndex;
-			IndexData[CurrentIndexIndex + 4] = CurrentVertexIndex - 1;
-			IndexData[CurrentIndexIndex + 5] = CurrentVertexIndex + 1;
-
-
-			CurrentVertexIndex += 2;
-			CurrentIndexIndex += 6;
-
-			CurrentIndex = NextIndex;
-			CurrentDataIndex = NextDataIndex;
-			LastPosition = CurrentPosition;
-			LastParticleUIPosition = CurrentParticleUIPosition;
-			CurrentPosition = NextPosition;
-			LastToCurrentVector = CurrentToNextVector;
-			LastToCurrentSize = CurrentToNextSize;
-			LastU0 = CurrentU0;
-
-			++NextIndex;
+			Scratch.RibbonOffsets.Last() = WriteIndex;
 		}
-	};
+	}
 
-	if (!MultiRibbons)
+	LGUIPARTICLE_SCOPE_CYCLE_COUNTER(STAT_LGUIParticle_RibbonBuild);
+	//2 vertices and 6 indices per particle, so capacity can be computed once before building any ribbon
+	int32 RequiredParticleCount = 0;
+	for (int32 RibbonIndex = 0; RibbonIndex + 1 < Scratch.RibbonOffsets.Num(); RibbonIndex++)
 	{
-		TArray<int32> SortedIndices;
-		for (int32 i = 0; i < ParticleCount; ++i)
+		const int32 numParticlesInRibbon = Scratch.RibbonOffsets[RibbonIndex + 1] - Scratch.RibbonOffsets[RibbonIndex];
+		if (numParticlesInRibbon >= 3)
 		{
-			SortedIndices.Add(i);
+			RequiredParticleCount += numParticlesInRibbon - 1;
 		}
+	}
+	//capacity compare with previous frame's, so only recreate RenderResource when capacity change. Old data is not cleared, every used vertex is overwritten and unused indices are zeroed below
+	const int32 ParticleCapacity = MeshCapacity.GetParticleCapacity(RequiredParticleCount, PrevParticleCapacity, MaxParticleCount);
+	VertexData.SetNumZeroed(ParticleCapacity * 2);
+	IndexData.SetNumZeroed(ParticleCapacity * 6);
 
-		SortedIndices.Sort([&SortKeyReader](const int32& A, const int32& B) {	return (SortKeyReader[A] < SortKeyReader[B]); });
-
-		int VertexCount = 0, IndexCount = 0;
-		AddRibbonVerts(SortedIndices, VertexCount, IndexCount);
-		if (IndexData.Num() > IndexCount)
-		{
-			FMemory::Memzero((void*)(IndexData.GetData() + IndexCount), (IndexData.Num() - IndexCount) * sizeof(FLGUIIndexType));
-		}
+	int VertexCount = 0, IndexCount = 0;
+	for (int32 RibbonIndex = 0; RibbonIndex + 1 < Scratch.RibbonOffsets.Num(); RibbonIndex++)
+	{
+		const int32 RibbonStart = Scratch.RibbonOffsets[RibbonIndex];
+		LGUIParticleRibbonBuilder::BuildRibbon(Streams, Params, Scratch.SortedIndices.GetData() + RibbonStart, Scratch.RibbonOffsets[RibbonIndex + 1] - RibbonStart
+			, VertexData.GetData(), IndexData.GetData(), VertexCount, IndexCount);
 	}
-	else
+	if (IndexData.Num() > IndexCount)//set not required triangle index to zero
 	{
-		if (FullIDs)
-		{
-			TMap<FNiagaraID, TArray<int32>> MultiRibbonSortedIndices;
-
-			for (int32 i = 0; i < ParticleCount; ++i)
-			{
-				TArray<int32>& Indices = MultiRibbonSortedIndices.FindOrAdd(RibbonFullIDData[i]);
-				Indices.Add(i);
-			}
-
-			// Sort the ribbons by ID so that the draw order stays consistent.
-			MultiRibbonSortedIndices.KeySort(TLess<FNiagaraID>());
-
-			int VertexCount = 0, IndexCount = 0;
-			for (TPair<FNiagaraID, TArray<int32>>& Pair : MultiRibbonSortedIndices)
-			{
-				TArray<int32>& SortedIndices = Pair.Value;
-				SortedIndices.Sort([&SortKeyReader](const int32& A, const int32& B) {	return (SortKeyReader[A] < SortKeyReader[B]); });
-				AddRibbonVerts(SortedIndices, VertexCount, IndexCount);
-			}
-			if (IndexData.Num() > IndexCount)
-			{
-				FMemory::Memzero(((uint8*)IndexData.GetData()) + IndexCount * sizeof(FLGUIIndexType), (IndexData.Num() - IndexCount) * sizeof(FLGUIIndexType));
-			}
-		}
+		FMemory::Memzero(((uint8*)IndexData.GetData()) + IndexCount * sizeof(FLGUIIndexType), (IndexData.Num() - IndexCount) * sizeof(FLGUIIndexType));
 	}
 }
 //PRAGMA_ENABLE_OPTIMIZATION
\ No newline at end of file
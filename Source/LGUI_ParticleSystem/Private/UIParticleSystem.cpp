@@ -4,9 +4,18 @@
 #include "Particles/ParticleSpriteEmitter.h"
 #include "CoreMinimal.h"
 #include "LGUIWorldParticleSystemComponent.h"
+#include "NiagaraEmitterInstance.h"
 #include "UIParticleSystemRendererItem.h"
 #include "Core/LGUIMesh/LGUIMeshComponent.h"
-#include "SLGUIParticleSystemUpdateAgentWidget.h"
+#include "Core/LGUIIndexBuffer.h"
+#include "LGUIParticleSystemSubsystem.h"
+#include "Core/ActorComponent/LGUICanvas.h"
+#include "HAL/IConsoleManager.h"
+#include "Async/ParallelFor.h"
+#include "LGUIParticleSystemStats.h"
+#include "LGUIParticleSnapshot.h"
+#include "LGUIParticleBakedEffect.h"
+#include "LGUIParticleCapture.h"
 
 #define LOCTEXT_NAMESPACE "UIParticleSystem"
 
@@ -20,6 +29,11 @@ typedef FVector2D MyVector2;
 typedef FVector4 MyVector4;
 #endif
 
+static TAutoConsoleVariable<int32> CVarLGUIParticleMergeRenderers(
+	TEXT("lgui.ParticleSystem.MergeRenderers"),
+	1,
+	TEXT("Adjacent render entries of a UIParticleSystem that use the same material share one renderer item, so they are drawn as one mesh. Entries of different UIParticleSystems are not merged. Take effect when render entries are created."));
+
 UUIParticleSystem::UUIParticleSystem(const FObjectInitializer& ObjectInitializer):Super(ObjectInitializer)
 {
 	PrimaryComponentTick.bCanEverTick = false;
@@ -30,19 +44,23 @@ void UUIParticleSystem::BeginPlay()
 {
 	Super::BeginPlay();
 
-	if (!UpdateAgentWidget.IsValid())
+	auto Subsystem = ULGUIParticleSystemSubsystem::GetInstance(this->GetWorld());
+	if (Subsystem)
 	{
-		UpdateAgentWidget = SNew(SLGUIParticleSystemUpdateAgentWidget);
-		GEngine->GameViewport->AddViewportWidgetContent(UpdateAgentWidget.ToSharedRef());
-		UpdateAgentWidget->OnPaintCallbackDelegate.BindUObject(this, &UUIParticleSystem::OnPaintUpdate);
+		Subsystem->RegisterUIParticleSystem(this);
 	}
-	if (IsValid(ParticleSystem))
+	if (IsValid(BakedEffect))
 	{
-		auto WorldParticleSystemActor = this->GetWorld()->SpawnActor<ALGUIWorldParticleSystemActor>();
-#if WITH_EDITOR
-		WorldParticleSystemActor->SetActorLabel(FString(TEXT("LGUI_PS_")) + this->GetOwner()->GetActorLabel());
-#endif
-		ParticleSystemInstance = WorldParticleSystemActor->Emit(ParticleSystem, bAutoActivateParticleSystem);
+		bUsingBakedEffect = true;
+		UpdateBakedRendererItems();
+		if (bAutoActivateParticleSystem)
+		{
+			BeginBakedPlayback();
+		}
+	}
+	else if (IsValid(ParticleSystem))
+	{
+		AcquireParticleSystemInstance();
 
 		if (bAutoActivateParticleSystem)
 		{
@@ -51,41 +69,203 @@ void UUIParticleSystem::BeginPlay()
 	}
 }
 
+void UUIParticleSystem::AcquireParticleSystemInstance()
+{
+	auto Subsystem = ULGUIParticleSystemSubsystem::GetInstance(this->GetWorld());
+	bUsingSharedSimulation = bShareSimulation && Subsystem != nullptr;
+	if (bUsingSharedSimulation)
+	{
+		ParticleSystemInstance = Subsystem->AcquireSharedSimulation(ParticleSystem, bAutoActivateParticleSystem);
+		BeginCaptureIfActive();
+		return;
+	}
+	if (Subsystem)
+	{
+		ParticleSystemInstance = Subsystem->AcquireWorldParticleSystem(ParticleSystem, bAutoActivateParticleSystem);
+	}
+	else
+	{
+		ParticleSystemInstance = this->GetWorld()->SpawnActor<ALGUIWorldParticleSystemActor>()->Emit(ParticleSystem, bAutoActivateParticleSystem);
+	}
+#if WITH_EDITOR
+	ParticleSystemInstance->GetOwner()->SetActorLabel(FString(TEXT("LGUI_PS_")) + this->GetOwner()->GetActorLabel());
+#endif
+	BeginCaptureIfActive();
+}
+
+void UUIParticleSystem::BeginCaptureIfActive()
+{
+	//lgui.ParticleSystem.Capture is running, so effects that start during capture are in the file too
+	auto CaptureWriter = FLGUIParticleCaptureWriter::GetActive();
+	if (CaptureWriter.IsValid() && ParticleSystemInstance.IsValid() && !ParticleSystemInstance->IsCapturing())
+	{
+		ParticleSystemInstance->BeginCapture(CaptureWriter);
+	}
+}
+
+void UUIParticleSystem::ReleaseParticleSystemInstance()
+{
+	SetPausedByHidden(false);
+	//actors go back to pool, so reopening the same effect don't need to spawn them again
+	auto Subsystem = ULGUIParticleSystemSubsystem::GetInstance(this->GetWorld());
+	if (ParticleSystemInstance.IsValid())
+	{
+		auto WorldParticleActor = ParticleSystemInstance->GetOwner();
+		if (IsValid(WorldParticleActor))
+		{
+			if (bUsingSharedSimulation)
+			{
+				Subsystem->ReleaseSharedSimulation(ParticleSystemInstance.Get());
+			}
+			else if (Subsystem)
+			{
+				//pooled component should not keep capture file open
+				ParticleSystemInstance->EndCapture();
+				Subsystem->ReleaseWorldParticleSystem(ParticleSystemInstance.Get());
+			}
+			else
+			{
+				WorldParticleActor->Destroy();
+			}
+		}
+		ParticleSystemInstance.Reset();
+	}
+	bUsingSharedSimulation = false;
+}
+
 void UUIParticleSystem::SetRenderEntries()
 {
 	if (!RenderEntriesValid)
 	{
+		FinishAsyncMeshBuild();
 		UWorld* World = this->GetWorld();
 		if (World)
 		{
 			ParticleSystemInstance->GetRenderEntries(RenderEntries);
 			RenderEntriesValid = true;
-			for (int i = 0; i < RenderEntries.Num(); i++)
-			{
-				auto ParticleSytemRendererItemActor = World->SpawnActor<AUIParticleSystemRendererItemActor>();
+			RenderEntryMergeSplits.Reset();
+			UpdateRendererItems();
+		}
+	}
+}
+
+UMaterialInterface* UUIParticleSystem::GetRenderEntryMaterial(int32 EntryIndex)const
+{
+	UMaterialInterface* Mat = RenderEntries[EntryIndex].Material;
+	if (auto FoundMatPtr = ReplaceMaterialMap.Find(Mat))
+	{
+		Mat = *FoundMatPtr;
+	}
+	return Mat;
+}
+
+void UUIParticleSystem::UpdateRendererItems()
+{
+	FinishAsyncMeshBuild();
+	//entries are sorted by SortOrderHint and their renderer items are adjacent in depth, so entries with same material can be drawn as one mesh
+	const bool bMerge = CVarLGUIParticleMergeRenderers.GetValueOnGameThread() != 0;
+	TArray<UMaterialInterface*, TInlineAllocator<8>> RendererMaterials;
+	RenderEntryRendererIndices.SetNum(RenderEntries.Num());
+	RenderEntryMergeSplits.SetNumZeroed(RenderEntries.Num());
+	int64 GroupMaxVertexCount = 0;
+	for (int i = 0; i < RenderEntries.Num(); i++)
+	{
+		auto Mat = GetRenderEntryMaterial(i);
+		//merged mesh must still fit index type, so only merge emitters with known max particle count. It is an estimate, MergeMeshSections check the actual size
+		const int64 MaxVertexCount = (int64)RenderEntries[i].MaxParticleCount * 4;
+		const bool bCanMerge = bMerge && RendererMaterials.Num() > 0 && RendererMaterials.Last() == Mat && !RenderEntryMergeSplits[i]
+			&& MaxVertexCount > 0 && GroupMaxVertexCount > 0 && GroupMaxVertexCount + MaxVertexCount <= (int64)TNumericLimits<FLGUIIndexType>::Max() + 1;
+		if (bCanMerge)
+		{
+			GroupMaxVertexCount += MaxVertexCount;
+		}
+		else
+		{
+			RendererMaterials.Add(Mat);
+			GroupMaxVertexCount = MaxVertexCount;
+		}
+		RenderEntryRendererIndices[i] = RendererMaterials.Num() - 1;
+	}
+	RenderEntryMergeSections.SetNum(RenderEntries.Num());
+	for (int i = 0; i < RenderEntries.Num(); i++)
+	{
+		const int32 RendererIndex = RenderEntryRendererIndices[i];
+		const bool bShareRenderer = (i > 0 && RenderEntryRendererIndices[i - 1] == RendererIndex)
+			|| (i + 1 < RenderEntries.Num() && RenderEntryRendererIndices[i + 1] == RendererIndex);
+		if (!bShareRenderer)
+		{
+			RenderEntryMergeSections[i].Reset();
+		}
+		else if (!RenderEntryMergeSections[i].IsValid())
+		{
+			RenderEntryMergeSections[i] = MakeShared<FLGUIMeshSection>();
+		}
+		//target mesh section may change, so every entry need to build again
+		RenderEntries[i].LastBuildSignature = FLGUIParticleBuildSignature();
+	}
+
+	SetRendererItemCount(RendererMaterials.Num());
+	for (int i = 0; i < RendererMaterials.Num(); i++)
+	{
+		UIParticleSystemRenderers[i]->SetMaterial(RendererMaterials[i]);
+	}
+	//staging sections are per renderer item
+	AsyncBuildStagingSections.Empty();
+}
+
+void UUIParticleSystem::SetRendererItemCount(int32 Count)
+{
+	while (UIParticleSystemRenderers.Num() > Count)
+	{
+		ReleaseRendererItem(UIParticleSystemRenderers.Pop());
+	}
+	UWorld* World = this->GetWorld();
+	auto Subsystem = ULGUIParticleSystemSubsystem::GetInstance(World);
+	for (int i = UIParticleSystemRenderers.Num(); i < Count; i++)
+	{
+		auto ParticleSytemRendererItemActor = Subsystem ? Subsystem->AcquireRendererItemActor() : World->SpawnActor<AUIParticleSystemRendererItemActor>();
 #if WITH_EDITOR
-				ParticleSytemRendererItemActor->SetActorLabel(FString::Printf(TEXT("%s_%d"), *this->GetOwner()->GetActorLabel(), i));
+		ParticleSytemRendererItemActor->SetActorLabel(FString::Printf(TEXT("%s_%d"), *this->GetOwner()->GetActorLabel(), i));
 #endif
-				auto RendererItem = ParticleSytemRendererItemActor->GetUIParticleSystemRendererItem();
-				RendererItem->AttachToComponent(this, FAttachmentTransformRules::KeepRelativeTransform);
-				RendererItem->SetWidth(0);
-				RendererItem->SetHeight(0);
-				UMaterialInterface* Mat = RenderEntries[i].Material;
-				if (auto FoundMatPtr = ReplaceMaterialMap.Find(Mat))
-				{
-					Mat = *FoundMatPtr;
-				}
-				RendererItem->SetMaterial(Mat);
-				RendererItem->Manager = this;
-				UIParticleSystemRenderers.Add(RendererItem);
-			}
+		auto RendererItem = ParticleSytemRendererItemActor->GetUIParticleSystemRendererItem();
+		RendererItem->AttachToComponent(this, FAttachmentTransformRules::KeepRelativeTransform);
+		RendererItem->SetWidth(0);
+		RendererItem->SetHeight(0);
+		RendererItem->Manager = this;
+		UIParticleSystemRenderers.Add(RendererItem);
+	}
+}
+
+void UUIParticleSystem::ReleaseRendererItem(UUIParticleSystemRendererItem* InItem)
+{
+	if (!IsValid(InItem))
+		return;
+	auto itemActor = Cast<AUIParticleSystemRendererItemActor>(InItem->GetOwner());
+	if (IsValid(itemActor))
+	{
+		if (auto Subsystem = ULGUIParticleSystemSubsystem::GetInstance(this->GetWorld()))
+		{
+			Subsystem->ReleaseRendererItemActor(itemActor);
+		}
+		else
+		{
+			itemActor->Destroy();
 		}
 	}
 }
+
 void UUIParticleSystem::ActivateParticleSystem(bool Reset)
 {
-	if (ParticleSystemInstance.IsValid())
+	if (bUsingBakedEffect)
+	{
+		if (Reset || BakedPlaybackStartTime < 0.f)
+		{
+			BeginBakedPlayback();
+		}
+	}
+	else if (ParticleSystemInstance.IsValid())
 	{
+		FinishAsyncMeshBuild();
 		ParticleSystemInstance->Activate(Reset);
 		SetRenderEntries();
 	}
@@ -93,6 +273,9 @@ void UUIParticleSystem::ActivateParticleSystem(bool Reset)
 
 void UUIParticleSystem::DeactivateParticleSystem()
 {
+	//next paint clear the mesh
+	BakedPlaybackStartTime = -1.f;
+	FinishAsyncMeshBuild();
 	if (ParticleSystemInstance.IsValid())
 		ParticleSystemInstance->Deactivate();
 }
@@ -100,20 +283,41 @@ void UUIParticleSystem::DeactivateParticleSystem()
 void UUIParticleSystem::SetReplaceMaterialMap(const TMap<UMaterialInterface*, UMaterialInterface*>& value)
 {
 	ReplaceMaterialMap = value;
-	for (int i = 0; i < UIParticleSystemRenderers.Num(); i++)
+	if (bUsingBakedEffect)
 	{
-		auto RendererItem = UIParticleSystemRenderers[i];
-		UMaterialInterface* Mat = RenderEntries[i].Material;
-		if (auto FoundMatPtr = ReplaceMaterialMap.Find(Mat))
-		{
-			Mat = *FoundMatPtr;
-		}
-		RendererItem->SetMaterial(Mat);
-		UIParticleSystemRenderers.Add(RendererItem);
+		UpdateBakedRendererItems();
+	}
+	else if (RenderEntriesValid)
+	{
+		//material decide which entries can be merged
+		UpdateRendererItems();
 	}
 }
 
-DECLARE_CYCLE_STAT(TEXT("UIParticleSystem RenderToUI"), STAT_UIParticleSystem, STATGROUP_LGUI);
+static TAutoConsoleVariable<int32> CVarLGUIParticleParallelBuild(
+	TEXT("lgui.ParticleSystem.ParallelBuild"),
+	1,
+	TEXT("Build mesh of UIParticleSystem's render entries in parallel. 0: build on game thread one by one. 1: build in parallel."));
+static TAutoConsoleVariable<float> CVarLGUIParticleAutoUpdateFrequency(
+	TEXT("lgui.ParticleSystem.AutoUpdateFrequency"),
+	10.f,
+	TEXT("Mesh rebuild per second of UIParticleSystem in Automatic update mode, when all of its particles are outside of clip rect or screen."));
+static TAutoConsoleVariable<int32> CVarLGUIParticleCompactVertex(
+	TEXT("lgui.ParticleSystem.CompactVertex"),
+	1,
+	TEXT("Only write and upload additional vertex channels (uv1, uv2...) that render canvas have and render entry bind. 0: write and upload all channels."));
+static TAutoConsoleVariable<int32> CVarLGUIParticleAsyncBuild(
+	TEXT("lgui.ParticleSystem.AsyncBuild"),
+	0,
+	TEXT("Build UIParticleSystem's mesh on task graph after world's actor tick, game thread only swap and upload on paint. 0: build on paint. 1: async, wait on paint, no latency. 2: async, upload on next frame's paint, one frame latency."));
+static TAutoConsoleVariable<int32> CVarLGUIParticleSnapshot(
+	TEXT("lgui.ParticleSystem.Snapshot"),
+	0,
+	TEXT("Copy bound sprite attributes into a lock-free ring on game thread after world's actor tick, mesh build read the copy instead of niagara data set. It is a handoff from game thread to mesh build, the copy is taken at the same point that build on paint read data set. Ribbon read data set directly, async build finish before niagara's next tick."));
+static TAutoConsoleVariable<int32> CVarLGUIParticleSkipUnchanged(
+	TEXT("lgui.ParticleSystem.SkipUnchanged"),
+	1,
+	TEXT("Skip mesh build and upload of render entry if its particle data, transform, alpha and clip are not changed since last build, eg: paused, deactivated or finished particle system. 0: always build."));
 
 void UUIParticleSystem::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
 {
@@ -122,83 +326,608 @@ void UUIParticleSystem::TickComponent(float DeltaTime, ELevelTick TickType, FAct
 void UUIParticleSystem::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
 	Super::EndPlay(EndPlayReason);
-	if (ParticleSystemInstance.IsValid())
+	FinishAsyncMeshBuild();
+	bAsyncBuildPendingUpload = false;
+	AsyncBuildStagingSections.Empty();
+	ReleaseParticleSystemInstance();
+	auto Subsystem = ULGUIParticleSystemSubsystem::GetInstance(this->GetWorld());
+	RenderEntries.Empty();
+	RenderEntriesValid = false;
+	RenderEntryRendererIndices.Empty();
+	RenderEntryMergeSections.Empty();
+	bUsingBakedEffect = false;
+	BakedPlaybackStartTime = -1.f;
+	BakedIndexCounts.Empty();
+	for (auto item : UIParticleSystemRenderers)
 	{
-		auto WorldParticleActor = ParticleSystemInstance->GetOwner();
-		if (IsValid(WorldParticleActor))
+		ReleaseRendererItem(item);
+	}
+	UIParticleSystemRenderers.Empty();
+	if (Subsystem)
+	{
+		Subsystem->UnregisterUIParticleSystem(this);
+	}
+}
+
+void UUIParticleSystem::OnPaintUpdate()
+{
+	if (bUsingBakedEffect)
+	{
+		if (bMeshUpdateScheduled)
 		{
-			WorldParticleActor->Destroy();
+			UpdateBakedPlayback();
 		}
-		ParticleSystemInstance.Reset();
+		return;
 	}
-	RenderEntries.Empty();
-	for (auto item : UIParticleSystemRenderers)
+	if (AsyncBuildTask.IsValid() || bAsyncBuildPendingUpload)
+	{
+		//one frame latency mode is finished in subsystem's pre actor tick, otherwise wait here
+		if (CVarLGUIParticleAsyncBuild.GetValueOnGameThread() != 2)
+		{
+			FinishAsyncMeshBuild();
+		}
+		if (bAsyncBuildPendingUpload)
+		{
+			bAsyncBuildPendingUpload = false;
+			UploadMeshSections();
+		}
+		return;
+	}
+	if (CVarLGUIParticleAsyncBuild.GetValueOnGameThread() != 0)
+		return;
+	//skipped frame keep previous mesh
+	if (!bMeshUpdateScheduled)
+		return;
+
+	TArray<TSharedPtr<FLGUIMeshSection>> MeshSections;
+	if (PrepareMeshBuild(MeshSections))
+	{
+		LGUIPARTICLE_SCOPE_CYCLE_COUNTER(STAT_UIParticleSystem);
+		BuildMeshSections(MeshSections);
+		PublishBuildStats();
+		UploadMeshSections();
+	}
+}
+
+float UUIParticleSystem::GetMeshUpdateInterval()const
+{
+	switch (UpdateMode)
+	{
+	default:
+	case ELGUIParticleUpdateMode::EveryFrame:
+		return 0.f;
+	case ELGUIParticleUpdateMode::FixedRate:
+		return 1.f / FMath::Max(UpdateFrequency, 1.f);
+	case ELGUIParticleUpdateMode::Automatic:
+	{
+		const auto CullStats = GetCullStats();
+		if (CullStats.Emitted == 0 && CullStats.Culled > 0)
+		{
+			return 1.f / FMath::Max(CVarLGUIParticleAutoUpdateFrequency.GetValueOnGameThread(), 1.f);
+		}
+		return 0.f;
+	}
+	}
+}
+
+void UUIParticleSystem::SetPausedByHidden(bool bHidden)
+{
+	//shared simulation is still visible in other UIParticleSystems
+	const bool bPause = bHidden && bPauseWhenHidden && !bUsingSharedSimulation;
+	if (bPause)
+	{
+		//already paused by user, leave it to user to resume
+		if (!bPausedByHidden && ParticleSystemInstance.IsValid() && !ParticleSystemInstance->IsPaused())
+		{
+			bPausedByHidden = true;
+			ParticleSystemInstance->SetPaused(true);
+		}
+	}
+	else if (bPausedByHidden)
+	{
+		//only undo the pause we made
+		bPausedByHidden = false;
+		if (ParticleSystemInstance.IsValid())
+		{
+			ParticleSystemInstance->SetPaused(false);
+		}
+	}
+}
+
+void UUIParticleSystem::SetPauseWhenHidden(bool value)
+{
+	if (bPauseWhenHidden != value)
+	{
+		bPauseWhenHidden = value;
+		if (!bPauseWhenHidden)
+		{
+			SetPausedByHidden(false);
+		}
+	}
+}
+
+void UUIParticleSystem::UpdateMeshBuildTransform()
+{
+	auto rootUIItem = this->GetRenderCanvas()->GetUIItem();
+	auto rootSpaceLocation = rootUIItem->GetComponentTransform().InverseTransformPosition(this->GetComponentLocation());
+	auto rootSpaceLocation2D = MyVector2(rootSpaceLocation.Y, rootSpaceLocation.Z);
+	auto scale3D = this->GetRelativeScale3D();
+	auto scale2D = MyVector2(scale3D.Y, scale3D.Z);
+	//shared simulation is rendered by many UIParticleSystem, so only keep the transform for mesh build
+	const FTransform RenderTransform = ULGUIWorldParticleSystemComponent::MakeTransformationForUIRendering(rootSpaceLocation2D, scale2D, this->GetRelativeRotation().Roll);
+	if (ParticleSystemInstance.IsValid() && !bUsingSharedSimulation)
 	{
-		if (IsValid(item))
+		ParticleSystemInstance->SetTransformationForUIRendering(rootSpaceLocation2D, scale2D, this->GetRelativeRotation().Roll);
+	}
+	MeshBuildTransform.Location = RenderTransform.GetLocation();
+	MeshBuildTransform.Scale = RenderTransform.GetScale3D();
+	MeshBuildTransform.Rotation = RenderTransform.Rotator();
+	MeshBuildTransform.bForceLocalSpace = bUsingSharedSimulation;
+}
+
+bool UUIParticleSystem::PrepareMeshBuild(TArray<TSharedPtr<FLGUIMeshSection>>& OutMeshSections)
+{
+	if (!ParticleSystemInstance.IsValid() || !GetIsUIActiveInHierarchy())
+		return false;
+
+	UpdateMeshBuildTransform();
+	auto rootUIItem = this->GetRenderCanvas()->GetUIItem();
+
+	//cull rect in render canvas's space: clip rect, and screen if render canvas cover the whole screen
+	auto RenderCanvas = this->GetRenderCanvas();
+	MeshBuildCullRect = FLGUIParticleCullRect();
+	if (RenderCanvas->IsRootCanvas() && RenderCanvas->IsRenderToScreenSpace())
+	{
+		MeshBuildCullRect.bEnable = true;
+		MeshBuildCullRect.Min = MyVector2(rootUIItem->GetLocalSpaceLeft(), rootUIItem->GetLocalSpaceBottom());
+		MeshBuildCullRect.Max = MyVector2(rootUIItem->GetLocalSpaceRight(), rootUIItem->GetLocalSpaceTop());
+	}
+	if (RenderCanvas->GetActualClipType() == ELGUICanvasClipType::Rect)
+	{
+		const MyVector2 ClipMin = (MyVector2)RenderCanvas->GetClipRectMin();
+		const MyVector2 ClipMax = (MyVector2)RenderCanvas->GetClipRectMax();
+		if (MeshBuildCullRect.bEnable)
+		{
+			MeshBuildCullRect.Min = MyVector2(FMath::Max(MeshBuildCullRect.Min.X, ClipMin.X), FMath::Max(MeshBuildCullRect.Min.Y, ClipMin.Y));
+			MeshBuildCullRect.Max = MyVector2(FMath::Min(MeshBuildCullRect.Max.X, ClipMax.X), FMath::Min(MeshBuildCullRect.Max.Y, ClipMax.Y));
+		}
+		else
 		{
-			auto itemActor = item->GetOwner();
-			if (IsValid(itemActor))
+			MeshBuildCullRect.bEnable = true;
+			MeshBuildCullRect.Min = ClipMin;
+			MeshBuildCullRect.Max = ClipMax;
+		}
+	}
+
+	MeshBuildChannels = CVarLGUIParticleCompactVertex.GetValueOnGameThread() != 0 ? (uint8)RenderCanvas->GetActualAdditionalShaderChannelFlags() : 0xFF;
+
+	//split before build, so the entry that would not fit is drawn by its own renderer item in this build
+	if (SplitOverflowingMergeGroups())
+	{
+		UpdateRendererItems();
+	}
+
+	//collect everything that touch UObjects on game thread, so the mesh build can run on any thread
+	OutMeshSections.SetNum(UIParticleSystemRenderers.Num());
+	for (int i = 0; i < UIParticleSystemRenderers.Num(); i++)
+	{
+		auto UIMeshSection = UIParticleSystemRenderers[i]->GetMeshSection();
+		if (UIMeshSection.IsValid())
+		{
+			OutMeshSections[i] = UIMeshSection.Pin();
+		}
+	}
+	//everything except particle data that affect the mesh, for skipping unchanged entries
+	uint32 InputHash = FCrc::MemCrc32(&MeshBuildTransform.Location, sizeof(MeshBuildTransform.Location));
+	InputHash = FCrc::MemCrc32(&MeshBuildTransform.Scale, sizeof(MeshBuildTransform.Scale), InputHash);
+	InputHash = FCrc::MemCrc32(&MeshBuildTransform.Rotation, sizeof(MeshBuildTransform.Rotation), InputHash);
+	InputHash = HashCombine(InputHash, (uint32)MeshBuildTransform.bForceLocalSpace);
+	InputHash = HashCombine(InputHash, (uint32)MeshBuildCullRect.bEnable);
+	InputHash = FCrc::MemCrc32(&MeshBuildCullRect.Min, sizeof(MeshBuildCullRect.Min), InputHash);
+	InputHash = FCrc::MemCrc32(&MeshBuildCullRect.Max, sizeof(MeshBuildCullRect.Max), InputHash);
+	InputHash = HashCombine(InputHash, (uint32)MeshBuildChannels);
+	InputHash = HashCombine(InputHash, (uint32)BudgetStride);
+	InputHash = HashCombine(InputHash, (uint32)MeshCapacity.Policy);
+	InputHash = HashCombine(InputHash, (uint32)MeshCapacity.BucketSize);
+	InputHash = HashCombine(InputHash, GetTypeHash(MeshCapacity.GrowFactor));
+	InputHash = HashCombine(InputHash, GetTypeHash(MeshCapacity.ShrinkRatio));
+
+	MeshBuildAlphas.SetNum(RenderEntries.Num());
+	MeshBuildInputHashes.SetNum(RenderEntries.Num());
+	for (int i = 0; i < RenderEntries.Num(); i++)
+	{
+		const int32 RendererIndex = RenderEntryRendererIndices[i];
+		MeshBuildAlphas[i] = bUseAlpha ? UIParticleSystemRenderers[RendererIndex]->GetFinalAlpha01() : 1.0f;
+		RenderEntries[i].LODStride = BudgetStride;
+		//renderer item's mesh section is recreated when it move to another drawcall, new section need to be filled
+		MeshBuildInputHashes[i] = HashCombine(HashCombine(InputHash, GetTypeHash(MeshBuildAlphas[i])), PointerHash(OutMeshSections[RendererIndex].Get()));
+	}
+	if (ParticleSystemInstance->IsCapturing())
+	{
+		//same inputs as BuildMeshSections, so replay build what this build see
+		ParticleSystemInstance->CaptureFrame(RenderEntries, MeshBuildTransform, 1.0f, MyVector2::ZeroVector, MeshCapacity, MeshBuildCullRect, MeshBuildChannels);
+	}
+	return true;
+}
+
+void UUIParticleSystem::BuildMeshSections(const TArray<TSharedPtr<FLGUIMeshSection>>& InMeshSections)
+{
+	//auto layoutScale = this->GetRootCanvas()->GetCanvasScale();
+	auto layoutScale = 1.0f;
+	//auto locationOffset = MyVector2(-rootUIItem->GetWidth() * 0.5f, -rootUIItem->GetHeight() * 0.5f);
+	auto locationOffset = MyVector2::ZeroVector;
+
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+	auto WorldParticleSystem = ParticleSystemInstance.Get();
+	//every entry fill its own mesh section, so they can build in parallel
+	const bool bParallelBuild = CVarLGUIParticleParallelBuild.GetValueOnAnyThread() != 0 && RenderEntries.Num() > 1;
+	const bool bSkipUnchanged = CVarLGUIParticleSkipUnchanged.GetValueOnAnyThread() != 0;
+	ParallelFor(RenderEntries.Num(), [&](int32 i)
+		{
+			auto& RendererMeshSection = InMeshSections[RenderEntryRendererIndices[i]];
+			const bool bChanged = WorldParticleSystem->UpdateBuildSignature(RenderEntries[i], MeshBuildInputHashes[i]);
+			RenderEntries[i].bMeshChanged = RendererMeshSection.IsValid() && (bChanged || !bSkipUnchanged);
+			RenderEntries[i].bIndicesChanged = false;
+			if (RenderEntries[i].bMeshChanged)
 			{
-				itemActor->Destroy();
+				auto MeshSection = RenderEntryMergeSections[i].IsValid() ? RenderEntryMergeSections[i].Get() : RendererMeshSection.Get();
+				WorldParticleSystem->RenderUI(MeshSection, RenderEntries[i], MeshBuildTransform, layoutScale, locationOffset, MeshBuildAlphas[i], MeshCapacity, MeshBuildCullRect, MeshBuildChannels);
 			}
+		}, !bParallelBuild);
+	MergeMeshSections(InMeshSections);
+	//game thread may read stats during async build, so only write the build's own copy here
+	FLGUIParticleSystemBuildStats Stats;
+	FLGUIParticleCullStats EntryCullStats;
+	Stats.BuildTimeMs = (float)FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - StartCycles);
+	for (auto& Entry : RenderEntries)
+	{
+		//skipped entries keep their mesh, so count their particles of last build too
+		Stats.Particles += Entry.EmittedParticleCount;
+		EntryCullStats.Emitted += Entry.EmittedParticleCount;
+		EntryCullStats.Culled += Entry.CulledParticleCount;
+		if (Entry.SpriteSnapshots.IsValid())
+		{
+			Stats.SnapshotsPublished += Entry.SpriteSnapshots->GetPublishedCount();
+			Stats.SnapshotsDropped += Entry.SpriteSnapshots->GetDroppedCount();
+			Stats.SnapshotsStale += Entry.SpriteSnapshots->GetStaleCount();
 		}
 	}
-	UIParticleSystemRenderers.Empty();
-	if (UpdateAgentWidget.IsValid())
+	MeshBuildStats = Stats;
+	MeshBuildCullStats = EntryCullStats;
+}
+
+void UUIParticleSystem::PublishBuildStats()
+{
+	//upload counters are filled by UploadMeshSections
+	BuildStats.Particles = MeshBuildStats.Particles;
+	BuildStats.BuildTimeMs = MeshBuildStats.BuildTimeMs;
+	BuildStats.SnapshotsPublished = MeshBuildStats.SnapshotsPublished;
+	BuildStats.SnapshotsDropped = MeshBuildStats.SnapshotsDropped;
+	BuildStats.SnapshotsStale = MeshBuildStats.SnapshotsStale;
+	CullStats = MeshBuildCullStats;
+	INC_DWORD_STAT_BY(STAT_LGUIParticle_Particles, BuildStats.Particles);
+}
+
+void UUIParticleSystem::PublishParticleSnapshots()
+{
+	if (!ParticleSystemInstance.IsValid() || !RenderEntriesValid)
+		return;
+	if (CVarLGUIParticleSnapshot.GetValueOnGameThread() == 0)
 	{
-		if (IsValid(GEngine) && IsValid(GEngine->GameViewport))
+		if (RenderEntries.ContainsByPredicate([](const FLGUINiagaraRendererEntry& Entry) { return Entry.SpriteSnapshots.IsValid(); }))
 		{
-			GEngine->GameViewport->RemoveViewportWidgetContent(UpdateAgentWidget.ToSharedRef());
+			//mesh build may hold a snapshot
+			FinishAsyncMeshBuild();
+			for (auto& Entry : RenderEntries)
+			{
+				Entry.SpriteSnapshots.Reset();
+				Entry.SpriteSnapshot = nullptr;
+			}
 		}
+		return;
+	}
+	if (!bMeshUpdateScheduled || !GetIsUIActiveInHierarchy())
+		return;
+	//producer only write slots that mesh build don't hold, so no need to wait for async build
+	for (auto& Entry : RenderEntries)
+	{
+		ParticleSystemInstance->PublishSpriteSnapshot(Entry);
 	}
 }
 
-void UUIParticleSystem::OnPaintUpdate()
+bool UUIParticleSystem::SplitOverflowingMergeGroups()
 {
-	if (ParticleSystemInstance.IsValid())
+	bool bSplit = false;
+	int64 GroupVertexCount = 0;
+	for (int i = 0; i < RenderEntries.Num(); i++)
 	{
-		if (GetIsUIActiveInHierarchy())
+		if (!RenderEntryMergeSections[i].IsValid())
+			continue;
+		//mesh build emit at most all simulated particles, and capacity never grow more than what that count need
+		const auto& Entry = RenderEntries[i];
+		const int32 VerticesPerParticle = Entry.BindingPlan.RendererType == ELGUIParticleRendererType::Ribbon ? 2 : 4;
+		const int32 CurrentCapacity = RenderEntryMergeSections[i]->vertices.Num() / VerticesPerParticle;
+		const int64 MaxVertexCount = (int64)MeshCapacity.GetParticleCapacity(Entry.EmitterInstance->GetNumParticles(), CurrentCapacity, Entry.MaxParticleCount) * VerticesPerParticle;
+		const bool bGroupStart = i == 0 || RenderEntryRendererIndices[i - 1] != RenderEntryRendererIndices[i];
+		if (bGroupStart)
+		{
+			GroupVertexCount = 0;
+		}
+		else if (GroupVertexCount + MaxVertexCount > (int64)TNumericLimits<FLGUIIndexType>::Max() + 1)
 		{
-			SCOPE_CYCLE_COUNTER(STAT_UIParticleSystem);
+			//this entry start a new group after UpdateRendererItems
+			RenderEntryMergeSplits[i] = true;
+			bSplit = true;
+			GroupVertexCount = 0;
+		}
+		GroupVertexCount += MaxVertexCount;
+	}
+	return bSplit;
+}
 
-			//auto layoutScale = this->GetRootCanvas()->GetCanvasScale();
-			auto layoutScale = 1.0f;
-			//auto locationOffset = MyVector2(-rootUIItem->GetWidth() * 0.5f, -rootUIItem->GetHeight() * 0.5f);
-			auto locationOffset = MyVector2::ZeroVector;
+void UUIParticleSystem::MergeMeshSections(const TArray<TSharedPtr<FLGUIMeshSection>>& InMeshSections)
+{
+	MeshBuildIndicesChanged.SetNumZeroed(InMeshSections.Num());
+	MeshBuildVerticesChanged.SetNumZeroed(InMeshSections.Num());
+	for (int EntryIndex = 0; EntryIndex < RenderEntries.Num(); )
+	{
+		const int32 RendererIndex = RenderEntryRendererIndices[EntryIndex];
+		bool bGroupChanged = RenderEntries[EntryIndex].bMeshChanged;
+		int32 GroupEnd = EntryIndex + 1;
+		while (GroupEnd < RenderEntries.Num() && RenderEntryRendererIndices[GroupEnd] == RendererIndex)
+		{
+			bGroupChanged |= RenderEntries[GroupEnd].bMeshChanged;
+			GroupEnd++;
+		}
+		MeshBuildVerticesChanged[RendererIndex] = bGroupChanged;
+		auto& TargetSection = InMeshSections[RendererIndex];
+		if (!RenderEntryMergeSections[EntryIndex].IsValid())
+		{
+			MeshBuildIndicesChanged[RendererIndex] = RenderEntries[EntryIndex].bIndicesChanged;
+		}
+		else if (TargetSection.IsValid() && bGroupChanged)
+		{
+			//unchanged entries keep their last result in merge sections
+			//every entry's capacity only change when it is reallocated, so merged size is stable too
+			//SplitOverflowingMergeGroups already split groups that may not fit, this only keep index from wrapping if the estimate is wrong
+			int32 VertexCount = 0, IndexCount = 0;
+			int32 MergeEnd = EntryIndex;
+			for (; MergeEnd < GroupEnd; MergeEnd++)
+			{
+				const int32 EntryVertexCount = RenderEntryMergeSections[MergeEnd]->vertices.Num();
+				if (MergeEnd > EntryIndex && (int64)VertexCount + EntryVertexCount > (int64)TNumericLimits<FLGUIIndexType>::Max() + 1)
+				{
+					MeshBuildMergeOverflowEntry = MergeEnd;
+					break;
+				}
+				VertexCount += EntryVertexCount;
+				IndexCount += RenderEntryMergeSections[MergeEnd]->triangles.Num();
+			}
+			TargetSection->vertices.SetNumUninitialized(VertexCount, false);
+			TargetSection->triangles.SetNumUninitialized(IndexCount, false);
+			int32 VertexOffset = 0, IndexOffset = 0;
+			for (int i = EntryIndex; i < MergeEnd; i++)
+			{
+				const auto& EntrySection = *RenderEntryMergeSections[i];
+				FMemory::Memcpy(TargetSection->vertices.GetData() + VertexOffset, EntrySection.vertices.GetData(), EntrySection.vertices.Num() * sizeof(FDynamicMeshVertex));
+				FLGUIIndexType* DestIndices = TargetSection->triangles.GetData() + IndexOffset;
+				for (int32 Index = 0; Index < EntrySection.triangles.Num(); Index++)
+				{
+					//unused indices are zero, which become degenerated triangles at VertexOffset
+					DestIndices[Index] = EntrySection.triangles[Index] + VertexOffset;
+				}
+				VertexOffset += EntrySection.vertices.Num();
+				IndexOffset += EntrySection.triangles.Num();
+			}
+			MeshBuildIndicesChanged[RendererIndex] = true;
+		}
+		EntryIndex = GroupEnd;
+	}
+}
+
+int32 UUIParticleSystem::GetUploadedVertexSize(uint8 AdditionalChannels)
+{
+	int32 Size = sizeof(float) * 3 + sizeof(FColor) + sizeof(float) * 2;
+	if (AdditionalChannels & ((uint8)ELGUICanvasAdditionalChannelType::Normal | (uint8)ELGUICanvasAdditionalChannelType::Tangent))
+	{
+		Size += sizeof(FPackedNormal) * 2;
+	}
+	for (const auto Channel : { ELGUICanvasAdditionalChannelType::UV1, ELGUICanvasAdditionalChannelType::UV2, ELGUICanvasAdditionalChannelType::UV3 })
+	{
+		if (AdditionalChannels & (uint8)Channel)
+		{
+			Size += sizeof(float) * 2;
+		}
+	}
+	return Size;
+}
 
-			//update transform
-			auto rootUIItem = this->GetRenderCanvas()->GetUIItem();
-			auto rootSpaceLocation = rootUIItem->GetComponentTransform().InverseTransformPosition(this->GetComponentLocation());
-			auto rootSpaceLocation2D = MyVector2(rootSpaceLocation.Y, rootSpaceLocation.Z);
-			auto scale3D = this->GetRelativeScale3D();
-			auto scale2D = MyVector2(scale3D.Y, scale3D.Z);
-			ParticleSystemInstance->SetTransformationForUIRendering(rootSpaceLocation2D, scale2D, this->GetRelativeRotation().Roll);
-			const int ParticleCountIncreaseAndDecrease = 50;//only recreate RenderResource when particle count increase or decrease N count, good for performance
-			for (int i = 0; i < RenderEntries.Num(); i++)
+void UUIParticleSystem::UploadMeshSections()
+{
+	const int32 UploadedVertexSize = GetUploadedVertexSize(MeshBuildChannels);
+	BuildStats.Vertices = 0;
+	BuildStats.BytesUploaded = 0;
+	BuildStats.Reallocations = 0;
+	for (int i = 0; i < UIParticleSystemRenderers.Num(); i++)
+	{
+		auto UIMeshSection = UIParticleSystemRenderers[i]->GetMeshSection();
+		if (UIMeshSection.IsValid())
+		{
+			auto MeshSectionPtr = UIMeshSection.Pin();
+			auto UIMesh = UIParticleSystemRenderers[i]->GetUIMesh();
+			const int32 UploadBytes = MeshSectionPtr->vertices.Num() * UploadedVertexSize + MeshSectionPtr->triangles.Num() * sizeof(FLGUIIndexType);
+			BuildStats.Vertices += MeshSectionPtr->vertices.Num();
+			if (MeshSectionPtr->prevVertexCount == MeshSectionPtr->vertices.Num() && MeshSectionPtr->prevIndexCount == MeshSectionPtr->triangles.Num())
+			{
+				//render resource already have the data
+				const bool bChanged = !MeshBuildVerticesChanged.IsValidIndex(i) || MeshBuildVerticesChanged[i];
+				if (bChanged && MeshSectionPtr->prevVertexCount > 0 && MeshSectionPtr->prevIndexCount > 0)
+				{
+					LGUIPARTICLE_SCOPE_CYCLE_COUNTER(STAT_LGUIParticle_MeshUpdate);
+					UIMesh->UpdateMeshSectionData(MeshSectionPtr, true, MeshBuildChannels);
+					MeshCapacityStats.Updates++;
+					BuildStats.BytesUploaded += UploadBytes;
+				}
+			}
+			else
 			{
-				auto UIMeshSection = UIParticleSystemRenderers[i]->GetMeshSection();
-				auto UIMesh = UIParticleSystemRenderers[i]->GetUIMesh();
-				if (UIMeshSection.IsValid())
+				LGUIPARTICLE_SCOPE_CYCLE_COUNTER(STAT_LGUIParticle_MeshCreate);
+				MeshCapacityStats.Reallocations++;
+				BuildStats.Reallocations++;
+				BuildStats.BytesUploaded += UploadBytes;
+				if (MeshSectionPtr->vertices.Num() > MeshSectionPtr->prevVertexCount)
 				{
-					auto MeshSectionPtr = UIMeshSection.Pin();
-					ParticleSystemInstance->RenderUI(MeshSectionPtr.Get(), RenderEntries[i], layoutScale, locationOffset, bUseAlpha ? UIParticleSystemRenderers[i]->GetFinalAlpha01() : 1.0f, ParticleCountIncreaseAndDecrease);
-					if (MeshSectionPtr->prevVertexCount == MeshSectionPtr->vertices.Num() && MeshSectionPtr->prevIndexCount == MeshSectionPtr->triangles.Num())
-					{
-						if (MeshSectionPtr->prevVertexCount > 0 && MeshSectionPtr->prevIndexCount > 0)
-						{
-							UIMesh->UpdateMeshSectionData(MeshSectionPtr, true, 1);
-						}
-					}
-					else
-					{
-						MeshSectionPtr->prevVertexCount = MeshSectionPtr->vertices.Num();
-						MeshSectionPtr->prevIndexCount = MeshSectionPtr->triangles.Num();
-						UIMesh->CreateMeshSectionData(MeshSectionPtr);
-					}
+					MeshCapacityStats.Grows++;
 				}
+				else
+				{
+					MeshCapacityStats.Shrinks++;
+				}
+				MeshSectionPtr->prevVertexCount = MeshSectionPtr->vertices.Num();
+				MeshSectionPtr->prevIndexCount = MeshSectionPtr->triangles.Num();
+				UIMesh->CreateMeshSectionData(MeshSectionPtr);
 			}
 		}
 	}
+	INC_DWORD_STAT_BY(STAT_LGUIParticle_Vertices, BuildStats.Vertices);
+	INC_DWORD_STAT_BY(STAT_LGUIParticle_BytesUploaded, BuildStats.BytesUploaded);
+	INC_DWORD_STAT_BY(STAT_LGUIParticle_Reallocations, BuildStats.Reallocations);
+	//build is finished here, so renderer items can change
+	if (MeshBuildMergeOverflowEntry != INDEX_NONE)
+	{
+		if (RenderEntryMergeSplits.IsValidIndex(MeshBuildMergeOverflowEntry))
+		{
+			RenderEntryMergeSplits[MeshBuildMergeOverflowEntry] = true;
+		}
+		MeshBuildMergeOverflowEntry = INDEX_NONE;
+		UpdateRendererItems();
+	}
+}
+
+void UUIParticleSystem::BeginAsyncMeshBuild()
+{
+	if (AsyncBuildTask.IsValid())
+		return;
+	if (CVarLGUIParticleAsyncBuild.GetValueOnGameThread() == 0)
+		return;
+	if (!bMeshUpdateScheduled)
+		return;
+	if (!PrepareMeshBuild(AsyncBuildTargetSections))
+		return;
+
+	//build into staging sections, mesh sections stay untouched until FinishAsyncMeshBuild
+	AsyncBuildStagingSections.SetNum(AsyncBuildTargetSections.Num());
+	for (int i = 0; i < AsyncBuildTargetSections.Num(); i++)
+	{
+		if (AsyncBuildTargetSections[i].IsValid() && !AsyncBuildStagingSections[i].IsValid())
+		{
+			AsyncBuildStagingSections[i] = MakeShared<FLGUIMeshSection>();
+		}
+	}
+	AsyncBuildTask = FFunctionGraphTask::CreateAndDispatchWhenReady([this]()
+		{
+			LGUIPARTICLE_SCOPE_CYCLE_COUNTER(STAT_UIParticleSystem);
+			BuildMeshSections(AsyncBuildStagingSections);
+		}, TStatId(), nullptr, ENamedThreads::AnyHiPriThreadHiPriTask);
+}
+
+void UUIParticleSystem::FinishAsyncMeshBuild()
+{
+	if (!AsyncBuildTask.IsValid())
+		return;
+
+	FTaskGraphInterface::Get().WaitUntilTaskCompletes(AsyncBuildTask);
+	AsyncBuildTask.SafeRelease();
+	//swap built vertices into mesh sections, old data stay in staging sections and will be overwritten by next build
+	for (int i = 0; i < AsyncBuildTargetSections.Num(); i++)
+	{
+		auto& MeshSection = AsyncBuildTargetSections[i];
+		auto& StagingSection = AsyncBuildStagingSections[i];
+		//skipped sections are not built, staging section still hold older data
+		if (MeshSection.IsValid() && StagingSection.IsValid() && MeshBuildVerticesChanged[i])
+		{
+			Swap(MeshSection->vertices, StagingSection->vertices);
+			//staging section keep its indices, so sprite quad indices only need to be written when particle count change
+			if (MeshBuildIndicesChanged[i] || MeshSection->triangles.Num() != StagingSection->triangles.Num())
+			{
+				MeshSection->triangles = StagingSection->triangles;
+			}
+		}
+	}
+	AsyncBuildTargetSections.Reset();
+	PublishBuildStats();
+	bAsyncBuildPendingUpload = true;
+}
+
+void UUIParticleSystem::UpdateBakedRendererItems()
+{
+	const auto& BakedEntries = BakedEffect->Entries;
+	SetRendererItemCount(BakedEntries.Num());
+	for (int i = 0; i < BakedEntries.Num(); i++)
+	{
+		UMaterialInterface* Mat = BakedEntries[i].Material;
+		if (auto FoundMatPtr = ReplaceMaterialMap.Find(Mat))
+		{
+			Mat = *FoundMatPtr;
+		}
+		UIParticleSystemRenderers[i]->SetMaterial(Mat);
+	}
+	//renderer item's mesh section may be recreated, write it again
+	BakedIndexCounts.SetNumZeroed(BakedEntries.Num());
+	BakedPlaybackFrame = INDEX_NONE;
+	BakedPlaybackInputHash = 0;
+	MeshBuildVerticesChanged.Init(true, BakedEntries.Num());
+}
+
+void UUIParticleSystem::BeginBakedPlayback()
+{
+	BakedPlaybackStartTime = this->GetWorld()->GetTimeSeconds();
+}
+
+void UUIParticleSystem::UpdateBakedPlayback()
+{
+	if (!GetIsUIActiveInHierarchy())
+		return;
+
+	LGUIPARTICLE_SCOPE_CYCLE_COUNTER(STAT_LGUIParticle_BakedPlayback);
+	int32 FrameIndex = INDEX_NONE;
+	if (BakedPlaybackStartTime >= 0.f)
+	{
+		FrameIndex = BakedEffect->GetFrameIndex(this->GetWorld()->GetTimeSeconds() - BakedPlaybackStartTime);
+		if (FrameIndex == INDEX_NONE)
+		{
+			//one shot effect finished
+			BakedPlaybackStartTime = -1.f;
+		}
+	}
+	UpdateMeshBuildTransform();
+	MeshBuildChannels = CVarLGUIParticleCompactVertex.GetValueOnGameThread() != 0 ? (uint8)this->GetRenderCanvas()->GetActualAdditionalShaderChannelFlags() : 0xFF;
+	uint32 InputHash = FCrc::MemCrc32(&MeshBuildTransform.Location, sizeof(MeshBuildTransform.Location));
+	InputHash = FCrc::MemCrc32(&MeshBuildTransform.Scale, sizeof(MeshBuildTransform.Scale), InputHash);
+	InputHash = FCrc::MemCrc32(&MeshBuildTransform.Rotation, sizeof(MeshBuildTransform.Rotation), InputHash);
+	InputHash = HashCombine(InputHash, (uint32)MeshBuildChannels);
+	for (auto RendererItem : UIParticleSystemRenderers)
+	{
+		InputHash = HashCombine(InputHash, GetTypeHash(bUseAlpha ? RendererItem->GetFinalAlpha01() : 1.0f));
+		InputHash = HashCombine(InputHash, PointerHash(RendererItem->GetMeshSection().Pin().Get()));
+	}
+	//paused, hold on one frame of a slow effect, or stopped
+	if (FrameIndex == BakedPlaybackFrame && InputHash == BakedPlaybackInputHash && CVarLGUIParticleSkipUnchanged.GetValueOnGameThread() != 0)
+		return;
+	BakedPlaybackFrame = FrameIndex;
+	BakedPlaybackInputHash = InputHash;
+
+	const auto& BakedEntries = BakedEffect->Entries;
+	for (int i = 0; i < UIParticleSystemRenderers.Num() && i < BakedEntries.Num(); i++)
+	{
+		auto UIMeshSection = UIParticleSystemRenderers[i]->GetMeshSection();
+		if (UIMeshSection.IsValid())
+		{
+			const float Alpha = bUseAlpha ? UIParticleSystemRenderers[i]->GetFinalAlpha01() : 1.0f;
+			BakedEntries[i].WriteMeshSection(FrameIndex, UIMeshSection.Pin().Get(), MeshBuildTransform, Alpha, MeshBuildChannels, BakedIndexCounts[i]);
+		}
+	}
+	UploadMeshSections();
 }
 
 #if WITH_EDITOR
@@ -214,16 +943,54 @@ void UUIParticleSystem::SetUseAlpha(bool value)
 		bUseAlpha = value;
 	}
 }
+void UUIParticleSystem::SetMeshCapacity(const FLGUIParticleMeshCapacitySettings& value)
+{
+	//async build read it on task graph
+	FinishAsyncMeshBuild();
+	MeshCapacity = value;
+}
+FLGUIParticleCullStats UUIParticleSystem::GetCullStats()const
+{
+	return CullStats;
+}
+void UUIParticleSystem::ResetMeshCapacityStats()
+{
+	MeshCapacityStats = FLGUIParticleMeshCapacityStats();
+}
 void UUIParticleSystem::SetParticleSystemTemplate(UNiagaraSystem* value)
 {
 	if (ParticleSystem != value)
 	{
 		ParticleSystem = value;
-		if (ParticleSystemInstance.IsValid())
+		FinishAsyncMeshBuild();
+		const bool bHadRenderEntries = RenderEntriesValid;
+		if (bUsingSharedSimulation)
+		{
+			//other UIParticleSystems still use the old one
+			ReleaseParticleSystemInstance();
+			if (IsValid(ParticleSystem))
+			{
+				AcquireParticleSystemInstance();
+			}
+		}
+		else if (ParticleSystemInstance.IsValid())
 		{
 			ParticleSystemInstance->SetAsset(ParticleSystem);
 			ParticleSystemInstance->ResetSystem();
 		}
+		//entries point to old system's emitters, and renderer items are made for them. built mesh that is not uploaded yet is old system's too
+		bAsyncBuildPendingUpload = false;
+		RenderEntries.Empty();
+		RenderEntriesValid = false;
+		if (bHadRenderEntries && ParticleSystemInstance.IsValid())
+		{
+			SetRenderEntries();
+		}
+		else
+		{
+			//not activated yet, ActivateParticleSystem will get entries
+			UpdateRendererItems();
+		}
 	}
 }
 
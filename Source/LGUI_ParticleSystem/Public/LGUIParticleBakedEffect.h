@@ -0,0 +1,102 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Object.h"
+#include "LGUIParticleRenderTransform.h"
+#include "LGUIParticleBakedEffect.generated.h"
+
+class UNiagaraSystem;
+class UMaterialInterface;
+struct FLGUIMeshSection;
+
+/** Mesh of one render entry in one frame, quantized. */
+USTRUCT()
+struct LGUI_PARTICLESYSTEM_API FLGUIParticleBakedFrame
+{
+	GENERATED_BODY()
+
+	/** Vertex position X and Y, in units of entry's PositionStep */
+	UPROPERTY()
+		TArray<int16> Positions;
+	/** UV0 X and Y as half float */
+	UPROPERTY()
+		TArray<uint16> TextureCoordinates;
+	UPROPERTY()
+		TArray<FColor> Colors;
+	/** Dynamic material parameter in uv1 and uv2 as half float, empty if all zero in this frame */
+	UPROPERTY()
+		TArray<uint16> MaterialData;
+	/** Ribbon only, sprite quad indices are generated from vertex count */
+	UPROPERTY()
+		TArray<uint16> Indices;
+
+	int32 GetVertexCount()const { return Colors.Num(); }
+};
+
+/** Baked frames of one niagara renderer. */
+USTRUCT()
+struct LGUI_PARTICLESYSTEM_API FLGUIParticleBakedEntry
+{
+	GENERATED_BODY()
+
+	UPROPERTY(VisibleAnywhere, Category = "LGUI")
+		UMaterialInterface* Material = nullptr;
+	/** Sprite or ribbon */
+	UPROPERTY(VisibleAnywhere, Category = "LGUI")
+		bool bSprite = true;
+	/** UI units of one position step, decided by the farthest vertex in all frames */
+	UPROPERTY()
+		float PositionStep = 1.f;
+	/** Largest vertex and index count in all frames, playback allocate mesh once with this size */
+	UPROPERTY(VisibleAnywhere, Category = "LGUI")
+		int32 MaxVertexCount = 0;
+	UPROPERTY(VisibleAnywhere, Category = "LGUI")
+		int32 MaxIndexCount = 0;
+	UPROPERTY()
+		TArray<FLGUIParticleBakedFrame> Frames;
+
+	/**
+	 * Decode a frame into mesh section, vertices are transformed by RenderTransform the same way as local space emitter.
+	 * InOutIndexCount: used index count of mesh section, indices are only written when it change. Return true if indices are written.
+	 */
+	bool WriteMeshSection(int32 FrameIndex, FLGUIMeshSection* MeshSection, const FLGUIParticleRenderTransform& RenderTransform, float Alpha01, uint8 AdditionalChannels, int32& InOutIndexCount)const;
+};
+
+/**
+ * UI mesh of a niagara system baked frame by frame. UIParticleSystem play it without niagara component, so nothing is simulated at runtime.
+ * Good for effects that always look the same, eg. button highlight or reward sparkle. Use "Bake" button in editor after changing SourceSystem.
+ * Only CPU sprite and ribbon emitters are baked, same as runtime rendering.
+ */
+UCLASS(BlueprintType)
+class LGUI_PARTICLESYSTEM_API ULGUIParticleBakedEffect : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(EditAnywhere, Category = "LGUI")
+		UNiagaraSystem* SourceSystem = nullptr;
+	/** Baked frames per second, playback don't interpolate between frames */
+	UPROPERTY(EditAnywhere, Category = "LGUI", meta = (ClampMin = "1.0"))
+		float FrameRate = 30.f;
+	UPROPERTY(EditAnywhere, Category = "LGUI", meta = (ClampMin = "1"))
+		int32 FrameCount = 60;
+	/** Frames simulated before the first baked frame, eg: warm up a looping effect so the loop don't start empty */
+	UPROPERTY(EditAnywhere, Category = "LGUI", meta = (ClampMin = "0"))
+		int32 WarmupFrames = 0;
+	/** Play from first frame after last frame, otherwise stop and clear mesh */
+	UPROPERTY(EditAnywhere, Category = "LGUI")
+		bool bLoop = true;
+	UPROPERTY(VisibleAnywhere, Category = "LGUI")
+		TArray<FLGUIParticleBakedEntry> Entries;
+
+	/** Frame to show at Time since playback begin, INDEX_NONE if not looping and last frame is passed */
+	int32 GetFrameIndex(float Time)const;
+	int32 GetBakedFrameCount()const { return Entries.Num() > 0 ? Entries[0].Frames.Num() : 0; }
+#if WITH_EDITOR
+	/** Simulate SourceSystem in editor world and store its mesh of every frame */
+	UFUNCTION(CallInEditor, Category = "LGUI")
+		void Bake();
+#endif
+};
@@ -0,0 +1,33 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LGUIParticleCulling.generated.h"
+
+/** Rect in render canvas's UI space, sprite particles outside it are not emitted. */
+struct FLGUIParticleCullRect
+{
+#if ENGINE_MAJOR_VERSION >= 5
+	typedef FVector2f FRectVector;
+#else
+	typedef FVector2D FRectVector;
+#endif
+	bool bEnable = false;
+	FRectVector Min = FRectVector(0.f, 0.f);
+	FRectVector Max = FRectVector(0.f, 0.f);
+};
+
+/** Particle count of last mesh build. */
+USTRUCT(BlueprintType)
+struct LGUI_PARTICLESYSTEM_API FLGUIParticleCullStats
+{
+	GENERATED_BODY()
+
+	/** Particles that have geometry in mesh */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 Emitted = 0;
+	/** Particles skipped because outside of clip rect or screen */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 Culled = 0;
+};
@@ -0,0 +1,62 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LGUIParticleMeshCapacity.generated.h"
+
+/** How UIParticleSystem's mesh capacity follow particle count. Mesh render resource is only recreated when capacity change. */
+UENUM(BlueprintType)
+enum class ELGUIParticleMeshCapacityPolicy : uint8
+{
+	/** Round particle count up to multiple of BucketSize, grow and shrink immediately. */
+	FixedBucket,
+	/** Multiply capacity by GrowFactor when not enough, shrink only when particle count drop below ShrinkRatio of capacity. Good for bursty effects. */
+	Geometric,
+	/** Allocate emitter's max particle count up front, grow by BucketSize if still not enough, never shrink. */
+	PreallocateMaxParticles,
+};
+
+USTRUCT(BlueprintType)
+struct LGUI_PARTICLESYSTEM_API FLGUIParticleMeshCapacitySettings
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LGUI")
+		ELGUIParticleMeshCapacityPolicy Policy = ELGUIParticleMeshCapacityPolicy::FixedBucket;
+	/** Capacity is always multiple of this particle count. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LGUI", meta = (ClampMin = "1"))
+		int32 BucketSize = 50;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LGUI", meta = (ClampMin = "1.0", EditCondition = "Policy==ELGUIParticleMeshCapacityPolicy::Geometric"))
+		float GrowFactor = 1.5f;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LGUI", meta = (ClampMin = "0.0", ClampMax = "1.0", EditCondition = "Policy==ELGUIParticleMeshCapacityPolicy::Geometric"))
+		float ShrinkRatio = 0.25f;
+
+	/**
+	 * Particle count that mesh should allocate for.
+	 * @param ParticleCount Particle count need to render
+	 * @param CurrentCapacity Particle capacity of current mesh
+	 * @param MaxParticleCount Emitter's max particle count estimate, 0 if unknown
+	 */
+	int32 GetParticleCapacity(int32 ParticleCount, int32 CurrentCapacity, int32 MaxParticleCount)const;
+};
+
+/** Counters of mesh capacity change, use them to tune FLGUIParticleMeshCapacitySettings. */
+USTRUCT(BlueprintType)
+struct LGUI_PARTICLESYSTEM_API FLGUIParticleMeshCapacityStats
+{
+	GENERATED_BODY()
+
+	/** Mesh render resource recreated because capacity changed */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 Reallocations = 0;
+	/** Reallocations that increase capacity */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 Grows = 0;
+	/** Reallocations that decrease capacity */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 Shrinks = 0;
+	/** Mesh data updated without recreate render resource */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 Updates = 0;
+};
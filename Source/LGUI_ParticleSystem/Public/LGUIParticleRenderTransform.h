@@ -0,0 +1,15 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** Where mesh builder put particles, in UI space. */
+struct FLGUIParticleRenderTransform
+{
+	FVector Location = FVector::ZeroVector;
+	FVector Scale = FVector::OneVector;
+	FRotator Rotation = FRotator::ZeroRotator;
+	/** Treat world space emitters as local space, so a shared simulation can be stamped at every instance's transform */
+	bool bForceLocalSpace = false;
+};
@@ -0,0 +1,143 @@
+// Copyright 2021-present LexLiu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "LGUIParticleSystemSubsystem.generated.h"
+
+class UUIParticleSystem;
+class SLGUIParticleSystemUpdateAgentWidget;
+class UNiagaraSystem;
+class ULGUIWorldParticleSystemComponent;
+class ALGUIWorldParticleSystemActor;
+class AUIParticleSystemRendererItemActor;
+
+/** Counters of the last update pass. */
+USTRUCT(BlueprintType)
+struct LGUI_PARTICLESYSTEM_API FLGUIParticleSystemUpdateStats
+{
+	GENERATED_BODY()
+
+	/** UIParticleSystem count registered to this world */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 Registered = 0;
+	/** UIParticleSystem count that build mesh in last pass */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 Updated = 0;
+	/** UIParticleSystem count skipped in last pass, because of not active in hierarchy or have no particle system instance */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 Skipped = 0;
+	/** Render canvas count of the updated UIParticleSystems in last pass */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 Canvases = 0;
+	/** Particles that have geometry in mesh of the updated UIParticleSystems */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 ParticlesEmitted = 0;
+	/** Particles culled by clip rect or screen of the updated UIParticleSystems */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 ParticlesCulled = 0;
+	/** UIParticleSystem count that is decimated because total particle count is over lgui.ParticleSystem.ParticleBudget */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 OverBudget = 0;
+	/** UIParticleSystem count that keep previous mesh in last pass, because of update mode */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 RateLimited = 0;
+};
+
+/** Deactivated world particle actors of the same niagara system. */
+USTRUCT()
+struct FLGUIWorldParticleSystemActorPool
+{
+	GENERATED_BODY()
+
+	UPROPERTY(Transient)
+		TArray<ALGUIWorldParticleSystemActor*> Actors;
+};
+
+/** One simulation rendered by all UIParticleSystems of the same niagara system that have bShareSimulation. */
+USTRUCT()
+struct FLGUISharedParticleSimulation
+{
+	GENERATED_BODY()
+
+	UPROPERTY(Transient)
+		ULGUIWorldParticleSystemComponent* Component = nullptr;
+	int32 RefCount = 0;
+};
+
+/**
+ * Update all UIParticleSystem of a world in one batched pass per frame.
+ * Only one slate agent widget is added to game viewport for the whole world, UIParticleSystem register in BeginPlay and unregister in EndPlay.
+ */
+UCLASS()
+class LGUI_PARTICLESYSTEM_API ULGUIParticleSystemSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection)override;
+	virtual void Deinitialize()override;
+
+	static ULGUIParticleSystemSubsystem* GetInstance(UWorld* World);
+
+	void RegisterUIParticleSystem(UUIParticleSystem* InItem);
+	void UnregisterUIParticleSystem(UUIParticleSystem* InItem);
+	const TArray<TWeakObjectPtr<UUIParticleSystem>>& GetUIParticleSystems()const { return UIParticleSystems; }
+
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		const FLGUIParticleSystemUpdateStats& GetUpdateStats()const { return UpdateStats; }
+
+	/** Get a world particle system of the niagara system from pool and reset it, or spawn a new one if pool is empty. */
+	ULGUIWorldParticleSystemComponent* AcquireWorldParticleSystem(UNiagaraSystem* InSystem, bool AutoActivate);
+	/** Deactivate and put back to pool, or destroy it if pool is full. lgui.ParticleSystem.PoolSize */
+	void ReleaseWorldParticleSystem(ULGUIWorldParticleSystemComponent* InComponent);
+	AUIParticleSystemRendererItemActor* AcquireRendererItemActor();
+	/** Detach and put back to pool, or destroy it if pool is full. lgui.ParticleSystem.RendererItemPoolSize */
+	void ReleaseRendererItemActor(AUIParticleSystemRendererItemActor* InActor);
+	/** Get the simulation shared by all UIParticleSystems of the niagara system, create it if not exist. */
+	ULGUIWorldParticleSystemComponent* AcquireSharedSimulation(UNiagaraSystem* InSystem, bool AutoActivate);
+	/** Release the simulation when no UIParticleSystem use it. */
+	void ReleaseSharedSimulation(ULGUIWorldParticleSystemComponent* InComponent);
+	/** Spawn world particle systems and their renderer items into pool until it have Count of the niagara system, so they are ready before a UIParticleSystem need it. Count is not limited by pool size. */
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		void PrewarmPool(UNiagaraSystem* InSystem, int32 Count);
+	/** Destroy all pooled actors. */
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		void EmptyPool();
+private:
+	ULGUIWorldParticleSystemComponent* SpawnWorldParticleSystem(UNiagaraSystem* InSystem, bool AutoActivate);
+	bool CanPool()const;
+	void OnPaintUpdate();
+	/** Async mesh build begin after world's actor tick, and finish before next actor tick. lgui.ParticleSystem.AsyncBuild */
+	void OnWorldPreActorTick(UWorld* InWorld, ELevelTick InTickType, float InDeltaSeconds);
+	void OnWorldPostActorTick(UWorld* InWorld, ELevelTick InTickType, float InDeltaSeconds);
+	void FinishAsyncMeshBuild();
+	/** Split particle budget to visible UIParticleSystems by priority, according to particle count of last frame. Called before mesh build begin, so sync and async build see the same stride */
+	void ApplyParticleBudget();
+	/** Decide which UIParticleSystem rebuild mesh in this frame, according to update mode. Rate limited ones are round-robin */
+	void ScheduleMeshUpdates();
+	void AddAgentWidget();
+	void RemoveAgentWidget();
+
+	TArray<TWeakObjectPtr<UUIParticleSystem>> UIParticleSystems;
+	/** Active items of current pass, sorted by render canvas. Keep as member to avoid allocation every frame */
+	TArray<UUIParticleSystem*> UpdateList;
+	/** Visible items sorted by budget priority */
+	TArray<UUIParticleSystem*> BudgetList;
+	/** Items decimated by last ApplyParticleBudget, for UpdateStats */
+	int32 OverBudgetCount = 0;
+	/** Rate limited items that is due in current frame */
+	TArray<UUIParticleSystem*> RateLimitedList;
+	TSharedPtr<SLGUIParticleSystemUpdateAgentWidget> UpdateAgentWidget = nullptr;
+	FDelegateHandle PreActorTickDelegateHandle;
+	FDelegateHandle PostActorTickDelegateHandle;
+	FDelegateHandle PreGarbageCollectDelegateHandle;
+	FLGUIParticleSystemUpdateStats UpdateStats;
+	UPROPERTY(Transient)
+		TMap<UNiagaraSystem*, FLGUIWorldParticleSystemActorPool> WorldParticleSystemPool;
+	UPROPERTY(Transient)
+		TArray<AUIParticleSystemRendererItemActor*> RendererItemActorPool;
+	UPROPERTY(Transient)
+		TMap<UNiagaraSystem*, FLGUISharedParticleSimulation> SharedSimulations;
+};
@@ -4,6 +4,9 @@
 
 #include "CoreMinimal.h"
 #include "NiagaraComponent.h"
+#include "LGUIParticleMeshCapacity.h"
+#include "LGUIParticleCulling.h"
+#include "LGUIParticleRenderTransform.h"
 #include "LGUIWorldParticleSystemComponent.generated.h"
 
 #if ENGINE_MAJOR_VERSION >= 5
@@ -20,6 +23,90 @@ struct FLGUIMeshSection;
 class FNiagaraEmitterInstance;
 class UNiagaraSpriteRendererProperties;
 class UNiagaraRibbonRendererProperties;
+struct FLGUISpriteSnapshotRing;
+struct FLGUISpriteParticleSnapshot;
+class FLGUIParticleCaptureWriter;
+struct FLGUISpriteParticleStreams;
+struct FLGUISpriteBuildParams;
+struct FLGUIRibbonParticleStreams;
+struct FLGUIRibbonBuildParams;
+
+/** Reusable memory for sorting ribbon particles, so ribbon mesh build don't allocate every frame. */
+struct FLGUIRibbonSortScratch
+{
+	/** Per particle, sortable bits of ribbon sort key */
+	TArray<uint32> SortKeys;
+	/** Per particle, sortable bits of ribbon ID */
+	TArray<uint64> RibbonKeys;
+	/** Particle indices sorted by (RibbonKeys, SortKeys) */
+	TArray<int32> SortedIndices;
+	TArray<int32> TempIndices;
+	/** Start of each ribbon in SortedIndices, last element is particle count */
+	TArray<int32> RibbonOffsets;
+};
+
+/** Sprite mesh build state kept between builds of a render entry, so quad indices are only written for changed particle count. */
+struct FLGUISpriteMeshBuildState
+{
+	/** Particle count that have quad indices written in mesh section, indices after that are zero. */
+	int32 QuadCount = 0;
+	/** Mesh section that QuadCount is relate to. */
+	const FLGUIMeshSection* QuadSection = nullptr;
+	/** Compacted streams of particles that survive culling */
+	TArray<float> CullStreams;
+};
+
+/** Inputs of a render entry's mesh build, mesh is not rebuilt if they are same as last build. */
+struct FLGUIParticleBuildSignature
+{
+	/** Niagara swap data buffers when simulate, so same buffer and system age means particles not changed */
+	const void* DataBuffer = nullptr;
+	int32 NumInstances = -1;
+	float SimulationAge = -1.f;
+	/** Hash of everything else that affect the mesh: transform, alpha, cull rect, target mesh section... */
+	uint32 InputHash = 0;
+
+	bool operator==(const FLGUIParticleBuildSignature& Other)const
+	{
+		return DataBuffer == Other.DataBuffer && NumInstances == Other.NumInstances && SimulationAge == Other.SimulationAge && InputHash == Other.InputHash;
+	}
+};
+
+enum class ELGUIParticleRendererType : uint8
+{
+	Unsupported,
+	Sprite,
+	Ribbon,
+};
+
+/**
+ * Data set components of the attributes that mesh build read, resolved once so mesh build don't find variables by name every frame.
+ * Resolved again only when emitter's compiled data change.
+ */
+struct FLGUIParticleBindingPlan
+{
+	ELGUIParticleRendererType RendererType = ELGUIParticleRendererType::Unsupported;
+	/** Data set layout that components are resolved from */
+	const void* CompiledData = nullptr;
+	int32 NumVariables = -1;
+	uint32 TotalFloatComponents = 0;
+	uint32 TotalInt32Components = 0;
+
+	static constexpr int32 NumSpriteStreams = 16;
+	/** Sprite: float component of every FLGUISpriteParticleStreams stream, INDEX_NONE if not bound */
+	int32 SpriteFloatComponents[NumSpriteStreams];
+	/** Int32 component of particle ID's Index, ID's AcquireTag is the next one */
+	int32 IDInt32Component = INDEX_NONE;
+	/** Ribbon: float component of color's R, GBA are next ones */
+	int32 RibbonColorFloatComponent = INDEX_NONE;
+	/** Ribbon: float component of position's X and Z, and width */
+	int32 RibbonPositionXFloatComponent = INDEX_NONE;
+	int32 RibbonPositionZFloatComponent = INDEX_NONE;
+	int32 RibbonWidthFloatComponent = INDEX_NONE;
+
+	/** Resolve components if not resolved for DataSet's current layout */
+	void Update(const class FNiagaraDataSet& DataSet, const UNiagaraRendererProperties* RendererProperties);
+};
 
 struct FLGUINiagaraRendererEntry
 {
@@ -30,6 +117,28 @@ struct FLGUINiagaraRendererEntry
 	TSharedRef<const FNiagaraEmitterInstance, ESPMode::ThreadSafe> EmitterInstance;
 	UNiagaraEmitter* Emitter;
 	UMaterialInterface* Material;
+	/** Emitter's max particle count estimate, for FLGUIParticleMeshCapacitySettings */
+	int32 MaxParticleCount = 0;
+	/** Over particle budget: sprite emit one of every LODStride particles, ribbon keep one of every LODStride points. 1 means full quality */
+	int32 LODStride = 1;
+
+	FLGUISpriteMeshBuildState SpriteBuildState;
+	/** Particle count emitted by last RenderUI, and not emitted because of culling or LODStride */
+	int32 CulledParticleCount = 0;
+	int32 EmittedParticleCount = 0;
+	/** Is index data changed by last RenderUI. */
+	bool bIndicesChanged = true;
+	/** Is mesh rebuilt in last build pass, false if skipped because nothing changed */
+	bool bMeshChanged = true;
+	FLGUIParticleBuildSignature LastBuildSignature;
+	/** Used by mesh build only */
+	FLGUIParticleBindingPlan BindingPlan;
+	/** Sprite: snapshots of particle data published after simulation, mesh build read them instead of niagara data set. lgui.ParticleSystem.Snapshot */
+	TSharedPtr<FLGUISpriteSnapshotRing, ESPMode::ThreadSafe> SpriteSnapshots;
+	/** Sprite: snapshot acquired by current build */
+	const FLGUISpriteParticleSnapshot* SpriteSnapshot = nullptr;
+	/** Ribbon: owned by entry because entries build in parallel */
+	FLGUIRibbonSortScratch RibbonScratch;
 };
 
 UCLASS()
@@ -39,21 +148,76 @@ class LGUI_PARTICLESYSTEM_API ULGUIWorldParticleSystemComponent : public UNiagar
 public:
 	void GetRenderEntries(TArray<FLGUINiagaraRendererEntry>& Renderers);
 
+	/** Set component transform if simulation need it and it change, mesh build don't read component transform. lgui.ParticleSystem.LocalSpaceSkipTransform */
     void SetTransformationForUIRendering(MyVector2 Location, MyVector2 Scale, float Angle);
+	/** Transform that SetTransformationForUIRendering would set, without touching the component. */
+	static FTransform MakeTransformationForUIRendering(MyVector2 Location, MyVector2 Scale, float Angle);
+
+	/** Copy sprite particle data into entry's snapshot ring, call on game thread after simulation is finalized. Ribbon entries are ignored, see FLGUISpriteParticleSnapshot */
+	void PublishSpriteSnapshot(FLGUINiagaraRendererEntry& RendererEntry);
+	/** Update entry's build signature, return false if nothing changed since last build, or nothing to render again after last particle died. */
+	bool UpdateBuildSignature(FLGUINiagaraRendererEntry& RendererEntry, uint32 InputHash);
+	/** AdditionalChannels: ELGUICanvasAdditionalChannelType flags of render canvas, vertex channels that canvas don't have are not written */
+	void RenderUI(FLGUIMeshSection* UIMeshSection, FLGUINiagaraRendererEntry& RendererEntry, const FLGUIParticleRenderTransform& RenderTransform, float ScaleFactor, MyVector2 LocationOffset, float Alpha01, const FLGUIParticleMeshCapacitySettings& MeshCapacity, const FLGUIParticleCullRect& CullRect, uint8 AdditionalChannels);
 
-	void RenderUI(FLGUIMeshSection* UIMeshSection, FLGUINiagaraRendererEntry RendererEntry, float ScaleFactor, MyVector2 LocationOffset, float Alpha01, const int ParticleCountIncreaseAndDecrease);
+	/**
+	 * Sprite mesh build after particle streams are read: cull, LODStride, mesh capacity, quad indices and vertices. Return emitted particle count.
+	 * Capture replay call it with captured streams, so it measure the same path as RenderUI.
+	 */
+	static int32 BuildSpriteMesh(FLGUIMeshSection* UIMeshSection, FLGUISpriteMeshBuildState& BuildState, bool& bOutIndicesChanged
+		, FLGUISpriteParticleStreams& Streams, FLGUISpriteBuildParams& Params, int32 LODStride, int32 MaxParticleCount
+		, const FLGUIParticleMeshCapacitySettings& MeshCapacity, const FLGUIParticleCullRect& CullRect);
+	/**
+	 * Ribbon mesh build after particle streams are read: sort, LODStride, mesh capacity and vertices.
+	 * Caller fill Scratch.SortKeys, and Scratch.RibbonKeys if bMultiRibbons, for Streams.Count particles. ParticleIDIndexData is optional, for LODStride.
+	 */
+	static void BuildRibbonMesh(FLGUIMeshSection* UIMeshSection, FLGUIRibbonSortScratch& Scratch
+		, const FLGUIRibbonParticleStreams& Streams, const FLGUIRibbonBuildParams& Params, bool bMultiRibbons, const int32* ParticleIDIndexData
+		, int32 LODStride, int32 MaxParticleCount, const FLGUIParticleMeshCapacitySettings& MeshCapacity);
+
+	/** Write particle attributes and mesh build inputs of sprite and ribbon render entries to Writer every frame until EndCapture. lgui.ParticleSystem.Capture */
+	void BeginCapture(const TSharedPtr<FLGUIParticleCaptureWriter>& Writer);
+	void EndCapture();
+	bool IsCapturing()const { return CaptureWriter.IsValid(); }
+	/**
+	 * Call on game thread before mesh build with the same inputs as RenderUI, only the first call in a frame is captured, as shared simulation is called by many UIParticleSystems.
+	 * MeshCapacity, CullRect and AdditionalChannels are captured too, so replay allocate, cull and upload the same way.
+	 */
+	void CaptureFrame(const TArray<FLGUINiagaraRendererEntry>& RenderEntries, const FLGUIParticleRenderTransform& RenderTransform, float ScaleFactor, MyVector2 LocationOffset
+		, const FLGUIParticleMeshCapacitySettings& MeshCapacity, const FLGUIParticleCullRect& CullRect, uint8 AdditionalChannels);
 private:
+	/** Any emitter simulate in world space, so particles spawn at component's transform */
+	bool NeedsTransformForSimulation();
+	/** Inputs of last SetRelativeTransform by SetTransformationForUIRendering */
+	bool bUITransformApplied = false;
+	MyVector2 AppliedUILocation = MyVector2::ZeroVector;
+	MyVector2 AppliedUIScale = MyVector2::UnitVector;
+	float AppliedUIAngle = 0.f;
+
+	TSharedPtr<FLGUIParticleCaptureWriter> CaptureWriter;
+	uint32 CaptureSourceId = 0;
+	uint64 LastCaptureFrame = 0;
+	/** Capture's own binding plans, entries' plans belong to mesh build which may run on task graph */
+	TArray<FLGUIParticleBindingPlan> CaptureBindingPlans;
+	/** Ribbon sort inputs copied from data set accessors, so they can be written as streams */
+	TArray<float> CaptureRibbonSortKeys;
+	TArray<int32> CaptureRibbonIDs;
     void AddSpriteRendererData(FLGUIMeshSection* UIMeshSection
-		, TSharedRef<const FNiagaraEmitterInstance, ESPMode::ThreadSafe> EmitterInst
+		, FLGUINiagaraRendererEntry& RendererEntry
 		, UNiagaraSpriteRendererProperties* SpriteRenderer
+		, const FLGUIParticleRenderTransform& RenderTransform
 		, float ScaleFactor, MyVector2 LocationOffset, float Alpha01
-		, const int ParticleCountIncreaseAndDecrease
+		, const FLGUIParticleMeshCapacitySettings& MeshCapacity
+		, const FLGUIParticleCullRect& CullRect
+		, uint8 AdditionalChannels
 	);
     void AddRibbonRendererData(FLGUIMeshSection* UIMeshSection
-		, TSharedRef<const FNiagaraEmitterInstance, ESPMode::ThreadSafe> EmitterInst
+		, FLGUINiagaraRendererEntry& RendererEntry
 		, UNiagaraRibbonRendererProperties* RibbonRenderer
+		, const FLGUIParticleRenderTransform& RenderTransform
 		, float ScaleFactor, MyVector2 LocationOffset, float Alpha01
-		, const int ParticleCountIncreaseAndDecrease
+		, const FLGUIParticleMeshCapacitySettings& MeshCapacity
+		, uint8 AdditionalChannels
 	);
 };
 
@@ -5,9 +5,58 @@
 #include "CoreMinimal.h"
 #include "Core/ActorComponent/UIItem.h"
 #include "Core/Actor/UIBaseActor.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "LGUIParticleMeshCapacity.h"
+#include "LGUIParticleCulling.h"
+#include "LGUIParticleRenderTransform.h"
 #include "UIParticleSystem.generated.h"
 
 class UNiagaraSystem;
+class ULGUIParticleBakedEffect;
+
+/** How often UIParticleSystem rebuild its mesh, previous mesh is kept in skipped frames. */
+UENUM(BlueprintType)
+enum class ELGUIParticleUpdateMode : uint8
+{
+	/** Rebuild mesh every frame. */
+	EveryFrame,
+	/** Rebuild mesh UpdateFrequency times per second, good for background effects. */
+	FixedRate,
+	/** Every frame if any particle is visible, lgui.ParticleSystem.AutoUpdateFrequency if all particles are outside of clip rect or screen. */
+	Automatic,
+};
+
+/** Counters of last mesh build and upload. "stat LGUIParticle" for the whole world, lgui.ParticleSystem.DumpTop for the most expensive ones. */
+USTRUCT(BlueprintType)
+struct LGUI_PARTICLESYSTEM_API FLGUIParticleSystemBuildStats
+{
+	GENERATED_BODY()
+
+	/** Particles that have geometry in mesh */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 Particles = 0;
+	/** Vertex count of all mesh sections, include unused capacity */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 Vertices = 0;
+	/** Vertex and index data size sent to render thread, vertex size only count the channels that are uploaded */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 BytesUploaded = 0;
+	/** Mesh sections that recreate render resource because capacity change */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 Reallocations = 0;
+	/** Time of building mesh, on game thread or task graph */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		float BuildTimeMs = 0.f;
+	/** Sprite particle snapshots published since begin, see lgui.ParticleSystem.Snapshot */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 SnapshotsPublished = 0;
+	/** Snapshots not published because mesh build still hold every slot */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 SnapshotsDropped = 0;
+	/** Snapshots replaced by newer ones before mesh build read them */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "LGUI")
+		int32 SnapshotsStale = 0;
+};
 
 UCLASS(ClassGroup = (LGUI), NotBlueprintable, meta = (BlueprintSpawnableComponent))
 class LGUI_PARTICLESYSTEM_API UUIParticleSystem : public UUIItem
@@ -20,22 +69,103 @@ public:
 	virtual void BeginPlay()override;
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)override;
 	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason)override;
+	/** Bytes of one vertex that LGUI send to render thread: position, color and uv0, then tangent basis and uv1-uv3 only if canvas have the channel */
+	static int32 GetUploadedVertexSize(uint8 AdditionalChannels);
 private:
+	friend class ULGUIParticleSystemSubsystem;
 	TWeakObjectPtr<class ULGUIWorldParticleSystemComponent> ParticleSystemInstance = nullptr;
 	void SetRenderEntries();
 #if WITH_EDITOR
 	virtual void PostEditChangeProperty(struct FPropertyChangedEvent& PropertyChangedEvent) override;
 #endif
 	void OnPaintUpdate();
+	/** Build mesh of all render entries into mesh sections of renderer items, can run on any thread. */
+	void BuildMeshSections(const TArray<TSharedPtr<struct FLGUIMeshSection>>& InMeshSections);
+	/** Gather transform, mesh sections and alpha on game thread, return false if nothing to build. */
+	bool PrepareMeshBuild(TArray<TSharedPtr<struct FLGUIMeshSection>>& OutMeshSections);
+	/** Fill MeshBuildTransform with this UI element's transform in render canvas */
+	void UpdateMeshBuildTransform();
+	/** Alpha of render entries, filled by PrepareMeshBuild */
+	TArray<float> MeshBuildAlphas;
+	/** Hash of render entries' build inputs except particle data, filled by PrepareMeshBuild. lgui.ParticleSystem.SkipUnchanged */
+	TArray<uint32> MeshBuildInputHashes;
+	/** Filled by PrepareMeshBuild */
+	FLGUIParticleCullRect MeshBuildCullRect;
+	FLGUIParticleRenderTransform MeshBuildTransform;
+	/** Additional vertex channels of render canvas that mesh build write and upload. lgui.ParticleSystem.CompactVertex */
+	uint8 MeshBuildChannels = 0;
+	/** Is ParticleSystemInstance a shared simulation of subsystem */
+	bool bUsingSharedSimulation = false;
+	void AcquireParticleSystemInstance();
+	/** Attach ParticleSystemInstance to running lgui.ParticleSystem.Capture */
+	void BeginCaptureIfActive();
+	void ReleaseParticleSystemInstance();
+	void UploadMeshSections();
+
+	/** Called by subsystem after world's actor tick, copy sprite particle data on game thread for mesh build and capture. lgui.ParticleSystem.Snapshot */
+	void PublishParticleSnapshots();
+	/** Called by subsystem after world's actor tick, start building mesh on task graph. lgui.ParticleSystem.AsyncBuild */
+	void BeginAsyncMeshBuild();
+	/** Wait for async mesh build and swap the result into mesh sections. */
+	void FinishAsyncMeshBuild();
+	FGraphEventRef AsyncBuildTask;
+	/** Async build write to these, then swap with mesh sections when finish. */
+	TArray<TSharedPtr<struct FLGUIMeshSection>> AsyncBuildStagingSections;
+	/** Mesh sections that AsyncBuildTask is building for. */
+	TArray<TSharedPtr<struct FLGUIMeshSection>> AsyncBuildTargetSections;
+	bool bAsyncBuildPendingUpload = false;
 
 	TArray<struct FLGUINiagaraRendererEntry> RenderEntries;
 	bool RenderEntriesValid = false;
+	/** Renderer item of each render entry, adjacent entries with same material share one renderer item. lgui.ParticleSystem.MergeRenderers */
+	TArray<int32> RenderEntryRendererIndices;
+	/** Entries that share a renderer item build into these, then merged into renderer item's mesh section */
+	TArray<TSharedPtr<struct FLGUIMeshSection>> RenderEntryMergeSections;
+	/** Entry that must start a new renderer item, because merging it made the mesh exceed index type */
+	TArray<bool> RenderEntryMergeSplits;
+	/** Set by mesh build when a merged mesh exceed index type, the first entry that not fit. Handled on game thread after upload. Should not happen after SplitOverflowingMergeGroups */
+	int32 MeshBuildMergeOverflowEntry = INDEX_NONE;
+	/** Per renderer item, is index data changed by last build */
+	TArray<bool> MeshBuildIndicesChanged;
+	/** Per renderer item, is mesh rebuilt by last build, unchanged mesh is not uploaded */
+	TArray<bool> MeshBuildVerticesChanged;
+	UMaterialInterface* GetRenderEntryMaterial(int32 EntryIndex)const;
+	/** Group render entries by material, and match renderer items to the groups */
+	void UpdateRendererItems();
+	void ReleaseRendererItem(class UUIParticleSystemRendererItem* InItem);
+	/** Acquire or release renderer items until there are Count of them */
+	void SetRendererItemCount(int32 Count);
+	void MergeMeshSections(const TArray<TSharedPtr<struct FLGUIMeshSection>>& InMeshSections);
+	/** Before build, mark entries whose merged mesh may exceed index type in this build as split, return true if any is marked */
+	bool SplitOverflowingMergeGroups();
 	UPROPERTY(Transient)
 		TArray<class UUIParticleSystemRendererItem*> UIParticleSystemRenderers;
-	TSharedPtr<class SLGUIParticleSystemUpdateAgentWidget> UpdateAgentWidget = nullptr;
 
 	UPROPERTY(EditAnywhere, Category = "LGUI")
 		UNiagaraSystem* ParticleSystem;
+	/** Play baked frames of this instead of simulating ParticleSystem, no niagara component is created. */
+	UPROPERTY(EditAnywhere, Category = "LGUI")
+		ULGUIParticleBakedEffect* BakedEffect = nullptr;
+	/** Is BakedEffect played since begin play */
+	bool bUsingBakedEffect = false;
+	/** World time that baked playback begin, negative if stopped */
+	float BakedPlaybackStartTime = -1.f;
+	/** Frame and inputs written into mesh sections by last baked playback, unchanged frame is not written again */
+	int32 BakedPlaybackFrame = INDEX_NONE;
+	uint32 BakedPlaybackInputHash = 0;
+	/** Per renderer item, used index count of baked frame */
+	TArray<int32> BakedIndexCounts;
+	/** One renderer item for each baked entry */
+	void UpdateBakedRendererItems();
+	void BeginBakedPlayback();
+	void UpdateBakedPlayback();
+	/**
+	 * Share one simulation with all UIParticleSystems of the same ParticleSystem that also enable this, each one render the particles at its own transform.
+	 * Good for many identical effects, eg. same sparkle on every inventory cell. World space emitters are rendered as local space.
+	 * Activate, deactivate and reset affect all UIParticleSystems that share the simulation.
+	 */
+	UPROPERTY(EditAnywhere, Category = "LGUI")
+		bool bShareSimulation = false;
 	/** Auto activate particle system when create it in begin play. */
 	UPROPERTY(EditAnywhere, Category = "LGUI", DisplayName = "Auto Activate")
 		bool bAutoActivateParticleSystem = true;
@@ -45,16 +175,65 @@ private:
 	/** Remap material for LGUI to render, if not assigned then use default material in particle system. */
 	UPROPERTY(EditAnywhere, Category = "LGUI")
 		TMap<UMaterialInterface*, UMaterialInterface*> ReplaceMaterialMap;
+	/** How mesh capacity follow particle count. Mesh render resource is only recreated when capacity change. */
+	UPROPERTY(EditAnywhere, Category = "LGUI")
+		FLGUIParticleMeshCapacitySettings MeshCapacity;
+	FLGUIParticleMeshCapacityStats MeshCapacityStats;
+	FLGUIParticleSystemBuildStats BuildStats;
+	FLGUIParticleCullStats CullStats;
+	/** Written by mesh build on any thread, copied to BuildStats and CullStats on game thread when the build finish */
+	FLGUIParticleSystemBuildStats MeshBuildStats;
+	FLGUIParticleCullStats MeshBuildCullStats;
+	void PublishBuildStats();
+	/** When total particle count of world is over lgui.ParticleSystem.ParticleBudget, lower priority UIParticleSystem is decimated first. */
+	UPROPERTY(EditAnywhere, Category = "LGUI")
+		int32 BudgetPriority = 0;
+	/** Decided by subsystem according to particle budget, 1 means full quality. */
+	int32 BudgetStride = 1;
+	UPROPERTY(EditAnywhere, Category = "LGUI")
+		ELGUIParticleUpdateMode UpdateMode = ELGUIParticleUpdateMode::EveryFrame;
+	/** Mesh rebuild per second for FixedRate mode. Rate limited UIParticleSystems are updated round-robin, see lgui.ParticleSystem.MaxRateLimitedUpdatesPerFrame */
+	UPROPERTY(EditAnywhere, Category = "LGUI", meta = (ClampMin = "1.0", EditCondition = "UpdateMode==ELGUIParticleUpdateMode::FixedRate"))
+		float UpdateFrequency = 30.f;
+	/** Pause simulation when this UI element is not active in hierarchy, instead of only skip building mesh. Not work with bShareSimulation. */
+	UPROPERTY(EditAnywhere, Category = "LGUI")
+		bool bPauseWhenHidden = false;
+	/** Set by subsystem: rebuild mesh in this frame */
+	bool bMeshUpdateScheduled = true;
+	/** Real time of last scheduled mesh update, negative if never */
+	double LastMeshUpdateTime = -1.0;
+	/** Simulation is paused by us because of hidden, not by user */
+	bool bPausedByHidden = false;
+	/** Seconds between mesh updates, 0 means every frame */
+	float GetMeshUpdateInterval()const;
+	void SetPausedByHidden(bool bHidden);
 public:
 	UFUNCTION(BlueprintCallable, Category = "LGUI")
 		class ULGUIWorldParticleSystemComponent* GetParticleSystemInstance()const { return ParticleSystemInstance.Get(); }
 	UFUNCTION(BlueprintCallable, Category = "LGUI")
 		UNiagaraSystem* GetParticleSystemTemplate()const { return ParticleSystem; }
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		ULGUIParticleBakedEffect* GetBakedEffect()const { return BakedEffect; }
+	/** Is playing BakedEffect instead of simulating ParticleSystem */
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		bool IsUsingBakedEffect()const { return bUsingBakedEffect; }
 	UFUNCTION(BlueprintCallable, Category = "LGUI")
 		bool GetUseAlpha()const { return bUseAlpha; }
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		bool GetShareSimulation()const { return bShareSimulation; }
 	UFUNCTION(BlueprintCallable, Category = "LGUI")
 		const TMap<UMaterialInterface*, UMaterialInterface*>& GetReplaceMaterialMap()const { return ReplaceMaterialMap; }
 
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		const FLGUIParticleMeshCapacitySettings& GetMeshCapacity()const { return MeshCapacity; }
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		const FLGUIParticleMeshCapacityStats& GetMeshCapacityStats()const { return MeshCapacityStats; }
+	/** Particle count emitted and culled by clip rect or screen in last mesh build */
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		FLGUIParticleCullStats GetCullStats()const;
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		const FLGUIParticleSystemBuildStats& GetBuildStats()const { return BuildStats; }
+
 	UFUNCTION(BlueprintCallable, Category = "LGUI")
 		void SetUseAlpha(bool value);
 	UFUNCTION(BlueprintCallable, Category = "LGUI")
@@ -65,6 +244,29 @@ public:
 		void DeactivateParticleSystem();
 	UFUNCTION(BlueprintCallable, Category = "LGUI")
 		void SetReplaceMaterialMap(const TMap<UMaterialInterface*, UMaterialInterface*>& value);
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		void SetMeshCapacity(const FLGUIParticleMeshCapacitySettings& value);
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		void ResetMeshCapacityStats();
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		int32 GetBudgetPriority()const { return BudgetPriority; }
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		void SetBudgetPriority(int32 value) { BudgetPriority = value; }
+	/** 1 means full quality, N means only one of every N particles is rendered because of particle budget. */
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		int32 GetBudgetStride()const { return BudgetStride; }
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		ELGUIParticleUpdateMode GetUpdateMode()const { return UpdateMode; }
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		void SetUpdateMode(ELGUIParticleUpdateMode value) { UpdateMode = value; }
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		float GetUpdateFrequency()const { return UpdateFrequency; }
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		void SetUpdateFrequency(float value) { UpdateFrequency = FMath::Max(value, 1.0f); }
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		bool GetPauseWhenHidden()const { return bPauseWhenHidden; }
+	UFUNCTION(BlueprintCallable, Category = "LGUI")
+		void SetPauseWhenHidden(bool value);
 };
 
 